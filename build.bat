@@ -12,6 +12,7 @@ echo.
 
 set COMPILER=
 set UNIVAC_BUILD=
+set SOURCES=unigma.c unigma_crib.c unigma_search.c unigma_bombe.c unigma_service.c unigma_memory.c unigma_gzip.c unigma_records.c unigma_engines.c unigma_wiring.c unigma_bench.c
 
 REM ============================================================================
 REM STEP 1: SELECT PLATFORM
@@ -103,8 +104,98 @@ if %ERRORLEVEL% NEQ 0 (
     exit /b 1
 )
 
+echo Compiling unigma_crib.c...
+gcc -c -DUNIVAC -O2 -Wall unigma_crib.c -o unigma_crib_univac.o
+
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile unigma_crib.c
+    pause
+    exit /b 1
+)
+
+echo Compiling unigma_search.c...
+gcc -c -DUNIVAC -O2 -Wall unigma_search.c -o unigma_search_univac.o
+
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile unigma_search.c
+    pause
+    exit /b 1
+)
+
+echo Compiling unigma_bombe.c...
+gcc -c -DUNIVAC -O2 -Wall unigma_bombe.c -o unigma_bombe_univac.o
+
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile unigma_bombe.c
+    pause
+    exit /b 1
+)
+
+echo Compiling unigma_service.c...
+gcc -c -DUNIVAC -O2 -Wall unigma_service.c -o unigma_service_univac.o
+
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile unigma_service.c
+    pause
+    exit /b 1
+)
+
+echo Compiling unigma_memory.c...
+gcc -c -DUNIVAC -O2 -Wall unigma_memory.c -o unigma_memory_univac.o
+
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile unigma_memory.c
+    pause
+    exit /b 1
+)
+
+echo Compiling unigma_gzip.c...
+gcc -c -DUNIVAC -O2 -Wall unigma_gzip.c -o unigma_gzip_univac.o
+
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile unigma_gzip.c
+    pause
+    exit /b 1
+)
+
+echo Compiling unigma_records.c...
+gcc -c -DUNIVAC -O2 -Wall unigma_records.c -o unigma_records_univac.o
+
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile unigma_records.c
+    pause
+    exit /b 1
+)
+
+echo Compiling unigma_engines.c...
+gcc -c -DUNIVAC -O2 -Wall unigma_engines.c -o unigma_engines_univac.o
+
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile unigma_engines.c
+    pause
+    exit /b 1
+)
+
+echo Compiling unigma_wiring.c...
+gcc -c -DUNIVAC -O2 -Wall unigma_wiring.c -o unigma_wiring_univac.o
+
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile unigma_wiring.c
+    pause
+    exit /b 1
+)
+
+echo Compiling unigma_bench.c...
+gcc -c -DUNIVAC -O2 -Wall unigma_bench.c -o unigma_bench_univac.o
+
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile unigma_bench.c
+    pause
+    exit /b 1
+)
+
 echo Linking...
-gcc -o unigma_univac.exe unigma_univac.o
+gcc -o unigma_univac.exe unigma_univac.o unigma_crib_univac.o unigma_search_univac.o unigma_bombe_univac.o unigma_service_univac.o unigma_memory_univac.o unigma_gzip_univac.o unigma_records_univac.o unigma_engines_univac.o unigma_wiring_univac.o unigma_bench_univac.o
 
 if %ERRORLEVEL% EQU 0 (
     echo.
@@ -203,7 +294,7 @@ echo.
 echo Compiling and linking...
 gcc %WARNING_FLAGS% %OPTIMIZE_FLAGS% %PERF_FLAGS% ^
     -o unigma_mingw.exe ^
-    unigma.c ^
+    %SOURCES% ^
     %LINKER_FLAGS%
 
 if %ERRORLEVEL% EQU 0 (
@@ -262,7 +353,7 @@ echo Compiling with MSVC...
 echo.
 
 REM Compile source files
-cl /W4 /O2 /Fe:unigma.exe unigma.c
+cl /W4 /O2 /Fe:unigma.exe %SOURCES%
 
 if %ERRORLEVEL% EQU 0 (
     echo.
@@ -8,13 +8,6 @@
 
 #include "unigma.h"
 
-// Platform-specific string copy
-#ifdef UNIVAC
-#define SAFE_STRCPY(dest, src, size) do { strncpy(dest, src, (size)-1); (dest)[(size)-1] = '\0'; } while(0)
-#else
-#define SAFE_STRCPY(dest, src, size) strcpy_s(dest, size, src)
-#endif
-
 // Rotor wiring constants (matches original R[] array)
 // Input A..Z maps to...
 const char* ROTOR_WIRINGS[NUM_ROTOR_WIRINGS] = {
@@ -24,9 +17,14 @@ const char* ROTOR_WIRINGS[NUM_ROTOR_WIRINGS] = {
     "YRUHQSLDPXNGOKMIEBFZCWVJAT"  /* Reflector B */
 };
 
-// Notch positions constants (matches original N[] array)
+// Notch positions (matches original N[] array), replaced by a --machine model
 // Q, E, V for rotors I, II, III (16, 4, 21 in 0-indexed)
-const int NOTCH_POSITIONS_INIT[NUM_ROTORS] = { 16, 4, 21 };
+int NOTCH_POSITIONS_INIT[NUM_ROTORS] = { 16, 4, 21 };
+
+// Every rotor order, slot-indexed (right, middle, left); the first is the default I-II-III
+const int ROTOR_ORDERS[NUM_ROTOR_ORDERS][NUM_ROTORS] = {
+    { 2, 1, 0 }, { 1, 2, 0 }, { 2, 0, 1 }, { 0, 2, 1 }, { 1, 0, 2 }, { 0, 1, 2 }
+};
 
 // Alphabet constant for reference
 static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
@@ -38,17 +36,76 @@ int main(int argc, char* argv[]) {
 #endif
 
     EnigmaState state;
+    RunOptions options;
+    RunStats stats;
     init_enigma(&state);
+    memset(&options, 0, sizeof(RunOptions));
+    options.replay_speed = 1.0;
+    memset(&stats, 0, sizeof(RunStats));
 
     // If no command-line arguments, use interactive configuration
     if (argc == 1) {
         interactive_config(&state);
     } else {
         // Parse command-line arguments for runtime configuration
-        parse_arguments(argc, argv, &state);
+        parse_arguments(argc, argv, &state, &options);
+    }
+
+    if (options.scorer_path) {
+        options.scorer = load_scorer(options.scorer_path);
+    }
+
+    if (options.mode == MODE_RECORDS && options.record_format != RECORD_LINES) {
+        run_structured_records(&state, &options, &stats);
+    } else if (options.mode == MODE_RECORDS) {
+        run_records(&state, &stats);
+    } else if (options.mode == MODE_KEYED_RECORDS) {
+        run_keyed_records(&state, &options, &stats);
+    } else if (options.mode == MODE_BUILD_INDEX) {
+        run_build_index(&state, &options);
+    } else if (options.mode == MODE_LOOKUP_INDEX) {
+        run_lookup_index(&state, &options);
+    } else if (options.mode == MODE_DAILY_KEY) {
+        run_daily_key(&state, &options);
+    } else if (options.mode == MODE_BOMBE) {
+        run_bombe(&state, &options);
+    } else if (options.mode == MODE_PLACE_CRIBS) {
+        run_place_cribs(&options);
+    } else if (options.mode == MODE_LIVE) {
+        run_live(&state, &options);
+    } else if (options.mode == MODE_ATTACK) {
+        run_attack(&state, &options);
+    } else if (options.mode == MODE_TURNOVER) {
+        run_turnover(&state, &options);
+    } else if (options.mode == MODE_RECOVER_WIRING) {
+        run_recover_wiring(&state, &options);
+    } else if (options.mode == MODE_BENCH_ENGINES) {
+        run_engine_benchmark(&state);
+    } else if (options.mode == MODE_BENCH_THREADS) {
+        run_thread_benchmark(&state, &options);
+    } else if (options.mode == MODE_SERVE) {
+        run_serve(&state, &options, &stats);
+    } else if (options.mode == MODE_REPLAY) {
+        run_replay(&state, &options, &stats);
+    } else if (options.verify) {
+        run_verified(&state, &stats);
+    } else if (options.ita2_input || options.ita2_output) {
+        // ITA2 input may start with LTRS, which looks like gzip's first byte
+        run_enigma(&state, &options);
+    } else if (options.input_path || options.output_path || options.compress_output ||
+               options.threads > 1 || input_may_be_compressed(stdin)) {
+        run_file_stream(&state, &options, &stats);
+    } else {
+        run_enigma(&state, &options);
+    }
+
+    if (options.show_stats) {
+        print_stats(&stats);
     }
 
-    run_enigma(&state);
+    if (stats.verify_mismatches) {
+        return 2;
+    }
 
     return 0;
 }
@@ -71,11 +128,15 @@ void init_enigma(EnigmaState* state) {
     init_plugboard(state);
 }
 
-// Initialize rotor wirings
+// Initialize rotor wirings (order I-II-III, rings AAA)
 void init_rotors(EnigmaState* state) {
     for (int i = 0; i < NUM_ROTOR_WIRINGS; i++) {
         SAFE_STRCPY(state->rotors[i].wiring, ROTOR_WIRINGS[i], ALPHABET_SIZE + 1);
     }
+    for (int slot = 0; slot < NUM_ROTORS; slot++) {
+        state->rotor_order[slot] = NUM_ROTORS - 1 - slot;  // Right slot holds rotor III
+        state->ring_settings[slot] = 0;
+    }
 }
 
 // Initialize notch positions
@@ -111,11 +172,57 @@ int idx(const char* s, int c) {
     return -1;
 }
 
+// Helper: Read one line, newline included, into a growable buffer.
+// Returns the number of bytes read, or -1 at end of input.
+long read_line(FILE* in, char** buffer, size_t* capacity) {
+    size_t len = 0;
+    int c;
+
+    while ((c = getc(in)) != EOF) {
+        if (len + 1 >= *capacity) {
+            size_t new_capacity = *capacity ? *capacity * 2 : 128;
+            char* grown = (char*)memory_realloc(MEM_IO, *buffer, new_capacity);
+            if (!grown) {
+                fprintf(stderr, "Error: Out of memory reading input\n");
+                exit(1);
+            }
+            *buffer = grown;
+            *capacity = new_capacity;
+        }
+        (*buffer)[len++] = (char)c;
+        if (c == '\n') {
+            break;
+        }
+    }
+
+    if (len == 0 && c == EOF) {
+        return -1;
+    }
+    (*buffer)[len] = '\0';
+    return (long)len;
+}
+
+// Helper: Index of the lowest set bit (de Bruijn multiply; bits must not be 0)
+int lowest_bit(unsigned long long bits) {
+    static const unsigned char DE_BRUIJN[64] = {
+         0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6
+    };
+    return DE_BRUIJN[((bits & (~bits + 1)) * 0x03F79D71B4CB0A89ULL) >> 58];
+}
+
 // Helper: Modulo 26 positive
 int mod_positive(int a) {
     return (a % ALPHABET_SIZE + ALPHABET_SIZE) % ALPHABET_SIZE;
 }
 
+// Helper: Offset of the wiring in a slot (rotor position less ring setting)
+int rotor_offset(const EnigmaState* state, int slot) {
+    return mod_positive(state->positions[slot] - state->ring_settings[slot]);
+}
+
 // Helper: Map through rotor
 // k: input character (0-25)
 // rotor_index: which rotor to use (0=I, 1=II, 2=III, 3=Reflector)
@@ -159,6 +266,216 @@ char apply_plugboard(char c, const char* plugboard) {
     return c;  // No swap found
 }
 
+// Pass one letter (0-25) through the rotors and reflector at the current
+// positions, without the plugboard.
+int scramble_letter(int c, const EnigmaState* state) {
+    // Forward through rotors: Right -> Middle -> Left
+    c = encode_through_rotor(c, 2, rotor_offset(state, 0), 0, state);  // Right  (III)
+    c = encode_through_rotor(c, 1, rotor_offset(state, 1), 0, state);  // Middle (II)
+    c = encode_through_rotor(c, 0, rotor_offset(state, 2), 0, state);  // Left   (I)
+
+    // REFLECTOR B (Fixed)
+    c = idx(ALPHABET, state->rotors[3].wiring[c]);
+
+    // Reverse through rotors: Left -> Middle -> Right
+    c = encode_through_rotor(c, 0, rotor_offset(state, 2), 1, state);  // Left   (I) Rev
+    c = encode_through_rotor(c, 1, rotor_offset(state, 1), 1, state);  // Middle (II) Rev
+    c = encode_through_rotor(c, 2, rotor_offset(state, 0), 1, state);  // Right  (III) Rev
+
+    return c;
+}
+
+// Encipher one letter (0-25) at the current rotor positions, plugboard included.
+// The caller is responsible for stepping the rotors first.
+int encipher_letter(int c, const EnigmaState* state) {
+    // PLUGBOARD (Input)
+    c = apply_plugboard((char)(c + 'A'), state->plugboard) - 'A';
+
+    c = scramble_letter(c, state);
+
+    // PLUGBOARD (Output)
+    return apply_plugboard((char)(c + 'A'), state->plugboard) - 'A';
+}
+
+// Build the full substitution for the current rotor positions.
+// table[i] is the cipher letter for letter i; table[PASS_THROUGH] maps to itself
+// so padded lanes can be pushed through the same lookup.
+void build_substitution(const EnigmaState* state, unsigned char table[ALPHABET_SIZE + 1]) {
+    unsigned char scrambler[ALPHABET_SIZE];
+    int plug[ALPHABET_SIZE];
+
+    build_scrambler(state, scrambler);
+    build_plug_map(state->plugboard, plug);
+    conjugate_table(scrambler, plug, table);
+}
+
+// Fused tables
+//
+// The full substitution at a rotor position is P o S o P, where S is the
+// plugboard-free scrambler and P the plugboard. S depends only on the rotor
+// positions, so it is compiled once; any plugboard is then applied by
+// conjugating the cached S tables, which is a pair of lookups per entry.
+
+// Convert a plugboard string into a permutation of 0-25
+void build_plug_map(const char* plugboard, int plug[ALPHABET_SIZE]) {
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        int c = apply_plugboard((char)('A' + i), plugboard);
+        plug[i] = (c >= 'A' && c <= 'Z') ? c - 'A' : i;
+    }
+}
+
+// Build the plugboard-free scrambler for the current rotor positions.
+// The scrambler is reciprocal, so each pass through the rotors fills two entries.
+void build_scrambler(const EnigmaState* state, unsigned char table[ALPHABET_SIZE]) {
+    memset(table, PASS_THROUGH, ALPHABET_SIZE);
+
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        if (table[i] == PASS_THROUGH) {
+            int j = scramble_letter(i, state);
+            table[i] = (unsigned char)j;
+            table[j] = (unsigned char)i;
+        }
+    }
+}
+
+// fused = P o S o P, plus the pass-through entry
+void conjugate_table(const unsigned char* scrambler, const int plug[ALPHABET_SIZE], unsigned char* fused) {
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        fused[i] = (unsigned char)plug[scrambler[plug[i]]];
+    }
+    fused[ALPHABET_SIZE] = PASS_THROUGH;
+}
+
+// Start an empty set of tables for the key in state (positions are the start
+// positions; the first compiled table is for the position after one step)
+void init_fused_tables(FusedTables* tables, const EnigmaState* state) {
+    memset(tables, 0, sizeof(FusedTables));
+    tables->next = *state;
+    build_plug_map(state->plugboard, tables->plug);
+}
+
+// Start over with a different key, keeping the memory already allocated
+void reset_fused_tables(FusedTables* tables, const EnigmaState* state) {
+    tables->length = 0;
+    tables->next = *state;
+    build_plug_map(state->plugboard, tables->plug);
+}
+
+// Allocate room for at least capacity positions (and their record lanes)
+void reserve_fused_tables(FusedTables* tables, size_t capacity) {
+    if (capacity <= tables->capacity) {
+        return;
+    }
+
+    size_t grown = tables->capacity ? tables->capacity : 64;
+    while (grown < capacity) {
+        grown *= 2;
+    }
+    unsigned char* scrambler = (unsigned char*)memory_realloc(MEM_TABLES, tables->scrambler, grown * ALPHABET_SIZE);
+    unsigned char* fused = !scrambler ? NULL :
+        (unsigned char*)memory_realloc(MEM_TABLES, tables->fused, grown * (ALPHABET_SIZE + 1));
+    unsigned char* lanes = !fused ? NULL :
+        (unsigned char*)memory_realloc(MEM_TABLES, tables->lanes, grown * RECORD_BATCH);
+    if (!lanes) {
+        fprintf(stderr, "Error: Out of memory compiling tables\n");
+        exit(1);
+    }
+    tables->scrambler = scrambler;
+    tables->fused = fused;
+    tables->lanes = lanes;
+    tables->capacity = grown;
+}
+
+// Make sure at least length positions are compiled. Already compiled
+// positions are kept, so a growing message only pays for the new ones.
+void compile_fused_tables(FusedTables* tables, size_t length) {
+    if (length <= tables->length) {
+        return;
+    }
+
+    UNIGMA_PROBE3(compile__start, tables, tables->length, length);
+    reserve_fused_tables(tables, length);
+    for (size_t k = tables->length; k < length; k++) {
+        unsigned char* scrambler = tables->scrambler + k * ALPHABET_SIZE;
+
+        step_rotors(&tables->next);
+        build_scrambler(&tables->next, scrambler);
+        conjugate_table(scrambler, tables->plug, tables->fused + k * (ALPHABET_SIZE + 1));
+    }
+    UNIGMA_PROBE3(compile__end, tables, tables->length, length);
+    tables->length = length;
+}
+
+// Switch every compiled table to a different plugboard without touching the rotors
+void rekey_fused_plugboard(FusedTables* tables, const char* plugboard) {
+    build_plug_map(plugboard, tables->plug);
+
+    for (size_t k = 0; k < tables->length; k++) {
+        conjugate_table(tables->scrambler + k * ALPHABET_SIZE, tables->plug,
+                        tables->fused + k * (ALPHABET_SIZE + 1));
+    }
+}
+
+// Make to a copy of from (positions, scrambler and fused tables and plug)
+void copy_fused_tables(FusedTables* to, const FusedTables* from) {
+    reserve_fused_tables(to, from->length);
+    memcpy(to->scrambler, from->scrambler, from->length * ALPHABET_SIZE);
+    memcpy(to->fused, from->fused, from->length * (ALPHABET_SIZE + 1));
+    memcpy(to->plug, from->plug, sizeof(to->plug));
+    to->length = from->length;
+    to->next = from->next;
+}
+
+// Connect letters a and b (0-25) with a cable, unplugging whatever they were
+// connected to before (a == b unplugs a). Only the entries for the (up to four) letters whose
+// plug changed, and their images, are rewritten in each table.
+void swap_fused_cable(FusedTables* tables, int a, int b) {
+    int changed[4];
+    int count = 0;
+
+    changed[count++] = a;
+    changed[count++] = b;
+    if (tables->plug[a] != a && tables->plug[a] != b) {
+        changed[count++] = tables->plug[a];
+    }
+    if (tables->plug[b] != b && tables->plug[b] != a) {
+        changed[count++] = tables->plug[b];
+    }
+
+    // Unplug the old partners, then connect a <-> b
+    tables->plug[tables->plug[a]] = tables->plug[a];
+    tables->plug[tables->plug[b]] = tables->plug[b];
+    tables->plug[a] = b;
+    tables->plug[b] = a;
+
+    // The fused tables are involutions, so setting x -> y also sets y -> x.
+    // Any entry whose value changed is either a changed letter or the image
+    // of one, so this covers every difference.
+    for (size_t k = 0; k < tables->length; k++) {
+        const unsigned char* scrambler = tables->scrambler + k * ALPHABET_SIZE;
+        unsigned char* fused = tables->fused + k * (ALPHABET_SIZE + 1);
+
+        for (int i = 0; i < count; i++) {
+            int x = changed[i];
+            int y = tables->plug[scrambler[tables->plug[x]]];
+            fused[x] = (unsigned char)y;
+            fused[y] = (unsigned char)x;
+        }
+    }
+}
+
+// Release table memory
+void free_fused_tables(FusedTables* tables) {
+    memory_free(tables->scrambler);
+    memory_free(tables->fused);
+    memory_free(tables->lanes);
+    tables->scrambler = NULL;
+    tables->fused = NULL;
+    tables->lanes = NULL;
+    tables->length = 0;
+    tables->capacity = 0;
+}
+
 // Stepping mechanism (implements the "Double Step" anomaly)
 void step_rotors(EnigmaState* state) {
     // Rotor 2 (Middle) steps if it is at notch, moving Rotor 3 (Left)
@@ -175,10 +492,66 @@ void step_rotors(EnigmaState* state) {
 }
 
 // Main encryption loop
-void run_enigma(EnigmaState* state) {
+void run_enigma(EnigmaState* state, const RunOptions* options) {
+    char block[STREAM_BLOCK];
+    size_t length;
+
+    if (options->ita2_input || options->ita2_output) {
+        // A shift code goes out ahead of at most every character
+        unsigned char teletype[2 * STREAM_BLOCK];
+        Teletype tty;
+
+        init_teletype(&tty, options->ita2_input, options->ita2_output);
+        for (;;) {
+            // 5-bit input has no lines to answer one by one
+            length = options->ita2_input ? fread(block, 1, sizeof(block), stdin)
+                                         : read_block(stdin, block, sizeof(block));
+            if (length == 0) {
+                break;
+            }
+            UNIGMA_PROBE3(block__start, "ita2", length, PROBE_POSITION(state->positions));
+            size_t written = teletype_block(&tty, state, (unsigned char*)block, length, teletype);
+            UNIGMA_PROBE4(block__end, "ita2", length, PROBE_POSITION(state->positions), written);
+            fwrite(teletype, 1, written, stdout);
+            fflush(stdout);
+        }
+        if (tty.dropped) {
+            fprintf(stderr, "Warning: %lu characters have no ITA2 code and were left out\n", tty.dropped);
+        }
+        return;
+    }
+
+    while ((length = read_block(stdin, block, sizeof(block))) > 0) {
+        UNIGMA_PROBE3(block__start, "direct", length, PROBE_POSITION(state->positions));
+        size_t letters = encrypt_block(state, block, length);
+        UNIGMA_PROBE4(block__end, "direct", length, PROBE_POSITION(state->positions), letters);
+        fwrite(block, 1, length, stdout);
+    }
+}
+
+// Read up to size bytes, stopping after a newline so that interactive
+// input is answered line by line. Returns 0 at end of input.
+size_t read_block(FILE* in, char* buffer, size_t size) {
+    size_t length = 0;
     int c;
 
-    while ((c = getchar()) != EOF) {
+    while (length < size && (c = getc(in)) != EOF) {
+        buffer[length++] = (char)c;
+        if (c == '\n') {
+            break;
+        }
+    }
+    return length;
+}
+
+// Encrypt a block in place, continuing from the rotor positions in state.
+// Returns the number of letters enciphered.
+size_t encrypt_block(EnigmaState* state, char* buffer, size_t length) {
+    size_t letters = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        int c = (unsigned char)buffer[i];
+
         // Convert lowercase to uppercase
         if (c >= 'a' && c <= 'z') {
             c -= 32;
@@ -186,180 +559,1117 @@ void run_enigma(EnigmaState* state) {
 
         // Pass through non-alphabetic characters
         if (c < 'A' || c > 'Z') {
-            putchar(c);
             continue;
         }
 
         // STEPPING MECHANISM (The "Double Step" Anomaly)
         step_rotors(state);
 
-        // PLUGBOARD (Input)
-        c = apply_plugboard((char)c, state->plugboard);
-
-        // ENCRYPTION PATH
-        c = c - 'A';  // Convert to 0-25 range
-
-        // Forward through rotors: Right -> Middle -> Left
-        c = encode_through_rotor(c, 2, state->positions[0], 0, state);  // Right  (III)
-        c = encode_through_rotor(c, 1, state->positions[1], 0, state);  // Middle (II)
-        c = encode_through_rotor(c, 0, state->positions[2], 0, state);  // Left   (I)
-
-        // REFLECTOR B (Fixed)
-        c = idx(ALPHABET, state->rotors[3].wiring[c]);
+        buffer[i] = (char)(encipher_letter(c - 'A', state) + 'A');
+        letters++;
+    }
+    return letters;
+}
 
-        // Reverse through rotors: Left -> Middle -> Right
-        c = encode_through_rotor(c, 0, state->positions[2], 1, state);  // Left   (I) Rev
-        c = encode_through_rotor(c, 1, state->positions[1], 1, state);  // Middle (II) Rev
-        c = encode_through_rotor(c, 2, state->positions[0], 1, state);  // Right  (III) Rev
+// Parallel blocks
+//
+// Only letters step the rotors, so where a piece of a block starts in the
+// key stream depends on how many letters come before it, not how many
+// bytes. A block is encrypted in two parallel passes: the first counts the
+// letters of every piece, a prefix sum over the counts gives each piece's
+// start, the rotors are jumped ahead to it, and the second pass encrypts the
+// pieces from their exact start positions. The output is byte for byte the
+// serial output.
+
+// Number of letters (A-Z, a-z) in buffer. Eight bytes at a time: folding
+// the case bit maps exactly the letters onto 'a'-'z', and a byte-wise range
+// test (bytes with the top bit set never match) marks them.
+size_t count_letters(const char* buffer, size_t length) {
+    const unsigned long long ones = 0x0101010101010101ULL;
+    const unsigned long long low7 = 0x7F7F7F7F7F7F7F7FULL;
+    size_t letters = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8) {
+        unsigned long long word;
+        memcpy(&word, buffer + i, 8);
+
+        unsigned long long folded = (word | (ones * 0x20)) & low7;
+        unsigned long long above = folded + ones * (127 - 'z');   // top bit: byte > 'z'
+        unsigned long long from = folded + ones * (128 - 'a');    // top bit: byte >= 'a'
+        unsigned long long hits = from & ~above & ~word & (ones * 0x80);
+        letters += (size_t)(((hits >> 7) * ones) >> 56);
+    }
+    for (; i < length; i++) {
+        int c = (unsigned char)buffer[i] | 0x20;
+        letters += c >= 'a' && c <= 'z';
+    }
+    return letters;
+}
 
-        c = c + 'A';  // Convert back to ASCII
+// Step the rotors as many times as letters would. Stepping depends on the
+// positions alone, so after NUM_POSITIONS steps the machine is on its cycle;
+// long jumps walk onto the cycle, measure it and skip the whole laps.
+void advance_rotors(EnigmaState* state, unsigned long long letters) {
+    if (letters > 3ULL * NUM_POSITIONS) {
+        EnigmaState lap;
+        unsigned long long period = 0;
 
-        // PLUGBOARD (Output)
-        c = apply_plugboard((char)c, state->plugboard);
+        for (int i = 0; i < NUM_POSITIONS; i++) {
+            step_rotors(state);
+        }
+        letters -= NUM_POSITIONS;
+
+        lap = *state;
+        do {
+            step_rotors(&lap);
+            period++;
+        } while (memcmp(lap.positions, state->positions, sizeof(lap.positions)) != 0);
+        letters %= period;
+    }
+    while (letters-- > 0) {
+        step_rotors(state);
+    }
+}
 
-        putchar(c);
+typedef struct {
+    char* buffer;
+    int counting;                               // First pass: count, second: encrypt
+    size_t bounds[PARALLEL_MAX_CHUNKS + 1];     // Piece k is bounds[k] to bounds[k + 1]
+    size_t letters[PARALLEL_MAX_CHUNKS];
+    EnigmaState starts[PARALLEL_MAX_CHUNKS];
+} ParallelBlock;
+
+static void parallel_block_worker(void* context, int worker) {
+    ParallelBlock* block = (ParallelBlock*)context;
+    char* piece = block->buffer + block->bounds[worker];
+    size_t length = block->bounds[worker + 1] - block->bounds[worker];
+
+    if (block->counting) {
+        block->letters[worker] = count_letters(piece, length);
+    } else {
+        encrypt_block(&block->starts[worker], piece, length);
     }
 }
 
-// Runtime configuration functions
+// encrypt_block split over up to threads threads; returns the letter count
+size_t encrypt_block_parallel(EnigmaState* state, char* buffer, size_t length, int threads) {
+    ParallelBlock block;
+    int pieces = (int)(length / PARALLEL_CHUNK);
+    size_t total = 0;
 
-// Interactive configuration (for teletype/terminal use)
-void interactive_config(EnigmaState* state) {
-    char input[256];
+    if (pieces > threads) {
+        pieces = threads;
+    }
+    if (pieces > PARALLEL_MAX_CHUNKS) {
+        pieces = PARALLEL_MAX_CHUNKS;
+    }
+    UNIGMA_PROBE3(block__start, "parallel", length, PROBE_POSITION(state->positions));
+    if (pieces < 2) {
+        total = encrypt_block(state, buffer, length);
+        UNIGMA_PROBE4(block__end, "parallel", length, PROBE_POSITION(state->positions), total);
+        return total;
+    }
 
-    printf("UNIGMA: THE LITTLE UNIVAC ENIGMA SIMULATOR\n");
-    printf("ROTORS: I, II, III | REFLECTOR: B\n");
-    printf("\n");
-    printf("--- CONFIGURATION ---\n");
-    printf("\n");
+    block.buffer = buffer;
+    for (int k = 0; k <= pieces; k++) {
+        block.bounds[k] = length / pieces * k;
+    }
+    block.bounds[pieces] = length;
 
-    // Get rotor positions
-    printf("ROTOR POSITIONS (3 LETTERS A-Z, PRESS ENTER FOR AAA): ");
-    fflush(stdout);
+    block.counting = 1;
+    run_workers(pieces, parallel_block_worker, &block);
 
-    if (fgets(input, sizeof(input), stdin) != NULL) {
-        // Remove newline
-        size_t len = strlen(input);
-        if (len > 0 && input[len - 1] == '\n') {
-            input[len - 1] = '\0';
-            len--;
-        }
+    // Prefix sum: each piece starts where the letters before it leave the rotors
+    block.starts[0] = *state;
+    for (int k = 1; k < pieces; k++) {
+        block.starts[k] = block.starts[k - 1];
+        advance_rotors(&block.starts[k], block.letters[k - 1]);
+        total += block.letters[k - 1];
+    }
+    total += block.letters[pieces - 1];
 
-        // If empty, use default (already set to AAA)
-        if (len > 0) {
-            // Trim whitespace
-            char* start = input;
-            while (*start == ' ' || *start == '\t') start++;
+    block.counting = 0;
+    run_workers(pieces, parallel_block_worker, &block);
+    *state = block.starts[pieces - 1];
+    UNIGMA_PROBE4(block__end, "parallel", length, PROBE_POSITION(state->positions), total);
+    return total;
+}
 
-            if (*start != '\0') {
-                set_rotor_positions(state, start);
-                printf("POSITIONS SET TO: %c%c%c\n",
-                       'A' + state->positions[2],
-                       'A' + state->positions[1],
-                       'A' + state->positions[0]);
-            } else {
-                printf("USING DEFAULT: AAA\n");
+// ITA2 teleprinter code
+//
+// Each character is a 5-bit code whose meaning depends on the shift: LTRS
+// and FIGS switch the receiver between letters and figures and print
+// nothing. Teletype streams are decoded, enciphered and re-encoded in one
+// pass over the block: in letters shift a code is a letter and goes through
+// the machine, anything else passes through. The encoder only sends a shift
+// code when the next character is not in the receiver's current shift, so
+// ITA2 in and out reproduces the input's shifts code for code.
+//
+// Codes as numbered by their five bits, first bit least significant. The
+// figures left to national use in ITA2 (F, G, H) take the US teletype ones;
+// 0x05 is who-are-you (WRU) and 0x07 the bell.
+static const char ITA2_DECODE[2][32] = {
+    { '\0', 'E', '\n', 'A', ' ', 'S', 'I', 'U', '\r', 'D', 'R', 'J', 'N', 'F', 'C', 'K',
+      'T', 'Z', 'L', 'W', 'H', 'Y', 'P', 'Q', 'O', 'B', 'G', '\0', 'M', 'X', 'V', '\0' },
+    { '\0', '3', '\n', '-', ' ', '\'', '8', '7', '\r', 0x05, '4', 0x07, ',', '!', ':', '(',
+      '5', '+', ')', '2', '#', '6', '0', '1', '9', '?', '&', '\0', '.', '/', '=', '\0' }
+};
+
+// ITA2 code of each byte, plus which shifts it can be sent in; 0 = none
+#define ITA2_IN_LETTERS 0x20
+#define ITA2_IN_FIGURES 0x40
+static unsigned char ita2_encode[256];
+
+void init_teletype(Teletype* tty, int input, int output) {
+    memset(tty, 0, sizeof(Teletype));
+    tty->input = input;
+    tty->output = output;
+    // Teletype to teletype, both ends start in letters like the input does;
+    // otherwise the first character is preceded by its shift
+    tty->out_shift = input ? ITA2_LTRS : 0;
+
+    if (!ita2_encode['A']) {
+        for (int code = 0; code < 32; code++) {
+            if (code == ITA2_LTRS || code == ITA2_FIGS) {
+                continue;
             }
-        } else {
-            printf("USING DEFAULT: AAA\n");
+            ita2_encode[(unsigned char)ITA2_DECODE[0][code]] |= (unsigned char)(code | ITA2_IN_LETTERS);
+            ita2_encode[(unsigned char)ITA2_DECODE[1][code]] |= (unsigned char)(code | ITA2_IN_FIGURES);
         }
     }
+}
 
-    printf("\n");
+// Decode, encrypt and encode length input bytes into out, continuing from
+// the rotor positions and shifts already reached. out needs room for
+// 2 x length bytes. Returns the number of bytes written.
+size_t teletype_block(Teletype* tty, EnigmaState* state, const unsigned char* in, size_t length,
+                      unsigned char* out) {
+    size_t written = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        int c = in[i];
+
+        if (tty->input) {
+            int code = c & 0x1F;
+
+            if (code == ITA2_LTRS || code == ITA2_FIGS) {
+                tty->in_figures = code == ITA2_FIGS;
+                if (tty->output) {
+                    out[written++] = (unsigned char)code;
+                    tty->out_shift = code;
+                }
+                continue;
+            }
+            c = (unsigned char)ITA2_DECODE[tty->in_figures][code];
+            if (c == '\0' && !tty->output) {
+                continue;  // Blank tape
+            }
+        } else if (c >= 'a' && c <= 'z') {
+            c -= 32;
+        }
 
-    // Get plugboard configuration
-    printf("PLUGBOARD PAIRS (E.G. 'AB CD EF', PRESS ENTER FOR NONE): ");
-    fflush(stdout);
+        if (c >= 'A' && c <= 'Z') {
+            step_rotors(state);
+            c = encipher_letter(c - 'A', state) + 'A';
+        }
 
-    if (fgets(input, sizeof(input), stdin) != NULL) {
-        // Remove newline
-        size_t len = strlen(input);
-        if (len > 0 && input[len - 1] == '\n') {
-            input[len - 1] = '\0';
-            len--;
+        if (!tty->output) {
+            out[written++] = (unsigned char)c;
+            continue;
         }
 
-        // Trim whitespace
-        char* start = input;
-        while (*start == ' ' || *start == '\t') start++;
+        int encoded = ita2_encode[c];
+        if (encoded == 0) {
+            tty->dropped++;
+            continue;
+        }
+        int shift = tty->out_shift == ITA2_FIGS ? ITA2_IN_FIGURES : ITA2_IN_LETTERS;
+        if (tty->out_shift == 0 || !(encoded & shift)) {
+            tty->out_shift = (encoded & ITA2_IN_LETTERS) ? ITA2_LTRS : ITA2_FIGS;
+            out[written++] = (unsigned char)tty->out_shift;
+        }
+        out[written++] = (unsigned char)(encoded & 0x1F);
+    }
+    return written;
+}
 
-        if (*start != '\0') {
-            set_plugboard(state, start);
-            printf("PLUGBOARD SET TO: %s\n", state->plugboard);
-        } else {
-            printf("NO PLUGBOARD\n");
+// Self-verifying stream mode
+//
+// The machine is its own inverse, so every block is checked right after it
+// is encrypted: the output is run back through a compiled-table machine
+// started from a checkpoint of the rotor positions, and must reproduce the
+// (uppercased) input. The second engine shares no code with encipher_letter
+// beyond the wiring strings, so a fault in either one shows up as a mismatch.
+void run_verified(EnigmaState* state, RunStats* stats) {
+    char input[STREAM_BLOCK];
+    char output[STREAM_BLOCK];
+    CompiledMachine machine;
+    unsigned long offset = 0;
+    size_t length;
+
+    compile_machine(state, &machine);
+
+    while ((length = read_block(stdin, input, sizeof(input))) > 0) {
+        EnigmaState checkpoint = *state;
+
+        // No newline can come before the end of either magic, so the first
+        // block holds all of it
+        if (offset == 0 && has_compressed_magic((const unsigned char*)input, length)) {
+            fprintf(stderr, "Error: --verify reads plain text; decompress the input first\n");
+            exit(1);
         }
+
+        memcpy(output, input, length);
+        stats->letters += encrypt_block(state, output, length);
+        stats->verify_mismatches += verify_block(&checkpoint, &machine, input, output, length, offset, stats);
+        stats->verified_blocks++;
+
+        fwrite(output, 1, length, stdout);
+        offset += (unsigned long)length;
     }
 
-    printf("\n");
-    printf("--- READY TO ENCRYPT/DECRYPT ---\n");
-    printf("ENTER TEXT (CTRL+Z OR CTRL+D TO END):\n");
-    printf("\n");
-    fflush(stdout);
+    if (stats->verify_mismatches) {
+        fprintf(stderr, "Verify: %lu mismatched byte(s) in %lu block(s)\n",
+                stats->verify_mismatches, stats->verified_blocks);
+    }
 }
 
-// Print usage information
-void print_usage(const char* program_name) {
-    fprintf(stderr, "Unigma: The Little UNIVAC Enigma Simulator\n");
-    fprintf(stderr, "Usage: %s [OPTIONS]\n\n", program_name);
-    fprintf(stderr, "Options:\n");
-    fprintf(stderr, "  -p POSITIONS    Set rotor positions (3 letters A-Z, default: AAA)\n");
-    fprintf(stderr, "                  Example: -p XYZ\n");
-    fprintf(stderr, "  -b PLUGBOARD    Set plugboard pairs (space-separated pairs)\n");
-    fprintf(stderr, "                  Example: -b \"AB CD EF\"\n");
-    fprintf(stderr, "  -s              Show current configuration and exit\n");
-    fprintf(stderr, "  -h              Show this help message\n\n");
-    fprintf(stderr, "Examples:\n");
-    fprintf(stderr, "  %s -p AAA                    # Start at position AAA\n", program_name);
-    fprintf(stderr, "  %s -p XYZ -b \"AB CD\"         # Custom position and plugboard\n", program_name);
-    fprintf(stderr, "  echo \"HELLO\" | %s -p QWE    # Encrypt with position QWE\n\n", program_name);
-    fprintf(stderr, "Rotors: I, II, III | Reflector: B\n");
-}
+// Compile the wiring strings and plugboard into lookup arrays
+void compile_machine(const EnigmaState* state, CompiledMachine* machine) {
+    int plug[ALPHABET_SIZE];
 
-// Print current configuration
-void print_current_config(const EnigmaState* state) {
-    char pos_str[4];
-    pos_str[0] = 'A' + state->positions[2];  // Left rotor
-    pos_str[1] = 'A' + state->positions[1];  // Middle rotor
-    pos_str[2] = 'A' + state->positions[0];  // Right rotor
-    pos_str[3] = '\0';
+    for (int slot = 0; slot < NUM_ROTORS; slot++) {
+        const char* wiring = state->rotors[NUM_ROTORS - 1 - slot].wiring;  // Right slot holds rotor III
+        for (int i = 0; i < ALPHABET_SIZE; i++) {
+            int out = wiring[i] - 'A';
+            machine->forward[slot][i] = (unsigned char)out;
+            machine->reverse[slot][out] = (unsigned char)i;
+        }
+    }
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        machine->reflector[i] = (unsigned char)(state->rotors[3].wiring[i] - 'A');
+    }
+    for (int slot = 0; slot < NUM_ROTORS; slot++) {
+        machine->rings[slot] = state->ring_settings[slot];
+    }
 
-    fprintf(stderr, "=== Enigma Configuration ===\n");
-    fprintf(stderr, "Rotors:     I, II, III\n");
-    fprintf(stderr, "Reflector:  B\n");
-    fprintf(stderr, "Positions:  %s (Left: %c, Middle: %c, Right: %c)\n",
-            pos_str, pos_str[0], pos_str[1], pos_str[2]);
-    fprintf(stderr, "Plugboard:  %s\n",
-            state->plugboard[0] ? state->plugboard : "(none)");
-    fprintf(stderr, "===========================\n");
+    build_plug_map(state->plugboard, plug);
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        machine->plug[i] = (unsigned char)plug[i];
+    }
 }
 
-// Set rotor positions from string (e.g., "ABC" or "XYZ")
-void set_rotor_positions(EnigmaState* state, const char* positions) {
-    if (!positions || strlen(positions) != 3) {
-        fprintf(stderr, "Error: Rotor positions must be exactly 3 letters (A-Z)\n");
-        exit(1);
+// Encipher one letter (0-25) with the compiled arrays at the given positions
+int compiled_encipher(int c, const int positions[NUM_ROTORS], const CompiledMachine* machine) {
+    int p[NUM_ROTORS];
+
+    for (int slot = 0; slot < NUM_ROTORS; slot++) {
+        p[slot] = mod_positive(positions[slot] - machine->rings[slot]);
     }
 
-    for (int i = 0; i < 3; i++) {
-        char c = positions[i];
-        if (c >= 'a' && c <= 'z') {
-            c -= 32;  // Convert to uppercase
+    c = machine->plug[c];
+    for (int slot = 0; slot < NUM_ROTORS; slot++) {
+        c = (machine->forward[slot][(c + p[slot]) % ALPHABET_SIZE] + ALPHABET_SIZE - p[slot]) % ALPHABET_SIZE;
+    }
+    c = machine->reflector[c];
+    for (int slot = NUM_ROTORS - 1; slot >= 0; slot--) {
+        c = (machine->reverse[slot][(c + p[slot]) % ALPHABET_SIZE] + ALPHABET_SIZE - p[slot]) % ALPHABET_SIZE;
+    }
+    return machine->plug[c];
+}
+
+// Re-encrypt output from the checkpoint and compare with input.
+// Mismatches are reported with their offset in the stream; returns the count.
+size_t verify_block(const EnigmaState* checkpoint, const CompiledMachine* machine,
+                    const char* input, const char* output, size_t length,
+                    unsigned long offset, RunStats* stats) {
+    EnigmaState replay = *checkpoint;
+    size_t mismatches = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        int expected = toupper((unsigned char)input[i]);
+        int c = (unsigned char)output[i];
+
+        if (c >= 'A' && c <= 'Z') {
+            step_rotors(&replay);
+            c = compiled_encipher(c - 'A', replay.positions, machine) + 'A';
         }
-        if (c < 'A' || c > 'Z') {
-            fprintf(stderr, "Error: Invalid rotor position '%c'. Must be A-Z.\n", positions[i]);
-            exit(1);
+
+        if (c != expected) {
+            if (stats->verify_mismatches + mismatches < MAX_VERIFY_REPORTS) {
+                fprintf(stderr, "Verify: mismatch at offset %lu (input 0x%02X, round trip 0x%02X)\n",
+                        offset + (unsigned long)i, (unsigned char)input[i], (unsigned)c);
+            }
+            mismatches++;
         }
     }
-
-    // Positions are specified as Left-Middle-Right, but stored as Right-Middle-Left
-    state->positions[2] = positions[0] - 'A';  // Left rotor
-    state->positions[1] = positions[1] - 'A';  // Middle rotor
-    state->positions[0] = positions[2] - 'A';  // Right rotor
+    return mismatches;
 }
 
-// Set plugboard configuration
-void set_plugboard(EnigmaState* state, const char* plugboard_config) {
+// Record mode: every input line is a separate message under the same key.
+// Lines are collected into batches of RECORD_BATCH and encrypted side by side.
+// The key is the same for every batch, so tables compiled for one batch are
+// reused by the next and only extended when a longer record turns up.
+void run_records(const EnigmaState* state, RunStats* stats) {
+    FusedTables tables;
+    char* records[RECORD_BATCH];
+    size_t capacities[RECORD_BATCH];
+    size_t lengths[RECORD_BATCH];
+    unsigned long batches = 0;
+    int done = 0;
+
+    memset(records, 0, sizeof(records));
+    memset(capacities, 0, sizeof(capacities));
+    init_fused_tables(&tables, state);
+
+    while (!done) {
+        int count = 0;
+        while (count < RECORD_BATCH) {
+            long len = read_line(stdin, &records[count], &capacities[count]);
+            if (len < 0) {
+                done = 1;
+                break;
+            }
+            lengths[count++] = (size_t)len;
+        }
+
+        if (count == 0) {
+            break;
+        }
+
+        encrypt_record_batch(&tables, records, lengths, count);
+        stats->records += (unsigned long)count;
+        batches++;
+
+        for (int r = 0; r < count; r++) {
+            fwrite(records[r], 1, lengths[r], stdout);
+        }
+    }
+
+    for (int r = 0; r < RECORD_BATCH; r++) {
+        memory_free(records[r]);
+    }
+    // One key, compiled for the first batch and reused by the rest
+    stats->key_groups = batches ? 1 : 0;
+    stats->table_misses = batches ? 1 : 0;
+    stats->table_hits = batches ? batches - 1 : 0;
+    free_fused_tables(&tables);
+}
+
+// Letter index (0-25) of a record byte, or -1. ASCII only, so the count and
+// the gather below agree whatever the locale.
+static int record_letter(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    }
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a';
+    }
+    return -1;
+}
+
+// Encrypt up to RECORD_BATCH records in place, each from the start of the key
+// the tables were initialised with. The letters are transposed offset-major:
+// row k holds letter k of every record, so one substitution table per rotor
+// position is applied to the whole row. Records with fewer letters are
+// padded with PASS_THROUGH lanes. Non-letters never enter the lanes and so
+// do not step the rotors, exactly as in run_enigma.
+void encrypt_record_batch(FusedTables* tables, char** records, const size_t* lengths, int count) {
+    size_t letters[RECORD_BATCH];
+    size_t max_letters = 0;
+
+    for (int r = 0; r < count; r++) {
+        letters[r] = 0;
+        for (size_t i = 0; i < lengths[r]; i++) {
+            if (record_letter((unsigned char)records[r][i]) >= 0) {
+                letters[r]++;
+            }
+        }
+        if (letters[r] > max_letters) {
+            max_letters = letters[r];
+        }
+    }
+
+    if (max_letters == 0) {
+        return;
+    }
+
+    // The lanes live with the tables, so a batch allocates nothing once the
+    // tables are long enough
+    compile_fused_tables(tables, max_letters);
+    unsigned char* lanes = tables->lanes;
+    memset(lanes, PASS_THROUGH, max_letters * RECORD_BATCH);
+
+    // Gather: letter k of record r goes to lanes[k][r]
+    for (int r = 0; r < count; r++) {
+        size_t k = 0;
+        for (size_t i = 0; i < lengths[r]; i++) {
+            int c = record_letter((unsigned char)records[r][i]);
+            if (c >= 0) {
+                lanes[k++ * RECORD_BATCH + r] = (unsigned char)c;
+            }
+        }
+    }
+
+    // One table per rotor position, applied across the row
+    for (size_t k = 0; k < max_letters; k++) {
+        const unsigned char* table = tables->fused + k * (ALPHABET_SIZE + 1);
+        unsigned char* row = lanes + k * RECORD_BATCH;
+
+        for (int r = 0; r < RECORD_BATCH; r++) {
+            row[r] = table[row[r]];
+        }
+    }
+
+    // Scatter the enciphered letters back over the original letters
+    for (int r = 0; r < count; r++) {
+        size_t k = 0;
+        for (size_t i = 0; i < lengths[r]; i++) {
+            if (record_letter((unsigned char)records[r][i]) >= 0) {
+                records[r][i] = (char)('A' + lanes[k++ * RECORD_BATCH + r]);
+            }
+        }
+    }
+}
+
+// Keyed record mode
+//
+// Each line is "KEY<TAB>PAYLOAD" where KEY is the rotor positions, optionally
+// followed by ":" and plugboard pairs (e.g. "XYZ:AB CD"). Only the payload is
+// encrypted. Lines are read in windows of KEYED_WINDOW, grouped by canonical
+// key and each key is always handed to the same worker, so a worker's compiled
+// tables stay in its cache instead of bouncing between keys. The window itself
+// is the reorder buffer: records are encrypted in place and written back in
+// input order.
+
+typedef struct {
+    char* line;
+    size_t capacity;
+    size_t length;
+    size_t payload;        // Offset of the payload within line
+    int valid;             // Key field parsed
+    unsigned long hash;    // Hash of the canonical key, picks the worker
+    CanonicalKey key;
+} KeyedRecord;
+
+typedef struct {
+    const EnigmaState* base;
+    KeyedRecord** order;   // Records sorted by key
+    size_t* group_start;   // Index into order where each key group begins (plus end marker)
+    size_t groups;
+    int workers;
+    KeyCache* caches;      // One per worker
+} KeyedWindow;
+
+// Build the canonical key for a machine
+void canonical_key(const EnigmaState* state, CanonicalKey* key) {
+    int plug[ALPHABET_SIZE];
+
+    memset(key, 0, sizeof(CanonicalKey));
+    for (int i = 0; i < NUM_ROTORS; i++) {
+        key->order[i] = (unsigned char)state->rotor_order[i];
+        key->rings[i] = (unsigned char)mod_positive(state->ring_settings[i]);
+        key->positions[i] = (unsigned char)mod_positive(state->positions[i]);
+    }
+    build_plug_map(state->plugboard, plug);
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        key->plug[i] = (unsigned char)plug[i];
+    }
+}
+
+static unsigned long hash_canonical_key(const CanonicalKey* key) {
+    const unsigned char* p = (const unsigned char*)key;
+    unsigned long hash = 2166136261UL;
+
+    for (size_t i = 0; i < sizeof(CanonicalKey); i++) {
+        hash = (hash ^ p[i]) * 16777619UL;
+    }
+    return hash & 0xFFFFFFFFUL;
+}
+
+// Parse the key field of a keyed record into a machine based on base.
+// Returns 0 and the payload offset on success, -1 if the key is malformed.
+int parse_record_key(const char* line, size_t length, const EnigmaState* base, EnigmaState* machine, size_t* payload) {
+    size_t tab = 0;
+
+    while (tab < length && line[tab] != '\t') {
+        tab++;
+    }
+    if (tab == length || tab < 3) {
+        return -1;
+    }
+
+    *machine = *base;
+    for (int i = 0; i < 3; i++) {
+        int c = toupper((unsigned char)line[i]);
+        if (c < 'A' || c > 'Z') {
+            return -1;
+        }
+        machine->positions[2 - i] = c - 'A';  // Given Left-Middle-Right
+    }
+
+    machine->plugboard[0] = '\0';
+    if (tab > 3) {
+        size_t len = tab - 4;
+        if (line[3] != ':' || len >= MAX_PLUGBOARD_LEN) {
+            return -1;
+        }
+        for (size_t i = 0; i < len; i++) {
+            machine->plugboard[i] = (char)toupper((unsigned char)line[4 + i]);
+        }
+        machine->plugboard[len] = '\0';
+    }
+
+    *payload = tab + 1;
+    return 0;
+}
+
+// Find the compiled tables for a key, compiling them on a miss.
+// The least recently used entry is evicted when the cache is full, and
+// further entries while the tables are over their memory limit.
+FusedTables* key_cache_lookup(KeyCache* cache, const CanonicalKey* key, const EnigmaState* machine) {
+    KeyCacheEntry* victim = &cache->entries[0];
+
+    cache->clock++;
+    for (int i = 0; i < KEY_CACHE_SLOTS; i++) {
+        KeyCacheEntry* entry = &cache->entries[i];
+        if (entry->valid && memcmp(&entry->key, key, sizeof(CanonicalKey)) == 0) {
+            entry->last_used = cache->clock;
+            cache->hits++;
+            UNIGMA_PROBE2(cache__hit, i, key);
+            return &entry->tables;
+        }
+        if (!entry->valid || (victim->valid && entry->last_used < victim->last_used)) {
+            victim = entry;
+        }
+    }
+
+    cache->misses++;
+    UNIGMA_PROBE2(cache__miss, (int)(victim - cache->entries), key);
+    victim->valid = 0;
+
+    // Over the table memory limit: drop the least recently used keys first
+    while (memory_over_limit(MEM_TABLES)) {
+        KeyCacheEntry* oldest = NULL;
+        for (int i = 0; i < KEY_CACHE_SLOTS; i++) {
+            KeyCacheEntry* entry = &cache->entries[i];
+            if (entry->valid && (!oldest || entry->last_used < oldest->last_used)) {
+                oldest = entry;
+            }
+        }
+        if (!oldest) {
+            break;
+        }
+        free_fused_tables(&oldest->tables);
+        oldest->valid = 0;
+        memory_note_eviction(MEM_TABLES);
+    }
+    victim->key = *key;
+    victim->valid = 1;
+    victim->last_used = cache->clock;
+    reset_fused_tables(&victim->tables, machine);  // Reuses the evicted key's memory
+    return &victim->tables;
+}
+
+void free_key_cache(KeyCache* cache) {
+    for (int i = 0; i < KEY_CACHE_SLOTS; i++) {
+        free_fused_tables(&cache->entries[i].tables);
+        cache->entries[i].valid = 0;
+    }
+}
+
+// Sort by key, then by input position so a group keeps its input order
+static int compare_keyed_records(const void* a, const void* b) {
+    const KeyedRecord* x = *(const KeyedRecord* const*)a;
+    const KeyedRecord* y = *(const KeyedRecord* const*)b;
+    int order = memcmp(&x->key, &y->key, sizeof(CanonicalKey));
+
+    if (order != 0) {
+        return order;
+    }
+    return (x < y) ? -1 : (x > y);
+}
+
+// Worker: encrypt every key group whose hash maps to this worker. Placement
+// is by key hash alone and the workers are not pinned, so a key's tables stay
+// with one worker but not with one processor or NUMA node (layout_cpu does
+// that only for --bench-threads --pin).
+static void keyed_window_worker(void* context, int worker) {
+    KeyedWindow* window = (KeyedWindow*)context;
+    KeyCache* cache = &window->caches[worker];
+    char* payloads[RECORD_BATCH];
+    size_t lengths[RECORD_BATCH];
+
+    for (size_t g = 0; g < window->groups; g++) {
+        KeyedRecord** first = window->order + window->group_start[g];
+        size_t count = window->group_start[g + 1] - window->group_start[g];
+
+        if ((int)(first[0]->hash % (unsigned long)window->workers) != worker) {
+            continue;
+        }
+
+        // Rebuild the machine from the first record's key field
+        EnigmaState machine;
+        size_t payload;
+        parse_record_key(first[0]->line, first[0]->length, window->base, &machine, &payload);
+        FusedTables* tables = key_cache_lookup(cache, &first[0]->key, &machine);
+
+        for (size_t i = 0; i < count; i += RECORD_BATCH) {
+            int batch = (count - i < RECORD_BATCH) ? (int)(count - i) : RECORD_BATCH;
+            for (int r = 0; r < batch; r++) {
+                KeyedRecord* record = first[i + r];
+                payloads[r] = record->line + record->payload;
+                lengths[r] = record->length - record->payload;
+            }
+            encrypt_record_batch(tables, payloads, lengths, batch);
+        }
+    }
+}
+
+void run_keyed_records(const EnigmaState* state, const RunOptions* options, RunStats* stats) {
+    encrypt_keyed_records(state, stdin, stdout, options->threads > 0 ? options->threads : default_thread_count(), stats);
+}
+
+// Keyed record mode from in to out over workers threads
+void encrypt_keyed_records(const EnigmaState* state, FILE* in, FILE* out, int workers, RunStats* stats) {
+    KeyedRecord* records = (KeyedRecord*)memory_calloc(MEM_IO, KEYED_WINDOW, sizeof(KeyedRecord));
+    KeyedRecord** order = (KeyedRecord**)memory_alloc(MEM_IO, KEYED_WINDOW * sizeof(KeyedRecord*));
+    size_t* group_start = (size_t*)memory_alloc(MEM_IO, (KEYED_WINDOW + 1) * sizeof(size_t));
+    KeyCache* caches = (KeyCache*)memory_calloc(MEM_KEY_CACHE, (size_t)workers, sizeof(KeyCache));
+    unsigned long line_number = 0;
+    int done = 0;
+
+    if (!records || !order || !group_start || !caches) {
+        fprintf(stderr, "Error: Out of memory in keyed record mode\n");
+        exit(1);
+    }
+    memory_evictor(MEM_TABLES, 1);  // The caches keep the tables under their limit
+
+    while (!done) {
+        size_t count = 0;
+        size_t keyed = 0;
+
+        // Fill the window
+        while (count < KEYED_WINDOW) {
+            KeyedRecord* record = &records[count];
+            long len = read_line(in, &record->line, &record->capacity);
+            EnigmaState machine;
+
+            if (len < 0) {
+                done = 1;
+                break;
+            }
+            line_number++;
+            record->length = (size_t)len;
+            record->valid = parse_record_key(record->line, record->length, state, &machine, &record->payload) == 0;
+            if (record->valid) {
+                canonical_key(&machine, &record->key);
+                record->hash = hash_canonical_key(&record->key);
+                order[keyed++] = record;
+            } else {
+                fprintf(stderr, "Warning: Record %lu has no valid key, copied unchanged\n", line_number);
+                stats->bad_keys++;
+            }
+            count++;
+        }
+
+        if (count == 0) {
+            break;
+        }
+
+        // Group by key
+        qsort(order, keyed, sizeof(KeyedRecord*), compare_keyed_records);
+        size_t groups = 0;
+        for (size_t i = 0; i < keyed; i++) {
+            if (i == 0 || memcmp(&order[i]->key, &order[i - 1]->key, sizeof(CanonicalKey)) != 0) {
+                group_start[groups++] = i;
+            }
+        }
+        group_start[groups] = keyed;
+
+        KeyedWindow window;
+        window.base = state;
+        window.order = order;
+        window.group_start = group_start;
+        window.groups = groups;
+        window.workers = workers;
+        window.caches = caches;
+        run_workers(workers, keyed_window_worker, &window);
+
+        // Drain the reorder buffer in input order
+        for (size_t i = 0; i < count; i++) {
+            fwrite(records[i].line, 1, records[i].length, out);
+        }
+
+        stats->records += count;
+        stats->key_groups += groups;
+    }
+
+    for (int w = 0; w < workers; w++) {
+        stats->table_hits += caches[w].hits;
+        stats->table_misses += caches[w].misses;
+        free_key_cache(&caches[w]);
+    }
+    memory_evictor(MEM_TABLES, -1);
+    for (size_t i = 0; i < KEYED_WINDOW; i++) {
+        memory_free(records[i].line);
+    }
+    memory_free(records);
+    memory_free(order);
+    memory_free(group_start);
+    memory_free(caches);
+}
+
+// Print run statistics (only the counters the chosen mode fills in)
+void print_stats(const RunStats* stats) {
+    unsigned long lookups = stats->table_hits + stats->table_misses;
+
+    fprintf(stderr, "=== Unigma Statistics ===\n");
+    if (stats->records) {
+        fprintf(stderr, "Records:          %lu\n", stats->records);
+        if (stats->fields) {
+            fprintf(stderr, "Fields:           %lu\n", stats->fields);
+        }
+        fprintf(stderr, "Key groups:       %lu (per window)\n", stats->key_groups);
+    }
+    if (stats->bad_keys) {
+        fprintf(stderr, "Bad keys:         %lu\n", stats->bad_keys);
+    }
+    if (lookups) {
+        fprintf(stderr, "Table cache:      %lu hits, %lu misses (%.1f%% hit rate)\n",
+                stats->table_hits, stats->table_misses,
+                100.0 * (double)stats->table_hits / (double)lookups);
+    }
+    if (stats->letters) {
+        fprintf(stderr, "Letters:          %lu\n", stats->letters);
+    }
+    if (stats->verified_blocks) {
+        fprintf(stderr, "Verified blocks:  %lu (%lu mismatches)\n",
+                stats->verified_blocks, stats->verify_mismatches);
+    }
+    if (stats->requests) {
+        fprintf(stderr, "Requests:         %lu\n", stats->requests);
+        fprintf(stderr, "Latency (us):     p50 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+                latency_percentile(&stats->latency, 50.0), latency_percentile(&stats->latency, 99.0),
+                latency_percentile(&stats->latency, 99.9), stats->latency.max);
+        if (stats->shed_latency || stats->shed_quota) {
+            fprintf(stderr, "Shed (BUSY):      %lu over latency target, %lu over tenant quota\n",
+                    stats->shed_latency, stats->shed_quota);
+        }
+    }
+    if (stats->bytes_in || stats->bytes_out) {
+        fprintf(stderr, "Stream bytes:     %llu in, %llu out\n", stats->bytes_in, stats->bytes_out);
+    }
+    if (stats->queue_full_waits || stats->queue_empty_waits) {
+        fprintf(stderr, "Queue waits:      %lu for room, %lu for work\n",
+                stats->queue_full_waits, stats->queue_empty_waits);
+    }
+    if (stats->capture_bytes) {
+        fprintf(stderr, "Capture:          %llu bytes\n", stats->capture_bytes);
+    }
+    print_memory_stats();
+    fprintf(stderr, "=========================\n");
+}
+
+// Runtime configuration functions
+
+// Interactive configuration (for teletype/terminal use)
+void interactive_config(EnigmaState* state) {
+    char input[256];
+
+    printf("UNIGMA: THE LITTLE UNIVAC ENIGMA SIMULATOR\n");
+    printf("ROTORS: I, II, III | REFLECTOR: B\n");
+    printf("\n");
+    printf("--- CONFIGURATION ---\n");
+    printf("\n");
+
+    // Get rotor positions
+    printf("ROTOR POSITIONS (3 LETTERS A-Z, PRESS ENTER FOR AAA): ");
+    fflush(stdout);
+
+    if (fgets(input, sizeof(input), stdin) != NULL) {
+        // Remove newline
+        size_t len = strlen(input);
+        if (len > 0 && input[len - 1] == '\n') {
+            input[len - 1] = '\0';
+            len--;
+        }
+
+        // If empty, use default (already set to AAA)
+        if (len > 0) {
+            // Trim whitespace
+            char* start = input;
+            while (*start == ' ' || *start == '\t') start++;
+
+            if (*start != '\0') {
+                set_rotor_positions(state, start);
+                printf("POSITIONS SET TO: %c%c%c\n",
+                       'A' + state->positions[2],
+                       'A' + state->positions[1],
+                       'A' + state->positions[0]);
+            } else {
+                printf("USING DEFAULT: AAA\n");
+            }
+        } else {
+            printf("USING DEFAULT: AAA\n");
+        }
+    }
+
+    printf("\n");
+
+    // Get plugboard configuration
+    printf("PLUGBOARD PAIRS (E.G. 'AB CD EF', PRESS ENTER FOR NONE): ");
+    fflush(stdout);
+
+    if (fgets(input, sizeof(input), stdin) != NULL) {
+        // Remove newline
+        size_t len = strlen(input);
+        if (len > 0 && input[len - 1] == '\n') {
+            input[len - 1] = '\0';
+            len--;
+        }
+
+        // Trim whitespace
+        char* start = input;
+        while (*start == ' ' || *start == '\t') start++;
+
+        if (*start != '\0') {
+            set_plugboard(state, start);
+            printf("PLUGBOARD SET TO: %s\n", state->plugboard);
+        } else {
+            printf("NO PLUGBOARD\n");
+        }
+    }
+
+    printf("\n");
+    printf("--- READY TO ENCRYPT/DECRYPT ---\n");
+    printf("ENTER TEXT (CTRL+Z OR CTRL+D TO END):\n");
+    printf("\n");
+    fflush(stdout);
+}
+
+// Print usage information
+void print_usage(const char* program_name) {
+    fprintf(stderr, "Unigma: The Little UNIVAC Enigma Simulator\n");
+    fprintf(stderr, "Usage: %s [OPTIONS]\n\n", program_name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -p POSITIONS    Set rotor positions (3 letters A-Z, default: AAA)\n");
+    fprintf(stderr, "                  Example: -p XYZ\n");
+    fprintf(stderr, "  -b PLUGBOARD    Set plugboard pairs (space-separated pairs)\n");
+    fprintf(stderr, "                  Example: -b \"AB CD EF\"\n");
+    fprintf(stderr, "  -o ORDER        Set rotor order, left to right (default: 123)\n");
+    fprintf(stderr, "                  Example: -o 312\n");
+    fprintf(stderr, "  -g RINGS        Set ring settings (3 letters A-Z, default: AAA)\n");
+    fprintf(stderr, "  -i FILE         Read the message from FILE instead of stdin\n");
+    fprintf(stderr, "  -O FILE         Write the result to FILE instead of stdout\n");
+    fprintf(stderr, "  --gzip          Compress the output with gzip (implied by -O NAME.gz);\n");
+    fprintf(stderr, "                  gzip input is recognised and decompressed on its own\n");
+    fprintf(stderr, "  --ita2-in       Read the message as ITA2 teleprinter code, one 5-bit code\n");
+    fprintf(stderr, "                  per byte, following the LTRS and FIGS shifts\n");
+    fprintf(stderr, "  --ita2-out      Write the result as ITA2 teleprinter code; characters\n");
+    fprintf(stderr, "                  with no ITA2 code are left out\n");
+    fprintf(stderr, "  -r              Record mode: encrypt each line as a separate message,\n");
+    fprintf(stderr, "                  every line starting from the same rotor positions\n");
+    fprintf(stderr, "  --format csv|tsv|jsonl\n");
+    fprintf(stderr, "                  Record mode on structured records: encrypt each field\n");
+    fprintf(stderr, "                  as its own message and leave the rest as it is\n");
+    fprintf(stderr, "  --fields LIST   Fields to encrypt: column numbers (csv, tsv) or top-level\n");
+    fprintf(stderr, "                  key names (jsonl), comma-separated (default: all)\n");
+    fprintf(stderr, "  --header        Leave the first record (a header row) unchanged\n");
+    fprintf(stderr, "  -k              Keyed record mode: each line is KEY<TAB>TEXT, where KEY is\n");
+    fprintf(stderr, "                  the positions, optionally followed by :PLUGBOARD\n");
+    fprintf(stderr, "                  Example line: XYZ:AB CD<TAB>HELLO\n");
+    fprintf(stderr, "  -t THREADS      Worker threads for keyed records (default: one per CPU);\n");
+    fprintf(stderr, "                  in stream mode, encrypt each block on THREADS threads\n");
+    fprintf(stderr, "  --stats         Print run statistics to stderr when done\n");
+    fprintf(stderr, "  --mem-limit CATEGORY=SIZE\n");
+    fprintf(stderr, "                  Cap the memory of tables, keycache, sessions, search, io or\n");
+    fprintf(stderr, "                  models (e.g. tables=64M); over the tables limit the key\n");
+    fprintf(stderr, "                  caches of -k and --serve evict, otherwise the run stops\n");
+    fprintf(stderr, "                  with an error\n");
+    fprintf(stderr, "  --verify        Check every block by decrypting it again with a second\n");
+    fprintf(stderr, "                  engine; mismatches are reported and the exit status is 2\n");
+    fprintf(stderr, "  --build-index FILE CRIB\n");
+    fprintf(stderr, "                  Index the ciphertext CRIB produces under every rotor order\n");
+    fprintf(stderr, "                  and start position (with the -g rings and -b plugboard)\n");
+    fprintf(stderr, "  --lookup-index FILE CIPHERTEXT\n");
+    fprintf(stderr, "                  List the keys whose crib encryption matches CIPHERTEXT\n");
+    fprintf(stderr, "  --daily-key FILE\n");
+    fprintf(stderr, "                  Recover the rotor order, rings and plugboard shared by the\n");
+    fprintf(stderr, "                  messages in FILE (one per line) and each message's start\n");
+    fprintf(stderr, "                  position\n");
+    fprintf(stderr, "  --bombe FILE    Run crib menus (CIPHERTEXT<TAB>CRIB<TAB>OFFSET per line)\n");
+    fprintf(stderr, "                  over every rotor order and start position with the -g\n");
+    fprintf(stderr, "                  rings, and list the stops of each menu\n");
+    fprintf(stderr, "  --place-cribs FILE\n");
+    fprintf(stderr, "                  Write a bombe menu for every place a crib in FILE (one per\n");
+    fprintf(stderr, "                  line) can lie in the messages on stdin or -i (one per line)\n");
+    fprintf(stderr, "  --attack FILE   Recover the whole key of the message in FILE from its\n");
+    fprintf(stderr, "                  ciphertext alone: positions, rings, plugboard and final\n");
+    fprintf(stderr, "                  scoring run as concurrent stages\n");
+    fprintf(stderr, "  --scorer FILE   Score the --attack position search and --turnover with the\n");
+    fprintf(stderr, "                  plug-in DLL in FILE instead of the built-in IoC\n");
+    fprintf(stderr, "  --turnover FILE Try every turnover point of the right and middle rotors\n");
+    fprintf(stderr, "                  around the -o/-g/-p/-b key on the message in FILE and\n");
+    fprintf(stderr, "                  show where the rotors turn over in the best decrypts\n");
+    fprintf(stderr, "  --machine FILE  Use the rotor and reflector wirings and notches of the\n");
+    fprintf(stderr, "                  machine model in FILE instead of rotors I-III and UKW-B\n");
+    fprintf(stderr, "  --recover-wiring ROTOR FILE\n");
+    fprintf(stderr, "                  Recover the wiring of rotor ROTOR (1-3, or R for the\n");
+    fprintf(stderr, "                  reflector) from messages in FILE sent on the -o/-g/-p/-b key\n");
+    fprintf(stderr, "                  (CIPHERTEXT<TAB>PLAINTEXT, or CIPHERTEXT alone for messages\n");
+    fprintf(stderr, "                  in depth) and write the result as a machine model\n");
+    fprintf(stderr, "  --live          Rank rotor orders and start positions (with the -g rings\n");
+    fprintf(stderr, "                  and -b plugboard) while the intercept arrives on stdin,\n");
+    fprintf(stderr, "                  updating and pruning after every line\n");
+    fprintf(stderr, "  --stage-threads P,R,G,F\n");
+    fprintf(stderr, "                  Threads for the --attack positions, rings, plugboard and\n");
+    fprintf(stderr, "                  final stages (default: -t threads split between them)\n");
+    fprintf(stderr, "  --bench-engines Time the direct, compiled, fused, segment, position-table\n");
+    fprintf(stderr, "                  and digram engines on the same text under the -o/-g/-b key\n");
+    fprintf(stderr, "  --bench-threads N\n");
+    fprintf(stderr, "                  Time file, record, search and service mode at 1, 2, 4 ... N\n");
+    fprintf(stderr, "                  threads and write speedup, thread balance and queue waits\n");
+    fprintf(stderr, "                  as JSON\n");
+    fprintf(stderr, "  --pin compact|scatter\n");
+    fprintf(stderr, "                  With --bench-threads, pin worker w to processor w, or deal\n");
+    fprintf(stderr, "                  the workers out over the NUMA nodes\n");
+    fprintf(stderr, "  --serve         Answer keyed requests (-k line format) one at a time as\n");
+    fprintf(stderr, "                  they arrive: ID<TAB>OK<TAB>TEXT or ID<TAB>ERR<TAB>REASON\n");
+    fprintf(stderr, "  --busy-poll     With --serve or --replay, pin the service threads and spin\n");
+    fprintf(stderr, "                  instead of sleeping, with all request memory pre-faulted;\n");
+    fprintf(stderr, "                  each thread gets a processor, so -t is at most one less\n");
+    fprintf(stderr, "                  than the processor count (and is by default)\n");
+    fprintf(stderr, "  --latency-target US\n");
+    fprintf(stderr, "                  With --serve or --replay, answer ID<TAB>BUSY<TAB>REASON once\n");
+    fprintf(stderr, "                  requests keep waiting longer than US microseconds in the queue\n");
+    fprintf(stderr, "  --tenant-quota N\n");
+    fprintf(stderr, "                  With --serve or --replay, answer BUSY for a key's requests\n");
+    fprintf(stderr, "                  beyond N queued or in service at once\n");
+    fprintf(stderr, "                  (both need -t 2 or more, so the service has a queue)\n");
+    fprintf(stderr, "  --capture FILE  With --serve, log request times, keys and lengths to FILE\n");
+    fprintf(stderr, "  --capture-payload\n");
+    fprintf(stderr, "                  Also log request payloads\n");
+    fprintf(stderr, "  --replay FILE   Replay a capture against the service and report\n");
+    fprintf(stderr, "                  throughput and latency percentiles\n");
+    fprintf(stderr, "  --speed X       Replay at X times the captured rate, or max (default: 1)\n");
+    fprintf(stderr, "  -s              Show current configuration and exit\n");
+    fprintf(stderr, "  -h              Show this help message\n\n");
+    fprintf(stderr, "Examples:\n");
+    fprintf(stderr, "  %s -p AAA                    # Start at position AAA\n", program_name);
+    fprintf(stderr, "  %s -p XYZ -b \"AB CD\"         # Custom position and plugboard\n", program_name);
+    fprintf(stderr, "  echo \"HELLO\" | %s -p QWE    # Encrypt with position QWE\n", program_name);
+    fprintf(stderr, "  %s -r -p QWE < column.txt    # Encrypt every line from QWE\n\n", program_name);
+    fprintf(stderr, "Rotors: I, II, III (any order) | Reflector: B\n");
+}
+
+// Print current configuration
+void print_current_config(const EnigmaState* state) {
+    char pos_str[4];
+    pos_str[0] = 'A' + state->positions[2];  // Left rotor
+    pos_str[1] = 'A' + state->positions[1];  // Middle rotor
+    pos_str[2] = 'A' + state->positions[0];  // Right rotor
+    pos_str[3] = '\0';
+
+    char order_str[16];
+    format_rotor_order(state->rotor_order, order_str, sizeof(order_str));
+
+    fprintf(stderr, "=== Enigma Configuration ===\n");
+    fprintf(stderr, "Rotors:     %s\n", order_str);
+    fprintf(stderr, "Reflector:  B\n");
+    fprintf(stderr, "Rings:      %c%c%c\n",
+            'A' + state->ring_settings[2], 'A' + state->ring_settings[1], 'A' + state->ring_settings[0]);
+    fprintf(stderr, "Positions:  %s (Left: %c, Middle: %c, Right: %c)\n",
+            pos_str, pos_str[0], pos_str[1], pos_str[2]);
+    fprintf(stderr, "Plugboard:  %s\n",
+            state->plugboard[0] ? state->plugboard : "(none)");
+    fprintf(stderr, "===========================\n");
+}
+
+// Set rotor positions from string (e.g., "ABC" or "XYZ")
+void set_rotor_positions(EnigmaState* state, const char* positions) {
+    if (!positions || strlen(positions) != 3) {
+        fprintf(stderr, "Error: Rotor positions must be exactly 3 letters (A-Z)\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        char c = positions[i];
+        if (c >= 'a' && c <= 'z') {
+            c -= 32;  // Convert to uppercase
+        }
+        if (c < 'A' || c > 'Z') {
+            fprintf(stderr, "Error: Invalid rotor position '%c'. Must be A-Z.\n", positions[i]);
+            exit(1);
+        }
+    }
+
+    // Positions are specified as Left-Middle-Right, but stored as Right-Middle-Left
+    state->positions[2] = positions[0] - 'A';  // Left rotor
+    state->positions[1] = positions[1] - 'A';  // Middle rotor
+    state->positions[0] = positions[2] - 'A';  // Right rotor
+}
+
+// Place rotors in slots (slot-indexed, 0=I, 1=II, 2=III). Each rotor carries
+// its wiring and its notch; rotors[] is indexed left to right by the engine.
+void apply_rotor_order(EnigmaState* state, const int order[NUM_ROTORS]) {
+    for (int slot = 0; slot < NUM_ROTORS; slot++) {
+        int rotor = order[slot];
+        SAFE_STRCPY(state->rotors[NUM_ROTORS - 1 - slot].wiring, ROTOR_WIRINGS[rotor], ALPHABET_SIZE + 1);
+        state->notch_positions[slot] = NOTCH_POSITIONS_INIT[NUM_ROTORS - 1 - rotor];
+        state->rotor_order[slot] = rotor;
+    }
+}
+
+// Set rotor order from string of rotor numbers, left to right (e.g., "231")
+void set_rotor_order(EnigmaState* state, const char* order) {
+    int slots[NUM_ROTORS];
+    int used = 0;
+
+    if (!order || strlen(order) != 3) {
+        fprintf(stderr, "Error: Rotor order must be exactly 3 digits (1-3), e.g. 231\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        int rotor = order[i] - '1';
+        if (rotor < 0 || rotor >= NUM_ROTORS || (used & (1 << rotor))) {
+            fprintf(stderr, "Error: Invalid rotor order '%s'. Use each of 1, 2, 3 once.\n", order);
+            exit(1);
+        }
+        used |= 1 << rotor;
+        slots[2 - i] = rotor;  // Given Left-Middle-Right
+    }
+
+    apply_rotor_order(state, slots);
+}
+
+// Set ring settings from string (e.g., "AAA"), Left-Middle-Right like positions
+void set_ring_settings(EnigmaState* state, const char* rings) {
+    if (!rings || strlen(rings) != 3) {
+        fprintf(stderr, "Error: Ring settings must be exactly 3 letters (A-Z)\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        int c = toupper((unsigned char)rings[i]);
+        if (c < 'A' || c > 'Z') {
+            fprintf(stderr, "Error: Invalid ring setting '%c'. Must be A-Z.\n", rings[i]);
+            exit(1);
+        }
+        state->ring_settings[2 - i] = c - 'A';
+    }
+}
+
+// Format a slot-indexed rotor order as roman numerals, left to right
+void format_rotor_order(const int order[NUM_ROTORS], char* out, size_t size) {
+    static const char* names[NUM_ROTORS] = { "I", "II", "III" };
+    snprintf(out, size, "%s-%s-%s", names[order[2]], names[order[1]], names[order[0]]);
+}
+
+// Set plugboard configuration
+void set_plugboard(EnigmaState* state, const char* plugboard_config) {
     if (!plugboard_config) {
         state->plugboard[0] = '\0';
         return;
@@ -379,20 +1689,297 @@ void set_plugboard(EnigmaState* state, const char* plugboard_config) {
         if (state->plugboard[i] >= 'a' && state->plugboard[i] <= 'z') {
             state->plugboard[i] -= 32;
         }
-    }
-}
-
-// Parse command-line arguments
-void parse_arguments(int argc, char* argv[], EnigmaState* state) {
-    int show_config = 0;
-
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-            print_usage(argv[0]);
-            exit(0);
+    }
+}
+
+// Parse command-line arguments
+void parse_arguments(int argc, char* argv[], EnigmaState* state, RunOptions* options) {
+    int show_config = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            exit(0);
+        }
+        else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--show") == 0) {
+            show_config = 1;
+        }
+        else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--order") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: -o requires an argument (3 digits 1-3)\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            set_rotor_order(state, argv[++i]);
+        }
+        else if (strcmp(argv[i], "-g") == 0 || strcmp(argv[i], "--rings") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: -g requires an argument (3 letters A-Z)\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            set_ring_settings(state, argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--records") == 0) {
+            options->mode = MODE_RECORDS;
+        }
+        else if (strcmp(argv[i], "--format") == 0) {
+            if (i + 1 < argc && strcmp(argv[i + 1], "csv") == 0) {
+                options->record_format = RECORD_CSV;
+            } else if (i + 1 < argc && strcmp(argv[i + 1], "tsv") == 0) {
+                options->record_format = RECORD_TSV;
+            } else if (i + 1 < argc && strcmp(argv[i + 1], "jsonl") == 0) {
+                options->record_format = RECORD_JSONL;
+            } else {
+                fprintf(stderr, "Error: --format requires csv, tsv or jsonl\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->mode = MODE_RECORDS;
+            i++;
+        }
+        else if (strcmp(argv[i], "--fields") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --fields requires a list of columns or key names\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->fields = argv[++i];
+        }
+        else if (strcmp(argv[i], "--header") == 0) {
+            options->record_header = 1;
+        }
+        else if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "--keyed-records") == 0) {
+            options->mode = MODE_KEYED_RECORDS;
+        }
+        else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1 || atoi(argv[i + 1]) > MAX_THREADS) {
+                fprintf(stderr, "Error: -t requires a thread count (1-%d)\n", MAX_THREADS);
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--build-index") == 0 || strcmp(argv[i], "--lookup-index") == 0) {
+            if (i + 2 >= argc) {
+                fprintf(stderr, "Error: %s requires a file and a text argument\n", argv[i]);
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->mode = strcmp(argv[i], "--build-index") == 0 ? MODE_BUILD_INDEX : MODE_LOOKUP_INDEX;
+            options->path = argv[++i];
+            options->text = argv[++i];
+        }
+        else if (strcmp(argv[i], "--daily-key") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --daily-key requires a message file\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->mode = MODE_DAILY_KEY;
+            options->path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bombe") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --bombe requires a menu file\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->mode = MODE_BOMBE;
+            options->path = argv[++i];
         }
-        else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--show") == 0) {
-            show_config = 1;
+        else if (strcmp(argv[i], "--place-cribs") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --place-cribs requires a crib file\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->mode = MODE_PLACE_CRIBS;
+            options->path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--attack") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --attack requires a message file\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->mode = MODE_ATTACK;
+            options->path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--scorer") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --scorer requires a plug-in file\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->scorer_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--turnover") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --turnover requires a message file\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->mode = MODE_TURNOVER;
+            options->path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--machine") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --machine requires a model file\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            load_machine_model(argv[++i], state);
+        }
+        else if (strcmp(argv[i], "--recover-wiring") == 0) {
+            if (i + 2 >= argc) {
+                fprintf(stderr, "Error: --recover-wiring requires a rotor (1-3 or R) and a message file\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->mode = MODE_RECOVER_WIRING;
+            options->text = argv[++i];
+            options->path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--live") == 0) {
+            options->mode = MODE_LIVE;
+        }
+        else if (strcmp(argv[i], "--bench-engines") == 0) {
+            options->mode = MODE_BENCH_ENGINES;
+        }
+        else if (strcmp(argv[i], "--bench-threads") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1 || atoi(argv[i + 1]) > MAX_THREADS) {
+                fprintf(stderr, "Error: --bench-threads requires a thread count (1-%d)\n", MAX_THREADS);
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->mode = MODE_BENCH_THREADS;
+            options->bench_threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--pin") == 0) {
+            const char* layout = i + 1 < argc ? argv[i + 1] : "";
+            if (strcmp(layout, "compact") == 0) {
+                options->pin_layout = PIN_COMPACT;
+            } else if (strcmp(layout, "scatter") == 0) {
+                options->pin_layout = PIN_SCATTER;
+            } else {
+                fprintf(stderr, "Error: --pin requires compact or scatter\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--stage-threads") == 0) {
+            const char* spec = i + 1 < argc ? argv[i + 1] : "";
+            char* end;
+
+            for (int s = 0; s < ATTACK_STAGES; s++) {
+                long count = strtol(spec, &end, 10);
+                if (end == spec || count < 1 || count > MAX_THREADS / ATTACK_STAGES ||
+                    *end != (s + 1 < ATTACK_STAGES ? ',' : '\0')) {
+                    fprintf(stderr, "Error: --stage-threads requires four thread counts (1-%d), e.g. 2,1,4,1\n",
+                            MAX_THREADS / ATTACK_STAGES);
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                options->stage_threads[s] = (int)count;
+                spec = end + 1;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--serve") == 0) {
+            options->mode = MODE_SERVE;
+        }
+        else if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "-O") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires a file name\n", argv[i]);
+                print_usage(argv[0]);
+                exit(1);
+            }
+            if (argv[i][1] == 'i') {
+                options->input_path = argv[++i];
+            } else {
+                options->output_path = argv[++i];
+            }
+        }
+        else if (strcmp(argv[i], "--gzip") == 0) {
+            options->compress_output = 1;
+        }
+        else if (strcmp(argv[i], "--ita2-in") == 0) {
+            options->ita2_input = 1;
+        }
+        else if (strcmp(argv[i], "--ita2-out") == 0) {
+            options->ita2_output = 1;
+        }
+        else if (strcmp(argv[i], "--busy-poll") == 0) {
+            options->busy_poll = 1;
+        }
+        else if (strcmp(argv[i], "--latency-target") == 0) {
+            if (i + 1 >= argc || atol(argv[i + 1]) <= 0) {
+                fprintf(stderr, "Error: --latency-target requires a queueing delay in microseconds\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->latency_target = (unsigned long)atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tenant-quota") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) <= 0 || atoi(argv[i + 1]) > SERVICE_QUEUE) {
+                fprintf(stderr, "Error: --tenant-quota requires a request count (1-%d)\n", SERVICE_QUEUE);
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->tenant_quota = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--capture") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --capture requires a file\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->capture_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--capture-payload") == 0) {
+            options->capture_payloads = 1;
+        }
+        else if (strcmp(argv[i], "--replay") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --replay requires a capture file\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            options->mode = MODE_REPLAY;
+            options->path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--speed") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --speed requires a factor (or max)\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            i++;
+            if (strcmp(argv[i], "max") == 0) {
+                options->replay_speed = 0.0;
+            } else if (atof(argv[i]) > 0.0) {
+                options->replay_speed = atof(argv[i]);
+            } else {
+                fprintf(stderr, "Error: --speed factor must be positive (or max)\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--mem-limit") == 0) {
+            if (i + 1 >= argc || set_memory_limit(argv[i + 1]) != 0) {
+                fprintf(stderr, "Error: --mem-limit requires CATEGORY=SIZE (categories: tables, keycache,\n");
+                fprintf(stderr, "       sessions, search, io, models; SIZE in bytes or with K, M or G)\n");
+                print_usage(argv[0]);
+                exit(1);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--stats") == 0) {
+            options->show_stats = 1;
+        }
+        else if (strcmp(argv[i], "--verify") == 0) {
+            options->verify = 1;
         }
         else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--positions") == 0) {
             if (i + 1 >= argc) {
@@ -417,6 +2004,27 @@ void parse_arguments(int argc, char* argv[], EnigmaState* state) {
         }
     }
 
+    if ((options->ita2_input || options->ita2_output) &&
+        (options->mode != MODE_STREAM || options->verify || options->input_path ||
+         options->output_path || options->compress_output)) {
+        fprintf(stderr, "Error: --ita2-in and --ita2-out work on the plain stream mode (stdin to stdout) only\n");
+        exit(1);
+    }
+
+    // -i, -O, --gzip and -t > 1 select the file stream, which these modes bypass
+    int record_mode = options->mode == MODE_RECORDS || options->mode == MODE_KEYED_RECORDS;
+    if ((record_mode || options->verify) &&
+        (options->input_path || options->output_path || options->compress_output)) {
+        fprintf(stderr, "Error: -i, -O and --gzip work in stream mode only, not with %s\n",
+                options->verify ? "--verify" : "-r, -k or --format");
+        exit(1);
+    }
+    if ((options->mode == MODE_RECORDS || (options->mode == MODE_STREAM && options->verify)) &&
+        options->threads > 1) {
+        fprintf(stderr, "Error: -t does not apply to %s\n", options->verify ? "--verify" : "-r or --format");
+        exit(1);
+    }
+
     if (show_config) {
         print_current_config(state);
         exit(0);
@@ -431,3 +2039,398 @@ void console_setup(void) {
     SetConsoleCP(CP_UTF8);
 }
 #endif
+
+// Scorer plug-ins
+//
+// Loaded once at startup, before any search thread runs, and kept loaded
+// until the process exits.
+#ifndef UNIVAC
+ScoreFunc load_scorer(const char* path) {
+    HMODULE library = LoadLibraryA(path);
+
+    if (!library) {
+        fprintf(stderr, "Error: Could not load scorer '%s' (error %lu)\n", path, (unsigned long)GetLastError());
+        exit(1);
+    }
+
+    // Through void (*)(void), the one function pointer type GCC lets any other
+    // convert to without -Wcast-function-type
+    ScorerAbiFunc abi = (ScorerAbiFunc)(void (*)(void))GetProcAddress(library, "unigma_scorer_abi");
+    ScoreFunc score = (ScoreFunc)(void (*)(void))GetProcAddress(library, "unigma_score");
+    if (!abi || !score) {
+        fprintf(stderr, "Error: Scorer '%s' does not export unigma_scorer_abi and unigma_score\n", path);
+        exit(1);
+    }
+    if (abi() != UNIGMA_SCORER_ABI) {
+        fprintf(stderr, "Error: Scorer '%s' was built for ABI %d; this build needs %d\n",
+                path, abi(), UNIGMA_SCORER_ABI);
+        exit(1);
+    }
+    return score;
+}
+#else
+ScoreFunc load_scorer(const char* path) {
+    (void)path;
+    fprintf(stderr, "Error: Scorer plug-ins need dynamic loading, which the UNIVAC build does not have\n");
+    exit(1);
+}
+#endif
+
+// Worker threads
+//
+// run_workers calls func(context, w) for w = 0..count-1 and returns when all
+// have finished. Worker 0 runs on the calling thread. The UNIVAC build has no
+// threads, so there the workers simply run one after another.
+//
+// While a WorkerMeter is set (--bench-threads), every worker is pinned by
+// the meter's layout for the length of its call, so that worker 0 leaves the
+// calling thread as it found it, and fork-joins are counted. Calls exactly as wide as
+// the meter also add up each worker's time in func by worker number, so a
+// nested call of another width (a pipeline's stages) does not mix in.
+static WorkerMeter* worker_meter;
+
+void meter_workers(WorkerMeter* meter) {
+    worker_meter = meter;
+}
+
+static void call_worker(WorkerFunc func, void* context, int worker, int count) {
+    WorkerMeter* meter = worker_meter;
+    unsigned long long previous = 0;
+    unsigned long long started;
+
+    if (!meter) {
+        func(context, worker);
+        return;
+    }
+    if (meter->layout != PIN_NONE) {
+        previous = pin_current_thread(layout_cpu(meter->layout, worker));
+    }
+    if (count != meter->width) {
+        func(context, worker);
+    } else {
+        started = clock_microseconds();
+        func(context, worker);
+#ifndef UNIVAC
+        InterlockedExchangeAdd64(&meter->busy[worker], (LONGLONG)(clock_microseconds() - started));
+#else
+        meter->busy[worker] += clock_microseconds() - started;
+#endif
+    }
+    restore_thread_affinity(previous);
+}
+
+#ifndef UNIVAC
+typedef struct {
+    WorkerFunc func;
+    void* context;
+    int worker;
+    int count;
+} WorkerStart;
+
+static DWORD WINAPI worker_entry(LPVOID arg) {
+    WorkerStart* start = (WorkerStart*)arg;
+    call_worker(start->func, start->context, start->worker, start->count);
+    return 0;
+}
+
+void run_workers(int count, WorkerFunc func, void* context) {
+    WorkerStart starts[MAX_THREADS];
+    HANDLE handles[MAX_THREADS];
+
+    if (count > MAX_THREADS) {
+        count = MAX_THREADS;
+    }
+    if (worker_meter) {
+        InterlockedIncrement(&worker_meter->fork_joins);
+    }
+    for (int w = 1; w < count; w++) {
+        starts[w].func = func;
+        starts[w].context = context;
+        starts[w].worker = w;
+        starts[w].count = count;
+        handles[w] = CreateThread(NULL, 0, worker_entry, &starts[w], 0, NULL);
+        if (handles[w] == NULL) {
+            call_worker(func, context, w, count);  // Could not start a thread: do the work here
+        }
+    }
+
+    call_worker(func, context, 0, count);
+
+    for (int w = 1; w < count; w++) {
+        if (handles[w] != NULL) {
+            WaitForSingleObject(handles[w], INFINITE);
+            CloseHandle(handles[w]);
+        }
+    }
+}
+
+int default_thread_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    if (info.dwNumberOfProcessors < 1) {
+        return 1;
+    }
+    return info.dwNumberOfProcessors > MAX_THREADS ? MAX_THREADS : (int)info.dwNumberOfProcessors;
+}
+#else
+void run_workers(int count, WorkerFunc func, void* context) {
+    if (count > MAX_THREADS) {
+        count = MAX_THREADS;
+    }
+    if (worker_meter) {
+        worker_meter->fork_joins++;
+    }
+    for (int w = 0; w < count; w++) {
+        call_worker(func, context, w, count);
+    }
+}
+
+int default_thread_count(void) {
+    return 1;
+}
+#endif
+
+// Bounded queues
+//
+// A fixed-capacity FIFO of pointers between pipeline threads: push waits
+// while the queue is full and pop waits while it is empty, so a slow stage
+// holds back the ones in front of it instead of letting buffers pile up.
+// pop returns NULL once the queue is closed and drained. The UNIVAC build has
+// no threads to wait for, so there push fails when full and pop returns NULL
+// when empty; its pipelines run their stages in turn instead.
+void queue_init(BoundedQueue* queue, int capacity) {
+    memset(queue, 0, sizeof(BoundedQueue));
+    queue->items = (void**)memory_alloc(MEM_IO, (size_t)capacity * sizeof(void*));
+    if (!queue->items) {
+        fprintf(stderr, "Error: Out of memory creating a queue\n");
+        exit(1);
+    }
+    queue->capacity = capacity;
+#ifndef UNIVAC
+    InitializeCriticalSection(&queue->lock);
+    InitializeConditionVariable(&queue->not_empty);
+    InitializeConditionVariable(&queue->not_full);
+#endif
+}
+
+void queue_destroy(BoundedQueue* queue) {
+#ifndef UNIVAC
+    DeleteCriticalSection(&queue->lock);
+#endif
+    memory_free(queue->items);
+    queue->items = NULL;
+}
+
+#ifndef UNIVAC
+int queue_push(BoundedQueue* queue, void* item) {
+    EnterCriticalSection(&queue->lock);
+    while (queue->count == queue->capacity) {
+        queue->full_waits++;
+        SleepConditionVariableCS(&queue->not_full, &queue->lock, INFINITE);
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    WakeConditionVariable(&queue->not_empty);
+    LeaveCriticalSection(&queue->lock);
+    return 0;
+}
+
+void* queue_pop(BoundedQueue* queue) {
+    void* item = NULL;
+
+    EnterCriticalSection(&queue->lock);
+    while (queue->count == 0 && !queue->closed) {
+        queue->empty_waits++;
+        SleepConditionVariableCS(&queue->not_empty, &queue->lock, INFINITE);
+    }
+    if (queue->count > 0) {
+        item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        WakeConditionVariable(&queue->not_full);
+    }
+    LeaveCriticalSection(&queue->lock);
+    return item;
+}
+
+void queue_close(BoundedQueue* queue) {
+    EnterCriticalSection(&queue->lock);
+    queue->closed = 1;
+    WakeAllConditionVariable(&queue->not_empty);
+    LeaveCriticalSection(&queue->lock);
+}
+#else
+int queue_push(BoundedQueue* queue, void* item) {
+    if (queue->count == queue->capacity) {
+        return -1;
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    return 0;
+}
+
+void* queue_pop(BoundedQueue* queue) {
+    void* item;
+
+    if (queue->count == 0) {
+        return NULL;
+    }
+    item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    return item;
+}
+
+void queue_close(BoundedQueue* queue) {
+    queue->closed = 1;
+}
+#endif
+
+// Clock
+//
+// clock_microseconds is a monotonic clock for latency measurement and replay
+// pacing. UNIVAC only has the C library's processor clock, which advances
+// with wall time as long as the program is busy, as it is when wait_until spins.
+#ifndef UNIVAC
+unsigned long long clock_microseconds(void) {
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart / frequency.QuadPart) * 1000000ULL +
+           (unsigned long long)(now.QuadPart % frequency.QuadPart) * 1000000ULL / (unsigned long long)frequency.QuadPart;
+}
+
+// Sleep while the target is more than a couple of milliseconds away, then spin
+void wait_until(unsigned long long microseconds) {
+    unsigned long long now;
+
+    while ((now = clock_microseconds()) < microseconds) {
+        if (microseconds - now > 2000) {
+            Sleep((DWORD)((microseconds - now) / 1000 - 1));
+        } else {
+            YieldProcessor();
+        }
+    }
+}
+#else
+unsigned long long clock_microseconds(void) {
+    clock_t now = clock();
+
+    return (unsigned long long)(now / CLOCKS_PER_SEC) * 1000000ULL +
+           (unsigned long long)(now % CLOCKS_PER_SEC) * 1000000ULL / CLOCKS_PER_SEC;
+}
+
+void wait_until(unsigned long long microseconds) {
+    while (clock_microseconds() < microseconds) {
+    }
+}
+#endif
+
+// Memory locking and thread pinning (for the busy-polling service)
+#ifndef UNIVAC
+// Returns 0 if the pages are locked in memory
+int lock_memory(void* block, size_t size) {
+    SIZE_T minimum;
+    SIZE_T maximum;
+
+    if (VirtualLock(block, size)) {
+        return 0;
+    }
+
+    // The default working set quota is small: grow it by the block and retry
+    if (!GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum) ||
+        !SetProcessWorkingSetSize(GetCurrentProcess(), minimum + size + 65536, maximum + size + 65536)) {
+        return -1;
+    }
+    return VirtualLock(block, size) ? 0 : -1;
+}
+
+// Affinity masks reach the first 8 * sizeof(DWORD_PTR) processors (one processor group).
+// Returns the thread's previous mask, or 0 if it could not be pinned.
+unsigned long long pin_current_thread(int cpu) {
+    int processors = default_thread_count();
+
+    if (processors > (int)(8 * sizeof(DWORD_PTR))) {
+        processors = (int)(8 * sizeof(DWORD_PTR));
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (cpu % processors));
+}
+
+// Put back a mask pin_current_thread returned (0: nothing to undo)
+void restore_thread_affinity(unsigned long long mask) {
+    if (mask) {
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask);
+    }
+}
+
+int numa_node_count(void) {
+    ULONG highest = 0;
+
+    return GetNumaHighestNodeNumber(&highest) ? (int)highest + 1 : 1;
+}
+
+// Processor for worker under a layout. Compact fills processors in order.
+// Scatter deals workers out over the NUMA nodes, or on a single node
+// alternates between its halves (sockets, or SMT siblings numbered apart).
+int layout_cpu(PinLayout layout, int worker) {
+    int processors = default_thread_count();
+    int nodes = numa_node_count();
+
+    if (layout == PIN_COMPACT || processors < 2) {
+        return worker % processors;
+    }
+    if (nodes < 2) {
+        int half = (processors + 1) / 2;
+        return ((worker % 2) * half + worker / 2) % processors;
+    }
+
+    ULONGLONG mask = 0;
+    int node = worker % nodes;
+    int index = worker / nodes;
+    int count = 0;
+
+    if (!GetNumaNodeProcessorMask((UCHAR)node, &mask) || mask == 0) {
+        return worker % processors;
+    }
+    for (ULONGLONG m = mask; m; m &= m - 1) {
+        count++;
+    }
+    index %= count;
+    for (int cpu = 0; cpu < 64; cpu++) {
+        if ((mask >> cpu) & 1) {
+            if (index-- == 0) {
+                return cpu;
+            }
+        }
+    }
+    return worker % processors;
+}
+#else
+int lock_memory(void* block, size_t size) {
+    (void)block;
+    (void)size;
+    return -1;
+}
+
+unsigned long long pin_current_thread(int cpu) {
+    (void)cpu;
+    return 0;
+}
+
+void restore_thread_affinity(unsigned long long mask) {
+    (void)mask;
+}
+
+int numa_node_count(void) {
+    return 1;
+}
+
+int layout_cpu(PinLayout layout, int worker) {
+    (void)layout;
+    return worker;
+}
+#endif
@@ -13,17 +13,90 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 
 // Platform-specific includes
 #ifndef UNIVAC
 #include <windows.h>
 #endif
 
+// Platform-specific string copy
+#ifdef UNIVAC
+#define SAFE_STRCPY(dest, src, size) do { strncpy(dest, src, (size)-1); (dest)[(size)-1] = '\0'; } while(0)
+#else
+#define SAFE_STRCPY(dest, src, size) strcpy_s(dest, size, src)
+#endif
+
+// Static probes (USDT)
+//
+// Built with -DUNIGMA_USDT where <sys/sdt.h> is available (systemtap-sdt),
+// the binary carries probe points for bpftrace, perf and systemtap, e.g.
+//
+//   bpftrace -e 'usdt:./unigma:unigma:cache__miss { @misses[arg0] = count(); }'
+//
+// A probe is a single NOP until a tracer attaches to it, and its arguments
+// are values already at hand. Without UNIGMA_USDT the macros are empty.
+//
+//   block__start, block__end     engine name, block bytes, rotor position (0-17575);
+//                                block__end also the letters enciphered
+//   compile__start, compile__end fused tables, first and end position compiled
+//   cache__hit, cache__miss      key cache slot, CanonicalKey pointer
+//   search__unit                 search name, finished work unit, worker
+//   service__enqueue             request id, requests now pending, tenant (-1 = none)
+//   service__dequeue             request id, worker, arrival (clock_microseconds)
+#ifdef UNIGMA_USDT
+#include <sys/sdt.h>
+#define UNIGMA_PROBE2(name, a, b) DTRACE_PROBE2(unigma, name, a, b)
+#define UNIGMA_PROBE3(name, a, b, c) DTRACE_PROBE3(unigma, name, a, b, c)
+#define UNIGMA_PROBE4(name, a, b, c, d) DTRACE_PROBE4(unigma, name, a, b, c, d)
+#else
+// sizeof keeps the arguments "used" without evaluating them
+#define UNIGMA_PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define UNIGMA_PROBE3(name, a, b, c) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#define UNIGMA_PROBE4(name, a, b, c, d) \
+    do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); } while (0)
+#endif
+
+// Rotor positions as one number for probes: right + 26 * middle + 676 * left
+#define PROBE_POSITION(positions) ((positions)[0] + 26 * ((positions)[1] + 26 * (positions)[2]))
+
 // Constants
 #define NUM_ROTORS 3
 #define NUM_ROTOR_WIRINGS 4  // 3 rotors + 1 reflector
 #define ALPHABET_SIZE 26
 #define MAX_PLUGBOARD_LEN 256
+#define RECORD_BATCH 64               // Records encrypted side by side in record mode
+#define PASS_THROUGH ALPHABET_SIZE    // Lane value that every substitution maps to itself
+#define KEYED_WINDOW 4096             // Keyed records scheduled together (and reordered) at once
+#define KEY_CACHE_SLOTS 16            // Compiled keys each worker keeps around
+#define MAX_THREADS 256
+#define STREAM_BLOCK 4096             // Bytes read and encrypted at a time in stream mode
+#define PARALLEL_CHUNK 4096           // Smallest piece of a block encrypted by one thread
+#define PARALLEL_MAX_CHUNKS 64        // Most pieces a block is split into
+#define ITA2_FIGS 0x1B                // ITA2 shift to figures
+#define ITA2_LTRS 0x1F                // ITA2 shift to letters
+#define MAX_VERIFY_REPORTS 20         // Mismatches listed individually by --verify
+#define NUM_ROTOR_ORDERS 6
+#define NUM_POSITIONS (ALPHABET_SIZE * ALPHABET_SIZE * ALPHABET_SIZE)
+#define CRIB_INDEX_MAX 32             // Longest crib a crib index can be built for
+#define CRIB_INDEX_VERSION 2
+#define MAX_CRIB_CANDIDATES 1024      // Candidate keys returned by one index lookup
+#define MAX_DAILY_MESSAGES 256        // Messages one daily-key search takes
+#define DAILY_KEY_STARTS 8            // Start positions per message carried into the first ring sweep
+#define DAILY_KEY_ROUNDS 3            // Ring/plugboard/position refinement rounds per order
+#define DAILY_KEY_CONFIDENT 0.003     // Pooled bigram IoC a recovered daily key must reach (random: 0.0015)
+#define BOMBE_MAX_MENUS 64            // Menus one bombe run tests together
+#define BOMBE_MAX_MENU 32             // Longest crib in a bombe menu
+#define BOMBE_MAX_SPAN 1024           // Message positions a menu offset can reach
+#define SERVICE_QUEUE 1024            // Requests in flight between the service reader and workers
+#define SERVICE_PREFAULT 1024         // Request bytes and letters --busy-poll pre-faults room for
+#define CAPTURE_BUFFER 65536          // Capture log bytes buffered before each write
+#define CAPTURE_VERSION 1
+#define LATENCY_BUCKETS 256           // Log-linear latency histogram: 8 buckets per power of two
+#define ATTACK_STAGES 4               // Positions, rings, plugboard, final scoring
+#define ATTACK_QUEUE 16               // Candidates in flight between two attack stages
+#define ATTACK_UNIT_KEEP 2            // Start positions kept per rotor order and left rotor position
+#define ATTACK_RESULTS 5              // Keys ranked by --attack
 
 // Rotor wiring structure
 typedef struct {
@@ -44,8 +117,285 @@ typedef struct {
 
     // Plugboard configuration (e.g., "AB CD EF" swaps A<->B, C<->D, E<->F)
     char plugboard[MAX_PLUGBOARD_LEN];
+
+    // Rotor order, slot-indexed like positions: which rotor (0=I, 1=II, 2=III)
+    // sits in each slot. The default order is I-II-III from left to right.
+    // A rotor keeps the notch it has in the default machine wherever it goes.
+    int rotor_order[NUM_ROTORS];
+
+    // Ring settings (Ringstellung, 0-25), slot-indexed like positions
+    int ring_settings[NUM_ROTORS];
 } EnigmaState;
 
+// Substitution tables compiled for a run of rotor positions under one key.
+// The plugboard-free scrambler tables are kept so the plugboard can be changed
+// by re-conjugating them instead of recompiling through the rotors.
+typedef struct {
+    int plug[ALPHABET_SIZE];   // Plugboard as a permutation of 0-25
+    size_t length;             // Number of positions compiled
+    size_t capacity;           // Number of positions allocated
+    EnigmaState next;          // Machine state before the next position to compile
+    unsigned char* scrambler;  // length x ALPHABET_SIZE, plugboard-free
+    unsigned char* fused;      // length x (ALPHABET_SIZE + 1), plugboard applied, last entry passes through
+    unsigned char* lanes;      // capacity x RECORD_BATCH scratch for encrypt_record_batch
+} FusedTables;
+
+// ITA2 (5-bit teleprinter) front end of stream mode and its shift states.
+// Input and output are each either ASCII or one ITA2 code per byte.
+typedef struct {
+    int input;                  // Decode ITA2 input
+    int output;                 // Encode ITA2 output
+    int in_figures;             // The input is in figures shift
+    int out_shift;              // ITA2_LTRS or ITA2_FIGS as last sent, 0 before the first
+    unsigned long dropped;      // Characters with no ITA2 code, left out of the output
+} Teletype;
+
+// Machine wiring compiled into lookup arrays, indexed by rotor slot
+// (0 = right, 1 = middle, 2 = left, the same order as positions).
+// This is an independent second implementation of the encryption path,
+// used to cross-check the direct one.
+typedef struct {
+    unsigned char forward[NUM_ROTORS][ALPHABET_SIZE];
+    unsigned char reverse[NUM_ROTORS][ALPHABET_SIZE];
+    unsigned char reflector[ALPHABET_SIZE];
+    unsigned char plug[ALPHABET_SIZE];
+    int rings[NUM_ROTORS];
+} CompiledMachine;
+
+// Canonical form of a key: two keys that encrypt identically compare equal
+typedef struct {
+    unsigned char order[NUM_ROTORS];
+    unsigned char rings[NUM_ROTORS];
+    unsigned char positions[NUM_ROTORS];
+    unsigned char plug[ALPHABET_SIZE];
+} CanonicalKey;
+
+// Small LRU cache of compiled keys (one per worker, so no locking)
+typedef struct {
+    CanonicalKey key;
+    int valid;
+    unsigned long last_used;
+    FusedTables tables;
+} KeyCacheEntry;
+
+typedef struct {
+    KeyCacheEntry entries[KEY_CACHE_SLOTS];
+    unsigned long clock;
+    unsigned long hits;
+    unsigned long misses;
+} KeyCache;
+
+// Crib index file: a header followed by entry_count entries sorted by hash.
+// Everything is fixed size in native byte order, so the file can be read in
+// one go (or mapped) and searched in place.
+typedef struct {
+    char magic[8];                      // "UNIGMAIX"
+    unsigned int version;
+    unsigned int crib_length;
+    unsigned int entry_count;
+    int rings[NUM_ROTORS];              // Ring settings the index was built with
+    char crib[CRIB_INDEX_MAX + 1];
+    char plugboard[MAX_PLUGBOARD_LEN];  // Fixed plugboard the index was built with
+    char wirings[NUM_ROTOR_WIRINGS][ALPHABET_SIZE + 1];  // Machine model (see --machine)
+    int notches[NUM_ROTORS];
+} CribIndexHeader;
+
+typedef struct {
+    unsigned int hash;                  // Hash of the ciphertext prefix
+    unsigned int key;                   // Order * NUM_POSITIONS + start position
+} CribIndexEntry;
+
+typedef struct {
+    CribIndexHeader header;
+    CribIndexEntry* entries;
+} CribIndex;
+
+// Bombe menu: a crib laid against the ciphertext at an offset
+typedef struct {
+    int offset;                         // Message position of the first crib letter
+    int length;
+    int test_letter;                    // Menu letter the plug hypothesis is made for
+    unsigned char plain[BOMBE_MAX_MENU];
+    unsigned char cipher[BOMBE_MAX_MENU];
+    unsigned char link_start[ALPHABET_SIZE + 1];  // Pairs on letter i: links link_start[i]..[i+1]
+    unsigned char link_pair[2 * BOMBE_MAX_MENU];
+    unsigned char link_other[2 * BOMBE_MAX_MENU];
+    unsigned long line;                 // Input line the menu was read from
+} BombeMenu;
+
+typedef struct {
+    int menu;
+    unsigned int key;                   // Order * NUM_POSITIONS + start position
+    unsigned int candidates;            // Possible plugs of the test letter, one bit each
+} BombeStop;
+
+// Memory accounting categories: who owns an allocation
+typedef enum {
+    MEM_TABLES = 0,     // Compiled substitution tables
+    MEM_KEY_CACHE,      // Key cache slots
+    MEM_SESSIONS,       // Service request slots and per-worker service state
+    MEM_SEARCH,         // Search and bombe scratch
+    MEM_IO,             // Input, output and capture buffers
+    MEM_MODELS,         // Crib indexes
+    MEM_CATEGORIES
+} MemoryCategory;
+
+// Latency histogram in microseconds. Buckets below 8 are exact; above that
+// every power of two is split into 8 buckets, so percentiles are within 12.5%.
+typedef struct {
+    unsigned long long count[LATENCY_BUCKETS];
+    unsigned long long samples;
+    unsigned long long max;
+} LatencyHistogram;
+
+// Run modes
+typedef enum {
+    MODE_STREAM = 0,    // Encrypt stdin as one continuous message
+    MODE_RECORDS,       // Encrypt each input line as its own message from the start key
+    MODE_KEYED_RECORDS, // Each input line carries its own key in front of a tab
+    MODE_BUILD_INDEX,   // Build a crib index file
+    MODE_LOOKUP_INDEX,  // Look up candidate keys for a ciphertext in a crib index
+    MODE_DAILY_KEY,     // Recover the shared daily key from several messages
+    MODE_BOMBE,         // Test crib menus against every rotor order and start position
+    MODE_SERVE,         // Answer keyed requests one by one as they arrive
+    MODE_REPLAY,        // Replay a traffic capture against the service
+    MODE_ATTACK,        // Ciphertext-only key search on one message
+    MODE_PLACE_CRIBS,   // List the legal crib placements in a corpus as bombe menus
+    MODE_LIVE,          // Rank keys while an intercept arrives group by group
+    MODE_BENCH_ENGINES, // Time the encryption engines against each other
+    MODE_TURNOVER,      // Locate rotor turnovers in a message under a candidate key
+    MODE_RECOVER_WIRING, // Recover an unknown rotor or reflector wiring
+    MODE_BENCH_THREADS  // Time the parallel modes at 1..N threads
+} RunMode;
+
+// Record layouts record mode understands
+typedef enum {
+    RECORD_LINES = 0,   // Each line is one message
+    RECORD_CSV,         // Comma-separated fields, RFC 4180 quoting
+    RECORD_TSV,         // Tab-separated fields, no quoting
+    RECORD_JSONL        // One JSON object per line
+} RecordFormat;
+
+// Scorer plug-ins (--scorer FILE)
+//
+// A scorer is a DLL that exports two functions with C linkage:
+//
+//   int unigma_scorer_abi(void);
+//     Returns the UNIGMA_SCORER_ABI the plug-in was built against; a
+//     plug-in for any other version is refused at startup.
+//
+//   void unigma_score(const unsigned char* letters, int length, int count, double* scores);
+//     Scores count candidate decrypts of length letters each. Letters are
+//     0-25 and stored letter-major (structure of arrays): letter i of
+//     candidate k is letters[i * count + k], so one row holds the same
+//     letter of every candidate. scores[k] receives the score of candidate
+//     k; higher means more like plaintext. Scores must depend only on the
+//     candidate's letters, not on the other candidates in the call: the
+//     searches rank candidates from many calls against each other, so a
+//     plug-in must not normalize per call (ranks, softmax and the like).
+//
+// unigma_score is called from several search threads at once and must not
+// keep state between calls. The ABI only ever grows by a new version.
+#define UNIGMA_SCORER_ABI 1
+
+typedef int (*ScorerAbiFunc)(void);
+typedef void (*ScoreFunc)(const unsigned char* letters, int length, int count, double* scores);
+
+// Where --bench-threads pins workers
+typedef enum {
+    PIN_NONE,
+    PIN_COMPACT,        // Worker w on processor w
+    PIN_SCATTER         // Workers dealt out over NUMA nodes
+} PinLayout;
+
+// Options that select what the program does with the configured machine
+typedef struct {
+    RunMode mode;
+    int threads;        // Worker threads for the parallel modes (0 = one per processor)
+    int show_stats;     // Print run statistics to stderr at the end
+    int verify;         // Round-trip every block through a second engine
+    const char* path;   // File argument of the index and search modes
+    const char* text;   // Crib or ciphertext argument of the index modes
+    const char* capture_path;  // Traffic capture log written by the service
+    int capture_payloads;      // Include request payloads in the capture
+    double replay_speed;       // Replay speed factor (1 = as captured, 0 = as fast as possible)
+    int busy_poll;             // Service threads spin on pre-faulted memory instead of sleeping
+    unsigned long latency_target;  // Service queueing delay target in microseconds (0 = no shedding)
+    int tenant_quota;          // Service requests one key may have in flight (0 = no quota)
+    const char* input_path;    // Stream mode input file (default stdin)
+    const char* output_path;   // Stream mode output file (default stdout)
+    int compress_output;       // Write gzip
+    int stage_threads[ATTACK_STAGES];  // Threads per --attack stage (0 = automatic)
+    RecordFormat record_format;        // Record mode input layout
+    const char* fields;        // Record fields to encrypt (NULL = all)
+    int record_header;         // Pass the first record through unchanged
+    int ita2_input;            // Stream mode input is ITA2 teleprinter code
+    int ita2_output;           // Stream mode output is ITA2 teleprinter code
+    const char* scorer_path;   // Scorer plug-in to load
+    ScoreFunc scorer;          // Loaded scorer for --attack and --turnover (NULL = built-in)
+    int bench_threads;         // Largest thread count --bench-threads runs
+    PinLayout pin_layout;      // Worker pinning for --bench-threads
+} RunOptions;
+
+// Counters collected during a run and printed by --stats
+typedef struct {
+    unsigned long records;
+    unsigned long fields;      // Structured record fields encrypted
+    unsigned long key_groups;  // Summed per window: a key in several windows counts in each
+    unsigned long bad_keys;
+    unsigned long table_hits;
+    unsigned long table_misses;
+    unsigned long letters;
+    unsigned long verified_blocks;
+    unsigned long verify_mismatches;
+    unsigned long requests;
+    unsigned long shed_latency;    // Service requests refused on queueing delay
+    unsigned long shed_quota;      // Service requests refused over their tenant's quota
+    unsigned long queue_full_waits;    // Pipeline and service queue pushes that waited for room
+    unsigned long queue_empty_waits;   // Pops that waited for an item
+    unsigned long long capture_bytes;
+    unsigned long long bytes_in;   // File stream mode, after decompression
+    unsigned long long bytes_out;  // File stream mode, after compression
+    LatencyHistogram latency;  // Service request latency
+} RunStats;
+
+// Worker threads (run serially on UNIVAC)
+typedef void (*WorkerFunc)(void* context, int worker);
+
+// Worker accounting for the thread benchmark (see run_workers)
+typedef struct {
+    PinLayout layout;
+    int width;                              // Only run_workers calls this wide are timed
+#ifndef UNIVAC
+    volatile LONGLONG busy[MAX_THREADS];    // Microseconds in the worker function, by worker number
+    volatile LONG fork_joins;
+#else
+    unsigned long long busy[MAX_THREADS];
+    long fork_joins;
+#endif
+} WorkerMeter;
+
+// Bounded FIFO of pointers between pipeline threads
+typedef struct {
+    void** items;
+    int capacity;
+    int head;
+    int count;
+    int closed;
+    unsigned long full_waits;   // Pushes that had to wait for room
+    unsigned long empty_waits;  // Pops that had to wait for an item
+#ifndef UNIVAC
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE not_empty;
+    CONDITION_VARIABLE not_full;
+#endif
+} BoundedQueue;
+
+// Shared tables (unigma.c)
+extern const char* ROTOR_WIRINGS[NUM_ROTOR_WIRINGS];
+extern int NOTCH_POSITIONS_INIT[NUM_ROTORS];
+extern const int ROTOR_ORDERS[NUM_ROTOR_ORDERS][NUM_ROTORS];
+
 // Function declarations
 
 // Initialization
@@ -56,30 +406,169 @@ void init_positions(EnigmaState* state);
 void init_plugboard(EnigmaState* state);
 
 // Runtime configuration
-void parse_arguments(int argc, char* argv[], EnigmaState* state);
+void parse_arguments(int argc, char* argv[], EnigmaState* state, RunOptions* options);
 void interactive_config(EnigmaState* state);
 void set_rotor_positions(EnigmaState* state, const char* positions);
+void set_rotor_order(EnigmaState* state, const char* order);
+void set_ring_settings(EnigmaState* state, const char* rings);
+void apply_rotor_order(EnigmaState* state, const int order[NUM_ROTORS]);
+void format_rotor_order(const int order[NUM_ROTORS], char* out, size_t size);
 void set_plugboard(EnigmaState* state, const char* plugboard_config);
 void print_usage(const char* program_name);
 void print_current_config(const EnigmaState* state);
 
 // Main encryption loop
-void run_enigma(EnigmaState* state);
+void run_enigma(EnigmaState* state, const RunOptions* options);
+size_t read_block(FILE* in, char* buffer, size_t size);
+size_t encrypt_block(EnigmaState* state, char* buffer, size_t length);
+size_t count_letters(const char* buffer, size_t length);
+void advance_rotors(EnigmaState* state, unsigned long long letters);
+size_t encrypt_block_parallel(EnigmaState* state, char* buffer, size_t length, int threads);
+void init_teletype(Teletype* tty, int input, int output);
+size_t teletype_block(Teletype* tty, EnigmaState* state, const unsigned char* in, size_t length,
+                      unsigned char* out);
+
+// Self-verifying stream mode
+void run_verified(EnigmaState* state, RunStats* stats);
+void compile_machine(const EnigmaState* state, CompiledMachine* machine);
+int compiled_encipher(int c, const int positions[NUM_ROTORS], const CompiledMachine* machine);
+size_t verify_block(const EnigmaState* checkpoint, const CompiledMachine* machine,
+                    const char* input, const char* output, size_t length,
+                    unsigned long offset, RunStats* stats);
+
+// Record mode (same key for every record, records laid out offset-major)
+void run_records(const EnigmaState* state, RunStats* stats);
+void encrypt_record_batch(FusedTables* tables, char** records, const size_t* lengths, int count);
+
+// Structured records (unigma_records.c)
+void run_structured_records(const EnigmaState* state, const RunOptions* options, RunStats* stats);
+
+// Keyed record mode (mixed keys, scheduled by key affinity)
+void run_keyed_records(const EnigmaState* state, const RunOptions* options, RunStats* stats);
+void encrypt_keyed_records(const EnigmaState* state, FILE* in, FILE* out, int workers, RunStats* stats);
+int parse_record_key(const char* line, size_t length, const EnigmaState* base, EnigmaState* machine, size_t* payload);
+void canonical_key(const EnigmaState* state, CanonicalKey* key);
+FusedTables* key_cache_lookup(KeyCache* cache, const CanonicalKey* key, const EnigmaState* machine);
+void free_key_cache(KeyCache* cache);
+void print_stats(const RunStats* stats);
 
 // Helper functions
 int idx(const char* s, int c);
 int mod_positive(int a);
+int lowest_bit(unsigned long long bits);
+int rotor_offset(const EnigmaState* state, int slot);
+long read_line(FILE* in, char** buffer, size_t* capacity);
 
 // Encryption functions
 int encode_through_rotor(int input_char, int rotor_index, int position, int direction, const EnigmaState* state);
 char apply_plugboard(char c, const char* plugboard);
+int scramble_letter(int c, const EnigmaState* state);
+int encipher_letter(int c, const EnigmaState* state);
+void build_substitution(const EnigmaState* state, unsigned char table[ALPHABET_SIZE + 1]);
+
+// Fused tables (plugboard conjugation)
+void build_plug_map(const char* plugboard, int plug[ALPHABET_SIZE]);
+void build_scrambler(const EnigmaState* state, unsigned char table[ALPHABET_SIZE]);
+void conjugate_table(const unsigned char* scrambler, const int plug[ALPHABET_SIZE], unsigned char* fused);
+void init_fused_tables(FusedTables* tables, const EnigmaState* state);
+void reset_fused_tables(FusedTables* tables, const EnigmaState* state);
+void reserve_fused_tables(FusedTables* tables, size_t capacity);
+void compile_fused_tables(FusedTables* tables, size_t length);
+void rekey_fused_plugboard(FusedTables* tables, const char* plugboard);
+void copy_fused_tables(FusedTables* to, const FusedTables* from);
+void swap_fused_cable(FusedTables* tables, int a, int b);
+void free_fused_tables(FusedTables* tables);
 
 // Stepping mechanism
 void step_rotors(EnigmaState* state);
 
+// Crib index (unigma_crib.c)
+void position_key(const EnigmaState* base, unsigned int key, EnigmaState* machine);
+void format_key_options(const EnigmaState* machine, char* out, size_t size);
+unsigned int prefix_hash(const unsigned char* letters, int length);
+int letters_of(const char* text, unsigned char* letters, int max_letters);
+void build_crib_index(const EnigmaState* base, const char* crib, int threads, CribIndex* index);
+int write_crib_index(const char* path, const CribIndex* index);
+int load_crib_index(const char* path, CribIndex* index);
+size_t lookup_crib_index(const CribIndex* index, const EnigmaState* base, const char* ciphertext,
+                         unsigned int* keys, size_t max_keys);
+void free_crib_index(CribIndex* index);
+void run_build_index(const EnigmaState* state, const RunOptions* options);
+void run_lookup_index(const EnigmaState* state, const RunOptions* options);
+
+// Key search (unigma_search.c)
+double ioc_score(const unsigned long counts[ALPHABET_SIZE]);
+double bigram_ioc_score(const unsigned long counts[ALPHABET_SIZE * ALPHABET_SIZE]);
+void format_plugboard(const int plug[ALPHABET_SIZE], char* out, size_t size);
+void run_daily_key(const EnigmaState* state, const RunOptions* options);
+void run_attack(const EnigmaState* state, const RunOptions* options);
+void run_live(const EnigmaState* state, const RunOptions* options);
+void run_turnover(const EnigmaState* state, const RunOptions* options);
+
+// Machine models (unigma_wiring.c)
+void load_machine_model(const char* path, EnigmaState* state);
+void run_recover_wiring(const EnigmaState* state, const RunOptions* options);
+
+// Bombe (unigma_bombe.c)
+int parse_bombe_menu(const char* line, BombeMenu* menu);
+int read_bombe_menus(FILE* in, BombeMenu* menus, int max_menus, unsigned long* line_number, int* more);
+BombeStop* run_bombe_menus(const EnigmaState* base, const BombeMenu* menus, int menu_count,
+                           int threads, size_t* stop_count);
+void run_bombe(const EnigmaState* state, const RunOptions* options);
+void run_place_cribs(const RunOptions* options);
+
+// Experimental engines (unigma_engines.c)
+void run_engine_benchmark(const EnigmaState* state);
+
+// Thread-scaling benchmark (unigma_bench.c)
+void run_thread_benchmark(const EnigmaState* state, const RunOptions* options);
+
+// Service (unigma_service.c)
+int service_handle(KeyCache* cache, const EnigmaState* base, char* line, size_t length, size_t* payload);
+void latency_record(LatencyHistogram* histogram, unsigned long long microseconds);
+void latency_merge(LatencyHistogram* into, const LatencyHistogram* from);
+unsigned long long latency_percentile(const LatencyHistogram* histogram, double percentile);
+void run_serve(const EnigmaState* state, const RunOptions* options, RunStats* stats);
+void run_replay(const EnigmaState* state, const RunOptions* options, RunStats* stats);
+void run_service_load(const EnigmaState* state, int workers, unsigned long count, int keys, size_t length,
+                      unsigned long* served, RunStats* stats);
+
+// Compressed and file stream I/O (unigma_gzip.c)
+int input_may_be_compressed(FILE* in);
+int has_compressed_magic(const unsigned char* bytes, size_t length);
+void run_file_stream(EnigmaState* state, const RunOptions* options, RunStats* stats);
+void encrypt_file_stream(EnigmaState* state, FILE* in, FILE* out, int threads, int compress_output, RunStats* stats);
+
+// Memory accounting (unigma_memory.c)
+void* memory_alloc(MemoryCategory category, size_t size);
+void* memory_calloc(MemoryCategory category, size_t count, size_t size);
+void* memory_realloc(MemoryCategory category, void* block, size_t size);
+void memory_free(void* block);
+int memory_over_limit(MemoryCategory category);
+void memory_evictor(MemoryCategory category, int delta);
+void memory_note_eviction(MemoryCategory category);
+int set_memory_limit(const char* spec);
+void print_memory_stats(void);
+
 // Platform-specific functions
 #ifndef UNIVAC
 void console_setup(void);
 #endif
+void run_workers(int count, WorkerFunc func, void* context);
+int default_thread_count(void);
+ScoreFunc load_scorer(const char* path);
+void queue_init(BoundedQueue* queue, int capacity);
+void queue_destroy(BoundedQueue* queue);
+int queue_push(BoundedQueue* queue, void* item);
+void* queue_pop(BoundedQueue* queue);
+void queue_close(BoundedQueue* queue);
+unsigned long long clock_microseconds(void);
+int lock_memory(void* block, size_t size);
+unsigned long long pin_current_thread(int cpu);
+void restore_thread_affinity(unsigned long long mask);
+int numa_node_count(void);
+int layout_cpu(PinLayout layout, int worker);
+void meter_workers(WorkerMeter* meter);
+void wait_until(unsigned long long microseconds);
 
 #endif // UNIGMA_H
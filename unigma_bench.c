@@ -0,0 +1,297 @@
+/*
+ * Program Name: Unigma
+ * Program Release Year: 2025
+ * Program Author: Steven S.
+ * Program Link: https://github.com/BitEU/Unigma
+ * Purpose: Thread-scaling benchmark for Unigma - the parallel modes at 1..N threads, reported as JSON
+ */
+
+#include "unigma.h"
+
+// Thread-scaling benchmark
+//
+// --bench-threads N runs each parallel mode on a fixed workload at 1, 2, 4,
+// ... threads up to N (and at N itself) and writes one JSON document to
+// stdout for plotting:
+//
+//   file     the file stream pipeline (reader, encrypt and writer stages)
+//            through temporary files, each block split over the threads
+//   records  keyed record mode, key groups hashed onto the threads
+//   search   the bombe over every rotor order and start position
+//   service  the request service with that many workers, fed as fast as
+//            it takes requests
+//
+// Each run reports wall time, throughput, and speedup and parallel
+// efficiency against the 1-thread run. The spread between threads is the
+// coefficient of variation and max/mean of each worker's busy time, as
+// metered in run_workers (for the service, of requests served per worker):
+// near 0 and 1 when the work is balanced. Contention shows as fork-joins
+// (every run_workers call is a barrier) and queue waits: pushes and pops
+// that had to wait on the file stream's bounded queues or the service's
+// request ring. --pin compact|scatter pins the workers (see layout_cpu).
+
+#define BENCH_FILE_BYTES (16UL << 20)   // Text through the file stream
+#define BENCH_RECORDS 65536             // Keyed records
+#define BENCH_RECORD_LETTERS 48
+#define BENCH_KEYS 64                   // Keys the records and requests rotate through
+#define BENCH_MENUS 4                   // Bombe menus searched together
+#define BENCH_REQUESTS 50000            // Service requests
+#define BENCH_REQUEST_LETTERS 64
+
+typedef enum {
+    BENCH_FILE,
+    BENCH_RECORDS_MODE,
+    BENCH_SEARCH,
+    BENCH_SERVICE,
+    BENCH_MODES
+} BenchMode;
+
+static const char* const BENCH_MODE_NAMES[BENCH_MODES] = { "file", "records", "search", "service" };
+static const char* const BENCH_UNITS[BENCH_MODES] = { "bytes", "records", "positions", "requests" };
+static const char* const PIN_NAMES[] = { "none", "compact", "scatter" };
+
+typedef struct {
+    double seconds;
+    double spread_cv;                   // Coefficient of variation between threads
+    double spread_max;                  // Busiest thread over the mean
+    long fork_joins;
+    unsigned long full_waits;
+    unsigned long empty_waits;
+} BenchRun;
+
+// Inputs shared by every run
+typedef struct {
+    const EnigmaState* state;
+    FILE* file_in;
+    FILE* file_out;
+    FILE* records_in;
+    FILE* records_out;
+    BombeMenu menus[BENCH_MENUS];
+} BenchInputs;
+
+static FILE* bench_tmpfile(void) {
+    FILE* file = tmpfile();
+
+    if (!file) {
+        fprintf(stderr, "Error: Could not create a temporary file for the benchmark\n");
+        exit(1);
+    }
+    return file;
+}
+
+// Pseudo-random text: letters in words, with spaces and newlines
+static void fill_text(char* text, size_t length, unsigned long seed) {
+    for (size_t i = 0; i < length; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        int r = (int)((seed >> 16) % 32);
+        text[i] = r < ALPHABET_SIZE ? (char)('A' + r) : (r == 31 ? '\n' : ' ');
+    }
+}
+
+static void prepare_inputs(BenchInputs* inputs, const EnigmaState* state) {
+    char* text = (char*)memory_alloc(MEM_IO, BENCH_FILE_BYTES);
+
+    if (!text) {
+        fprintf(stderr, "Error: Out of memory preparing the benchmark\n");
+        exit(1);
+    }
+    memset(inputs, 0, sizeof(BenchInputs));
+    inputs->state = state;
+
+    fill_text(text, BENCH_FILE_BYTES, 12345);
+    inputs->file_in = bench_tmpfile();
+    inputs->file_out = bench_tmpfile();
+    fwrite(text, 1, BENCH_FILE_BYTES, inputs->file_in);
+
+    // Records: KEY<TAB>TEXT with the key (start positions) rotating
+    inputs->records_in = bench_tmpfile();
+    inputs->records_out = bench_tmpfile();
+    for (int r = 0; r < BENCH_RECORDS; r++) {
+        int key = r % BENCH_KEYS;
+        fprintf(inputs->records_in, "%c%c%c\t", 'A' + key / (ALPHABET_SIZE * ALPHABET_SIZE) % ALPHABET_SIZE,
+                'A' + key / ALPHABET_SIZE % ALPHABET_SIZE, 'A' + key % ALPHABET_SIZE);
+        for (int i = 0; i < BENCH_RECORD_LETTERS; i++) {
+            fputc('A' + (r * 7 + i * 3) % ALPHABET_SIZE, inputs->records_in);
+        }
+        fputc('\n', inputs->records_in);
+    }
+
+    // Menus: cribs from a message enciphered on the machine as configured
+    EnigmaState machine = *state;
+    char message[BENCH_MENUS * BOMBE_MAX_MENU];
+    char cipher[sizeof(message)];
+    fill_text(message, sizeof(message), 777);
+    for (size_t i = 0; i < sizeof(message); i++) {
+        message[i] = (char)('A' + (unsigned char)message[i] % ALPHABET_SIZE);
+    }
+    memcpy(cipher, message, sizeof(message));
+    encrypt_block(&machine, cipher, sizeof(cipher));
+    for (int m = 0; m < BENCH_MENUS; m++) {
+        char line[sizeof(message) + BOMBE_MAX_MENU + 32];
+        int offset = m * BOMBE_MAX_MENU;
+        int length = 14;
+
+        snprintf(line, sizeof(line), "%.*s\t%.*s\t%d", offset + length, cipher, length, message + offset, offset);
+        if (parse_bombe_menu(line, &inputs->menus[m]) != 0) {
+            fprintf(stderr, "Error: Could not build the benchmark bombe menus\n");
+            exit(1);
+        }
+    }
+
+    memory_free(text);
+}
+
+static void free_inputs(BenchInputs* inputs) {
+    fclose(inputs->file_in);
+    fclose(inputs->file_out);
+    fclose(inputs->records_in);
+    fclose(inputs->records_out);
+}
+
+static unsigned long bench_work(BenchMode mode) {
+    switch (mode) {
+    case BENCH_FILE:
+        return BENCH_FILE_BYTES;
+    case BENCH_RECORDS_MODE:
+        return BENCH_RECORDS;
+    case BENCH_SEARCH:
+        return (unsigned long)NUM_ROTOR_ORDERS * NUM_POSITIONS;
+    default:
+        return BENCH_REQUESTS;
+    }
+}
+
+// Coefficient of variation and max/mean of the first count values
+static void spread(const double* values, int count, double* cv, double* max_over_mean) {
+    double sum = 0.0;
+    double squares = 0.0;
+    double max = 0.0;
+
+    for (int i = 0; i < count; i++) {
+        sum += values[i];
+        squares += values[i] * values[i];
+        if (values[i] > max) {
+            max = values[i];
+        }
+    }
+    double mean = sum / count;
+    double variance = squares / count - mean * mean;
+    if (mean <= 0.0) {
+        *cv = 0.0;
+        *max_over_mean = 1.0;
+        return;
+    }
+    // Square root by Newton's method, to stay clear of libm
+    double root = variance > 0.0 ? variance : 0.0;
+    if (root > 0.0) {
+        double x = root > 1.0 ? root : 1.0;
+        for (int i = 0; i < 64; i++) {
+            x = 0.5 * (x + root / x);
+        }
+        root = x;
+    }
+    *cv = root / mean;
+    *max_over_mean = max / mean;
+}
+
+static void bench_run(const BenchInputs* inputs, BenchMode mode, int threads, PinLayout layout, BenchRun* run) {
+    static WorkerMeter meter;
+    unsigned long served[MAX_THREADS];
+    double per_thread[MAX_THREADS];
+    RunStats stats;
+    unsigned long long started;
+
+    memset(&meter, 0, sizeof(WorkerMeter));
+    memset(&stats, 0, sizeof(RunStats));
+    meter.layout = layout;
+    meter.width = threads;
+    meter_workers(&meter);
+
+    started = clock_microseconds();
+    if (mode == BENCH_FILE) {
+        EnigmaState machine = *inputs->state;
+        rewind(inputs->file_in);
+        rewind(inputs->file_out);
+        encrypt_file_stream(&machine, inputs->file_in, inputs->file_out, threads, 0, &stats);
+    } else if (mode == BENCH_RECORDS_MODE) {
+        rewind(inputs->records_in);
+        rewind(inputs->records_out);
+        encrypt_keyed_records(inputs->state, inputs->records_in, inputs->records_out, threads, &stats);
+        fflush(inputs->records_out);
+    } else if (mode == BENCH_SEARCH) {
+        size_t stop_count;
+        memory_free(run_bombe_menus(inputs->state, inputs->menus, BENCH_MENUS, threads, &stop_count));
+    } else {
+        run_service_load(inputs->state, threads, BENCH_REQUESTS, BENCH_KEYS, BENCH_REQUEST_LETTERS, served, &stats);
+    }
+    run->seconds = (double)(clock_microseconds() - started) / 1e6;
+    meter_workers(NULL);
+
+    for (int w = 0; w < threads; w++) {
+        per_thread[w] = mode == BENCH_SERVICE ? (double)served[w] : (double)meter.busy[w];
+    }
+    spread(per_thread, threads, &run->spread_cv, &run->spread_max);
+    run->fork_joins = meter.fork_joins;
+    run->full_waits = stats.queue_full_waits;
+    run->empty_waits = stats.queue_empty_waits;
+    if (run->seconds <= 0.0) {
+        run->seconds = 1e-6;
+    }
+}
+
+void run_thread_benchmark(const EnigmaState* state, const RunOptions* options) {
+    BenchInputs inputs;
+    int counts[MAX_THREADS];
+    int count_total = 0;
+    int max_threads = options->bench_threads;
+
+    for (int t = 1; t < max_threads; t *= 2) {
+        counts[count_total++] = t;
+    }
+    counts[count_total++] = max_threads;
+
+    prepare_inputs(&inputs, state);
+    fprintf(stderr, "Thread benchmark: 1..%d threads, %d processors, %d NUMA node(s), pinning %s\n",
+            max_threads, default_thread_count(), numa_node_count(), PIN_NAMES[options->pin_layout]);
+
+    printf("{\n");
+    printf("  \"benchmark\": \"thread-scaling\",\n");
+    printf("  \"processors\": %d,\n", default_thread_count());
+    printf("  \"numa_nodes\": %d,\n", numa_node_count());
+    printf("  \"pin\": \"%s\",\n", PIN_NAMES[options->pin_layout]);
+    printf("  \"modes\": [\n");
+    for (int mode = 0; mode < BENCH_MODES; mode++) {
+        double base_seconds = 0.0;
+
+        printf("    {\n");
+        printf("      \"mode\": \"%s\",\n", BENCH_MODE_NAMES[mode]);
+        printf("      \"unit\": \"%s\",\n", BENCH_UNITS[mode]);
+        printf("      \"work\": %lu,\n", bench_work((BenchMode)mode));
+        printf("      \"thread_spread\": \"%s\",\n", mode == BENCH_SERVICE ? "requests" : "busy_time");
+        printf("      \"runs\": [\n");
+        for (int c = 0; c < count_total; c++) {
+            BenchRun run;
+            int threads = counts[c];
+
+            fprintf(stderr, "  %s at %d thread(s)...\n", BENCH_MODE_NAMES[mode], threads);
+            bench_run(&inputs, (BenchMode)mode, threads, options->pin_layout, &run);
+            if (c == 0) {
+                base_seconds = run.seconds;  // counts[0] is always 1
+            }
+            double speedup = base_seconds / run.seconds;
+
+            printf("        { \"threads\": %d, \"seconds\": %.6f, \"throughput\": %.1f, "
+                   "\"speedup\": %.3f, \"efficiency\": %.3f, \"thread_cv\": %.4f, \"thread_max_mean\": %.3f, "
+                   "\"fork_joins\": %ld, \"queue_full_waits\": %lu, \"queue_empty_waits\": %lu }%s\n",
+                   threads, run.seconds, (double)bench_work((BenchMode)mode) / run.seconds,
+                   speedup, speedup / threads, run.spread_cv, run.spread_max,
+                   run.fork_joins, run.full_waits, run.empty_waits, c + 1 < count_total ? "," : "");
+        }
+        printf("      ]\n");
+        printf("    }%s\n", mode + 1 < BENCH_MODES ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+
+    free_inputs(&inputs);
+}
@@ -0,0 +1,543 @@
+/*
+ * Program Name: Unigma
+ * Program Release Year: 2025
+ * Program Author: Steven S.
+ * Program Link: https://github.com/BitEU/Unigma
+ * Purpose: Bombe for Unigma - places cribs and tests crib menus against every rotor order and start position
+ */
+
+#include "unigma.h"
+
+// How the bombe works
+//
+// A menu is a crib laid against the ciphertext at an offset: each pair
+// (plain letter a, cipher letter b at message position j) says that
+// plug(b) = S_j(plug(a)), where S_j is the plugboard-free scrambler at
+// position j. The bombe assumes a value for the plug of the menu's most
+// connected letter and follows the consequences through every pair, and
+// through the diagonal board (plug(a) = b implies plug(b) = a). If the
+// assumption lights every possible value for that letter it was
+// contradictory and so is every value it lit; anything else is a stop.
+//
+// All menus are tested in one sweep: for every rotor order the scrambler
+// for all 17,576 rotor positions is compiled once, and at each start
+// position the tables along the stepping path are looked up once and
+// shared by every menu.
+
+// One bombe run over a set of menus
+typedef struct {
+    const EnigmaState* base;            // Rings the bombe assumes
+    const BombeMenu* menus;
+    int menu_count;
+    int span;                           // Message positions the menus reach
+    const unsigned char* scrambler;     // NUM_POSITIONS x 26 for the current order
+    int order;
+    int workers;
+    BombeStop* stops[MAX_THREADS];      // Stops found by each worker
+    size_t stop_count[MAX_THREADS];
+    size_t stop_capacity[MAX_THREADS];
+} BombeRun;
+
+// Parse "CIPHERTEXT<TAB>CRIB<TAB>OFFSET" into a menu. Returns 0 on success.
+// Anything after the offset (--place-cribs writes the message number there)
+// is ignored.
+int parse_bombe_menu(const char* line, BombeMenu* menu) {
+    const char* crib = strchr(line, '\t');
+    const char* offset = crib ? strchr(crib + 1, '\t') : NULL;
+    unsigned char cipher[BOMBE_MAX_SPAN];
+    unsigned char plain[BOMBE_MAX_MENU];
+
+    if (!crib || !offset) {
+        return -1;
+    }
+
+    int cipher_length = 0;
+    for (const char* p = line; p < crib && cipher_length < BOMBE_MAX_SPAN; p++) {
+        int c = toupper((unsigned char)*p);
+        if (c >= 'A' && c <= 'Z') {
+            cipher[cipher_length++] = (unsigned char)(c - 'A');
+        }
+    }
+
+    int crib_length = 0;
+    for (const char* p = crib + 1; p < offset && crib_length < BOMBE_MAX_MENU; p++) {
+        int c = toupper((unsigned char)*p);
+        if (c >= 'A' && c <= 'Z') {
+            plain[crib_length++] = (unsigned char)(c - 'A');
+        }
+    }
+
+    int start = atoi(offset + 1);
+    if (crib_length == 0 || start < 0 || start + crib_length > cipher_length) {
+        return -1;
+    }
+
+    memset(menu, 0, sizeof(BombeMenu));
+    menu->offset = start;
+    menu->length = crib_length;
+    for (int k = 0; k < crib_length; k++) {
+        menu->plain[k] = plain[k];
+        menu->cipher[k] = cipher[start + k];
+        if (plain[k] == cipher[start + k]) {
+            return -1;  // A letter never encrypts to itself: impossible placement
+        }
+    }
+
+    // Test register: the letter on the most pairs
+    int degree[ALPHABET_SIZE];
+    memset(degree, 0, sizeof(degree));
+    for (int k = 0; k < crib_length; k++) {
+        degree[plain[k]]++;
+        degree[menu->cipher[k]]++;
+    }
+    for (int i = 1; i < ALPHABET_SIZE; i++) {
+        if (degree[i] > degree[menu->test_letter]) {
+            menu->test_letter = i;
+        }
+    }
+
+    // Pairs grouped by letter, so the closure only visits the pairs it uses
+    int fill[ALPHABET_SIZE];
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        menu->link_start[i + 1] = (unsigned char)(menu->link_start[i] + degree[i]);
+        fill[i] = menu->link_start[i];
+    }
+    for (int k = 0; k < crib_length; k++) {
+        menu->link_pair[fill[plain[k]]] = (unsigned char)k;
+        menu->link_other[fill[plain[k]]++] = menu->cipher[k];
+        menu->link_pair[fill[menu->cipher[k]]] = (unsigned char)k;
+        menu->link_other[fill[menu->cipher[k]]++] = plain[k];
+    }
+    return 0;
+}
+
+// Follow one plug hypothesis through the menu. tables[k] is the scrambler at
+// the position of pair k. Returns the set of values lit for the test letter;
+// the search gives up as soon as every value is lit, since that is no stop.
+static unsigned int bombe_closure(const BombeMenu* menu, const unsigned char* const* tables, int hypothesis) {
+    const unsigned int all = (1u << ALPHABET_SIZE) - 1;
+    unsigned int lit[ALPHABET_SIZE];
+    unsigned short queue[ALPHABET_SIZE * ALPHABET_SIZE];
+    int head = 0;
+    int tail = 0;
+
+    memset(lit, 0, sizeof(lit));
+    lit[menu->test_letter] = 1u << hypothesis;
+    queue[tail++] = (unsigned short)(menu->test_letter * ALPHABET_SIZE + hypothesis);
+
+    while (head < tail) {
+        int letter = queue[head] / ALPHABET_SIZE;
+        int value = queue[head] % ALPHABET_SIZE;
+        head++;
+
+        // Diagonal board: plug(letter) = value means plug(value) = letter
+        if (!(lit[value] & (1u << letter))) {
+            lit[value] |= 1u << letter;
+            queue[tail++] = (unsigned short)(value * ALPHABET_SIZE + letter);
+        }
+
+        // Every pair on this letter carries the value across its scrambler
+        for (int l = menu->link_start[letter]; l < menu->link_start[letter + 1]; l++) {
+            int other = menu->link_other[l];
+            int carried = tables[menu->link_pair[l]][value];
+            if (!(lit[other] & (1u << carried))) {
+                lit[other] |= 1u << carried;
+                queue[tail++] = (unsigned short)(other * ALPHABET_SIZE + carried);
+            }
+        }
+
+        if (lit[menu->test_letter] == all) {
+            break;
+        }
+    }
+    return lit[menu->test_letter];
+}
+
+static void add_stop(BombeRun* run, int worker, int menu, unsigned int key, unsigned int candidates) {
+    if (run->stop_count[worker] == run->stop_capacity[worker]) {
+        size_t capacity = run->stop_capacity[worker] ? run->stop_capacity[worker] * 2 : 64;
+        BombeStop* grown = (BombeStop*)memory_realloc(MEM_SEARCH, run->stops[worker], capacity * sizeof(BombeStop));
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory recording bombe stops\n");
+            exit(1);
+        }
+        run->stops[worker] = grown;
+        run->stop_capacity[worker] = capacity;
+    }
+
+    BombeStop* stop = &run->stops[worker][run->stop_count[worker]++];
+    stop->menu = menu;
+    stop->key = key;
+    stop->candidates = candidates;
+}
+
+// Worker: every start position whose left rotor is assigned to this worker
+static void bombe_worker(void* context, int worker) {
+    BombeRun* run = (BombeRun*)context;
+    const unsigned char* path[BOMBE_MAX_SPAN];
+    const unsigned char* tables[BOMBE_MAX_MENU];
+    const unsigned int all = (1u << ALPHABET_SIZE) - 1;
+
+    for (int left = worker; left < ALPHABET_SIZE; left += run->workers) {
+        for (int rest = 0; rest < ALPHABET_SIZE * ALPHABET_SIZE; rest++) {
+            unsigned int key = (unsigned int)(run->order * NUM_POSITIONS + left * ALPHABET_SIZE * ALPHABET_SIZE + rest);
+            EnigmaState machine;
+
+            // Scramblers along the stepping path, shared by every menu
+            position_key(run->base, key, &machine);
+            for (int j = 0; j < run->span; j++) {
+                step_rotors(&machine);
+                path[j] = run->scrambler + (size_t)(machine.positions[2] * ALPHABET_SIZE * ALPHABET_SIZE +
+                                                    machine.positions[1] * ALPHABET_SIZE +
+                                                    machine.positions[0]) * ALPHABET_SIZE;
+            }
+
+            for (int m = 0; m < run->menu_count; m++) {
+                const BombeMenu* menu = &run->menus[m];
+                for (int k = 0; k < menu->length; k++) {
+                    tables[k] = path[menu->offset + k];
+                }
+
+                // Lit values are all false; a full set means no stop
+                unsigned int lit = bombe_closure(menu, tables, 0);
+                if (lit == all) {
+                    continue;
+                }
+                unsigned int candidates = (lit == 1u) ? 1u : (all & ~lit);
+                add_stop(run, worker, m, key, candidates);
+            }
+        }
+        UNIGMA_PROBE3(search__unit, "bombe", run->order * ALPHABET_SIZE + left, worker);
+    }
+}
+
+static int compare_stops(const void* a, const void* b) {
+    const BombeStop* x = (const BombeStop*)a;
+    const BombeStop* y = (const BombeStop*)b;
+
+    if (x->menu != y->menu) {
+        return x->menu - y->menu;
+    }
+    return x->key < y->key ? -1 : (x->key > y->key);
+}
+
+// Run the bombe for every menu over every rotor order and start position.
+// Returns the stops sorted by menu and key; the caller frees them.
+BombeStop* run_bombe_menus(const EnigmaState* base, const BombeMenu* menus, int menu_count,
+                           int threads, size_t* stop_count) {
+    BombeRun run;
+    BombeStop* all = NULL;
+    size_t total = 0;
+    unsigned char* scrambler = (unsigned char*)memory_alloc(MEM_SEARCH, (size_t)NUM_POSITIONS * ALPHABET_SIZE);
+
+    if (!scrambler) {
+        fprintf(stderr, "Error: Out of memory for bombe tables\n");
+        exit(1);
+    }
+
+    memset(&run, 0, sizeof(run));
+    run.base = base;
+    run.menus = menus;
+    run.menu_count = menu_count;
+    run.scrambler = scrambler;
+    run.workers = threads > 0 ? threads : default_thread_count();
+    for (int m = 0; m < menu_count; m++) {
+        if (menus[m].offset + menus[m].length > run.span) {
+            run.span = menus[m].offset + menus[m].length;
+        }
+    }
+
+    for (run.order = 0; run.order < NUM_ROTOR_ORDERS; run.order++) {
+        EnigmaState machine;
+        CompiledMachine compiled;
+
+        // Plugboard-free scrambler at every rotor position of this order
+        position_key(base, (unsigned int)(run.order * NUM_POSITIONS), &machine);
+        machine.plugboard[0] = '\0';
+        compile_machine(&machine, &compiled);
+        for (int p = 0; p < NUM_POSITIONS; p++) {
+            int positions[NUM_ROTORS];
+            positions[2] = p / (ALPHABET_SIZE * ALPHABET_SIZE);
+            positions[1] = p / ALPHABET_SIZE % ALPHABET_SIZE;
+            positions[0] = p % ALPHABET_SIZE;
+            for (int c = 0; c < ALPHABET_SIZE; c++) {
+                scrambler[p * ALPHABET_SIZE + c] = (unsigned char)compiled_encipher(c, positions, &compiled);
+            }
+        }
+
+        run_workers(run.workers, bombe_worker, &run);
+    }
+
+    for (int w = 0; w < run.workers; w++) {
+        total += run.stop_count[w];
+    }
+    if (total > 0) {
+        all = (BombeStop*)memory_alloc(MEM_SEARCH, total * sizeof(BombeStop));
+        if (!all) {
+            fprintf(stderr, "Error: Out of memory collecting bombe stops\n");
+            exit(1);
+        }
+        total = 0;
+        for (int w = 0; w < run.workers; w++) {
+            memcpy(all + total, run.stops[w], run.stop_count[w] * sizeof(BombeStop));
+            total += run.stop_count[w];
+        }
+        qsort(all, total, sizeof(BombeStop), compare_stops);
+    }
+    for (int w = 0; w < run.workers; w++) {
+        memory_free(run.stops[w]);
+    }
+    memory_free(scrambler);
+
+    *stop_count = total;
+    return all;
+}
+
+// Read menus, one "CIPHERTEXT<TAB>CRIB<TAB>OFFSET" per line, numbering them
+// by input line. *line_number carries the count of lines read over calls,
+// and *more is set when max_menus were read and the input goes on.
+int read_bombe_menus(FILE* in, BombeMenu* menus, int max_menus, unsigned long* line_number, int* more) {
+    char* line = NULL;
+    size_t capacity = 0;
+    int count = 0;
+
+    while (count < max_menus && read_line(in, &line, &capacity) >= 0) {
+        ++*line_number;
+        if (parse_bombe_menu(line, &menus[count]) == 0) {
+            menus[count++].line = *line_number;
+        } else {
+            fprintf(stderr, "Warning: Menu on line %lu is malformed or impossible, skipped\n", *line_number);
+        }
+    }
+    memory_free(line);
+
+    int c = getc(in);
+    *more = c != EOF;
+    if (c != EOF) {
+        ungetc(c, in);
+    }
+    return count;
+}
+
+// --bombe FILE: stops for every menu, one line each. Menus are run
+// BOMBE_MAX_MENUS at a time, so a file of any length (such as the output
+// of --place-cribs) is tested in full.
+void run_bombe(const EnigmaState* state, const RunOptions* options) {
+    static BombeMenu menus[BOMBE_MAX_MENUS];
+    FILE* in = strcmp(options->path, "-") == 0 ? stdin : fopen(options->path, "r");
+    unsigned long line_number = 0;
+    unsigned long total_menus = 0;
+    unsigned long total_stops = 0;
+    int batches = 0;
+    int more;
+    char key[64];
+
+    if (!in) {
+        fprintf(stderr, "Error: Could not open menu file '%s'\n", options->path);
+        exit(1);
+    }
+
+    do {
+        size_t stop_count;
+        int menu_count = read_bombe_menus(in, menus, BOMBE_MAX_MENUS, &line_number, &more);
+        if (menu_count == 0) {
+            continue;
+        }
+
+        BombeStop* stops = run_bombe_menus(state, menus, menu_count, options->threads, &stop_count);
+        for (size_t i = 0; i < stop_count; i++) {
+            EnigmaState machine;
+            const BombeMenu* menu = &menus[stops[i].menu];
+
+            position_key(state, stops[i].key, &machine);
+            format_key_options(&machine, key, sizeof(key));
+            printf("Menu %lu: %s  %c=", menu->line, key, 'A' + menu->test_letter);
+            for (int c = 0; c < ALPHABET_SIZE; c++) {
+                if (stops[i].candidates & (1u << c)) {
+                    putchar('A' + c);
+                }
+            }
+            putchar('\n');
+        }
+        memory_free(stops);
+        total_menus += (unsigned long)menu_count;
+        total_stops += (unsigned long)stop_count;
+        batches++;
+    } while (more);
+
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (total_menus == 0) {
+        fprintf(stderr, "Error: No usable menus in '%s'\n", options->path);
+        exit(1);
+    }
+    fprintf(stderr, "%lu menu(s) in %d batch(es), %lu stop(s)\n", total_menus, batches, total_stops);
+}
+
+// Crib placement
+//
+// --place-cribs makes the bombe's menus: every (message, crib, offset) where
+// no crib letter sits on the same cipher letter, since a letter never
+// encrypts to itself. The cribs are packed into 64-bit words, each crib a run
+// of consecutive bits, and scanned shift-and style: bit i of a word's state
+// is set while the crib letters up to i all differ from the cipher letters
+// they lie on. Each cipher letter costs a shift, an OR and an AND per word,
+// however many cribs the word holds, and a set end bit is a legal placement.
+// Messages are read line by line in one pass, so a day's intercepts can be
+// any size; only the first BOMBE_MAX_SPAN letters of each are scanned, as
+// the bombe takes no more.
+
+#define PLACE_MAX_CRIBS 256             // Cribs one placement scan takes
+
+typedef struct {
+    unsigned long long keep[ALPHABET_SIZE];  // Bits of the crib letters other than this letter
+    unsigned long long starts;               // First bit of every crib in the word
+    unsigned long long ends;                 // Last bit of every crib in the word
+    short end_crib[64];                      // Crib that ends at each bit
+} CribWord;
+
+typedef struct {
+    CribWord words[PLACE_MAX_CRIBS];    // At most one word per crib
+    int word_count;
+    int word_bits;                      // Bits taken in the last word
+    int crib_count;
+    int lengths[PLACE_MAX_CRIBS];
+    char text[PLACE_MAX_CRIBS][BOMBE_MAX_MENU + 1];
+} CribSet;
+
+// Add a crib to the set, starting a new word when it does not fit the last
+static void add_crib(CribSet* set, const unsigned char* letters, int length) {
+    int crib = set->crib_count++;
+    int used = set->word_bits;
+
+    if (set->word_count == 0 || used + length > 64) {
+        CribWord* word = &set->words[set->word_count++];
+        memset(word, 0, sizeof(CribWord));
+        for (int c = 0; c < ALPHABET_SIZE; c++) {
+            word->keep[c] = ~0ULL;
+        }
+        used = 0;
+    }
+
+    CribWord* word = &set->words[set->word_count - 1];
+    set->lengths[crib] = length;
+    for (int i = 0; i < length; i++) {
+        word->keep[letters[i]] &= ~(1ULL << (used + i));
+        set->text[crib][i] = (char)('A' + letters[i]);
+    }
+    set->text[crib][length] = '\0';
+    word->starts |= 1ULL << used;
+    word->ends |= 1ULL << (used + length - 1);
+    word->end_crib[used + length - 1] = (short)crib;
+    set->word_bits = used + length;
+}
+
+// One crib per line, letters only
+static void read_cribs(const char* path, CribSet* set) {
+    FILE* in = fopen(path, "r");
+    unsigned char letters[BOMBE_MAX_MENU + 1];
+    char* line = NULL;
+    size_t capacity = 0;
+    unsigned long line_number = 0;
+
+    if (!in) {
+        fprintf(stderr, "Error: Could not open crib file '%s'\n", path);
+        exit(1);
+    }
+
+    memset(set, 0, sizeof(CribSet));
+    while (read_line(in, &line, &capacity) >= 0) {
+        int count = letters_of(line, letters, BOMBE_MAX_MENU + 1);
+
+        line_number++;
+        if (count == 0) {
+            continue;
+        }
+        if (count > BOMBE_MAX_MENU) {
+            fprintf(stderr, "Warning: Crib on line %lu is longer than %d letters, skipped\n", line_number, BOMBE_MAX_MENU);
+            continue;
+        }
+        if (set->crib_count == PLACE_MAX_CRIBS) {
+            fprintf(stderr, "Warning: Only the first %d cribs are used\n", PLACE_MAX_CRIBS);
+            break;
+        }
+        add_crib(set, letters, count);
+    }
+
+    memory_free(line);
+    fclose(in);
+}
+
+// Write a menu line for every legal placement of every crib in one message.
+// Returns the number of placements.
+static unsigned long place_cribs(const CribSet* set, const unsigned char* cipher, int length,
+                                 unsigned long message, FILE* out) {
+    unsigned long long state[PLACE_MAX_CRIBS];
+    char text[BOMBE_MAX_SPAN];
+    unsigned long placements = 0;
+
+    memset(state, 0, (size_t)set->word_count * sizeof(unsigned long long));
+    for (int j = 0; j < length; j++) {
+        text[j] = (char)('A' + cipher[j]);
+    }
+
+    for (int j = 0; j < length; j++) {
+        int c = cipher[j];
+
+        for (int w = 0; w < set->word_count; w++) {
+            const CribWord* word = &set->words[w];
+            unsigned long long legal = ((state[w] << 1) | word->starts) & word->keep[c];
+            unsigned long long hits = legal & word->ends;
+
+            state[w] = legal;
+            while (hits) {
+                int crib = word->end_crib[lowest_bit(hits)];
+                int offset = j - set->lengths[crib] + 1;
+
+                fprintf(out, "%.*s\t%s\t%d\t%lu\n", j + 1, text, set->text[crib], offset, message);
+                placements++;
+                hits &= hits - 1;
+            }
+        }
+    }
+    return placements;
+}
+
+// --place-cribs FILE: bombe menus for the cribs in FILE against every message
+// (one per line) of the -i file or stdin
+void run_place_cribs(const RunOptions* options) {
+    static CribSet set;
+    FILE* in = options->input_path ? fopen(options->input_path, "r") : stdin;
+    unsigned char cipher[BOMBE_MAX_SPAN];
+    char* line = NULL;
+    size_t capacity = 0;
+    unsigned long messages = 0;
+    unsigned long placements = 0;
+
+    read_cribs(options->path, &set);
+    if (set.crib_count == 0) {
+        fprintf(stderr, "Error: No cribs in '%s'\n", options->path);
+        exit(1);
+    }
+    if (!in) {
+        fprintf(stderr, "Error: Could not open input file '%s'\n", options->input_path);
+        exit(1);
+    }
+
+    while (read_line(in, &line, &capacity) >= 0) {
+        int letters = letters_of(line, cipher, BOMBE_MAX_SPAN);
+
+        messages++;
+        if (letters > 0) {
+            placements += place_cribs(&set, cipher, letters, messages, stdout);
+        }
+    }
+
+    memory_free(line);
+    if (in != stdin) {
+        fclose(in);
+    }
+    fprintf(stderr, "%lu message(s), %d crib(s) in %d word(s), %lu placement(s)\n",
+            messages, set.crib_count, set.word_count, placements);
+}
@@ -0,0 +1,347 @@
+/*
+ * Program Name: Unigma
+ * Program Release Year: 2025
+ * Program Author: Steven S.
+ * Program Link: https://github.com/BitEU/Unigma
+ * Purpose: Crib index for Unigma - precomputed ciphertext prefixes of a known opening under every key
+ */
+
+#include "unigma.h"
+
+static const char CRIB_INDEX_MAGIC[8] = { 'U', 'N', 'I', 'G', 'M', 'A', 'I', 'X' };
+
+// Work shared by the index builder threads
+typedef struct {
+    const EnigmaState* base;
+    const unsigned char* crib;
+    int crib_length;
+    int workers;
+    CribIndexEntry* entries;
+} IndexBuild;
+
+// Set up a machine for an index key: the base machine's rings and plugboard,
+// with the rotor order and start position taken from the key
+void position_key(const EnigmaState* base, unsigned int key, EnigmaState* machine) {
+    unsigned int position = key % NUM_POSITIONS;
+
+    *machine = *base;
+    apply_rotor_order(machine, ROTOR_ORDERS[key / NUM_POSITIONS]);
+    machine->positions[2] = (int)(position / (ALPHABET_SIZE * ALPHABET_SIZE));
+    machine->positions[1] = (int)(position / ALPHABET_SIZE % ALPHABET_SIZE);
+    machine->positions[0] = (int)(position % ALPHABET_SIZE);
+}
+
+// Format a machine's key as the command-line options that select it
+void format_key_options(const EnigmaState* machine, char* out, size_t size) {
+    char order[4];
+
+    for (int i = 0; i < NUM_ROTORS; i++) {
+        order[i] = (char)('1' + machine->rotor_order[2 - i]);
+    }
+    order[3] = '\0';
+
+    snprintf(out, size, "-o %s -g %c%c%c -p %c%c%c", order,
+             'A' + machine->ring_settings[2], 'A' + machine->ring_settings[1], 'A' + machine->ring_settings[0],
+             'A' + machine->positions[2], 'A' + machine->positions[1], 'A' + machine->positions[0]);
+}
+
+// Hash a run of letters (0-25). Up to six letters fit exactly in base 26,
+// longer prefixes are folded with FNV-1a; lookups re-check every candidate.
+unsigned int prefix_hash(const unsigned char* letters, int length) {
+    if (length <= 6) {
+        unsigned int value = 0;
+        for (int i = 0; i < length; i++) {
+            value = value * ALPHABET_SIZE + letters[i];
+        }
+        return value;
+    }
+
+    unsigned int hash = 2166136261U;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ letters[i]) * 16777619U;
+    }
+    return hash;
+}
+
+// Extract up to max_letters letters (as 0-25) from text, skipping everything else
+int letters_of(const char* text, unsigned char* letters, int max_letters) {
+    int count = 0;
+
+    for (; *text && count < max_letters; text++) {
+        int c = toupper((unsigned char)*text);
+        if (c >= 'A' && c <= 'Z') {
+            letters[count++] = (unsigned char)(c - 'A');
+        }
+    }
+    return count;
+}
+
+// Encrypt the crib from the machine's start position into out
+static void encrypt_prefix(const EnigmaState* start, const CompiledMachine* compiled,
+                           const unsigned char* crib, int length, unsigned char* out) {
+    EnigmaState machine = *start;
+
+    for (int i = 0; i < length; i++) {
+        step_rotors(&machine);
+        out[i] = (unsigned char)compiled_encipher(crib[i], machine.positions, compiled);
+    }
+}
+
+// Builder worker. The key space is cut into one unit per rotor order and left
+// rotor position (NUM_ROTOR_ORDERS * 26 units of 676 keys); every unit writes
+// its own slice of the entry array, so the workers share nothing.
+static void index_build_worker(void* context, int worker) {
+    IndexBuild* build = (IndexBuild*)context;
+    unsigned char prefix[CRIB_INDEX_MAX];
+    const unsigned int unit_keys = ALPHABET_SIZE * ALPHABET_SIZE;
+
+    for (unsigned int unit = (unsigned int)worker; unit < NUM_ROTOR_ORDERS * ALPHABET_SIZE;
+         unit += (unsigned int)build->workers) {
+        EnigmaState machine;
+        CompiledMachine compiled;
+
+        position_key(build->base, unit * unit_keys, &machine);
+        compile_machine(&machine, &compiled);
+
+        for (unsigned int key = unit * unit_keys; key < (unit + 1) * unit_keys; key++) {
+            position_key(build->base, key, &machine);
+            encrypt_prefix(&machine, &compiled, build->crib, build->crib_length, prefix);
+            build->entries[key].hash = prefix_hash(prefix, build->crib_length);
+            build->entries[key].key = key;
+        }
+    }
+}
+
+static int compare_index_entries(const void* a, const void* b) {
+    const CribIndexEntry* x = (const CribIndexEntry*)a;
+    const CribIndexEntry* y = (const CribIndexEntry*)b;
+
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return x->key < y->key ? -1 : (x->key > y->key);
+}
+
+// Build the index of crib encryptions under every rotor order and start
+// position. Rings and plugboard are fixed to those of base.
+void build_crib_index(const EnigmaState* base, const char* crib, int threads, CribIndex* index) {
+    unsigned char letters[CRIB_INDEX_MAX + 1];
+    int length = letters_of(crib, letters, CRIB_INDEX_MAX + 1);
+    IndexBuild build;
+
+    if (length == 0) {
+        fprintf(stderr, "Error: Crib must contain at least one letter\n");
+        exit(1);
+    }
+    if (length > CRIB_INDEX_MAX) {
+        fprintf(stderr, "Error: Crib is longer than %d letters; index its first %d letters instead\n",
+                CRIB_INDEX_MAX, CRIB_INDEX_MAX);
+        exit(1);
+    }
+
+    memset(index, 0, sizeof(CribIndex));
+    memcpy(index->header.magic, CRIB_INDEX_MAGIC, sizeof(CRIB_INDEX_MAGIC));
+    index->header.version = CRIB_INDEX_VERSION;
+    index->header.crib_length = (unsigned int)length;
+    index->header.entry_count = NUM_ROTOR_ORDERS * NUM_POSITIONS;
+    for (int i = 0; i < NUM_ROTORS; i++) {
+        index->header.rings[i] = base->ring_settings[i];
+    }
+    for (int i = 0; i < length; i++) {
+        index->header.crib[i] = (char)('A' + letters[i]);
+    }
+    memcpy(index->header.plugboard, base->plugboard, MAX_PLUGBOARD_LEN);
+    for (int i = 0; i < NUM_ROTOR_WIRINGS; i++) {
+        SAFE_STRCPY(index->header.wirings[i], ROTOR_WIRINGS[i], ALPHABET_SIZE + 1);
+    }
+    memcpy(index->header.notches, NOTCH_POSITIONS_INIT, sizeof(index->header.notches));
+
+    index->entries = (CribIndexEntry*)memory_alloc(MEM_MODELS, index->header.entry_count * sizeof(CribIndexEntry));
+    if (!index->entries) {
+        fprintf(stderr, "Error: Out of memory building crib index\n");
+        exit(1);
+    }
+
+    build.base = base;
+    build.crib = letters;
+    build.crib_length = length;
+    build.workers = threads > 0 ? threads : default_thread_count();
+    build.entries = index->entries;
+    run_workers(build.workers, index_build_worker, &build);
+
+    qsort(index->entries, index->header.entry_count, sizeof(CribIndexEntry), compare_index_entries);
+}
+
+int write_crib_index(const char* path, const CribIndex* index) {
+    FILE* out = fopen(path, "wb");
+    int ok;
+
+    if (!out) {
+        return -1;
+    }
+    ok = fwrite(&index->header, sizeof(CribIndexHeader), 1, out) == 1 &&
+         fwrite(index->entries, sizeof(CribIndexEntry), index->header.entry_count, out) == index->header.entry_count;
+    if (fclose(out) != 0) {
+        ok = 0;
+    }
+    return ok ? 0 : -1;
+}
+
+int load_crib_index(const char* path, CribIndex* index) {
+    FILE* in = fopen(path, "rb");
+
+    memset(index, 0, sizeof(CribIndex));
+    if (!in) {
+        return -1;
+    }
+
+    if (fread(&index->header, sizeof(CribIndexHeader), 1, in) != 1 ||
+        memcmp(index->header.magic, CRIB_INDEX_MAGIC, sizeof(CRIB_INDEX_MAGIC)) != 0 ||
+        index->header.version != CRIB_INDEX_VERSION ||
+        index->header.crib_length == 0 || index->header.crib_length > CRIB_INDEX_MAX ||
+        index->header.entry_count != NUM_ROTOR_ORDERS * NUM_POSITIONS) {
+        fclose(in);
+        return -1;
+    }
+    index->header.crib[CRIB_INDEX_MAX] = '\0';
+    index->header.plugboard[MAX_PLUGBOARD_LEN - 1] = '\0';
+    for (int i = 0; i < NUM_ROTOR_WIRINGS; i++) {
+        index->header.wirings[i][ALPHABET_SIZE] = '\0';
+    }
+
+    index->entries = (CribIndexEntry*)memory_alloc(MEM_MODELS, index->header.entry_count * sizeof(CribIndexEntry));
+    if (!index->entries ||
+        fread(index->entries, sizeof(CribIndexEntry), index->header.entry_count, in) != index->header.entry_count) {
+        fclose(in);
+        free_crib_index(index);
+        return -1;
+    }
+
+    fclose(in);
+    return 0;
+}
+
+// Find the keys under which the indexed crib encrypts to the start of
+// ciphertext. Candidates from the hash are confirmed by encrypting the crib
+// again, so the result holds no hash collisions. Returns the number of keys,
+// which can be more than max_keys; only the first max_keys are stored.
+size_t lookup_crib_index(const CribIndex* index, const EnigmaState* base, const char* ciphertext,
+                         unsigned int* keys, size_t max_keys) {
+    unsigned char cipher[CRIB_INDEX_MAX];
+    unsigned char crib[CRIB_INDEX_MAX];
+    unsigned char prefix[CRIB_INDEX_MAX];
+    int length = (int)index->header.crib_length;
+    size_t found = 0;
+
+    if (letters_of(ciphertext, cipher, length) < length) {
+        return 0;
+    }
+    letters_of(index->header.crib, crib, length);
+
+    // Binary search for the first entry with this hash
+    unsigned int hash = prefix_hash(cipher, length);
+    size_t low = 0;
+    size_t high = index->header.entry_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index->entries[mid].hash < hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    EnigmaState machine = *base;
+    for (int i = 0; i < NUM_ROTORS; i++) {
+        machine.ring_settings[i] = index->header.rings[i];
+    }
+    SAFE_STRCPY(machine.plugboard, index->header.plugboard, MAX_PLUGBOARD_LEN);
+    const EnigmaState indexed = machine;
+
+    for (size_t i = low; i < index->header.entry_count && index->entries[i].hash == hash; i++) {
+        CompiledMachine compiled;
+
+        position_key(&indexed, index->entries[i].key, &machine);
+        compile_machine(&machine, &compiled);
+        encrypt_prefix(&machine, &compiled, crib, length, prefix);
+        if (memcmp(prefix, cipher, (size_t)length) == 0) {
+            if (found < max_keys) {
+                keys[found] = index->entries[i].key;
+            }
+            found++;
+        }
+    }
+    return found;
+}
+
+void free_crib_index(CribIndex* index) {
+    memory_free(index->entries);
+    index->entries = NULL;
+}
+
+// --build-index FILE CRIB
+void run_build_index(const EnigmaState* state, const RunOptions* options) {
+    CribIndex index;
+
+    build_crib_index(state, options->text, options->threads, &index);
+    if (write_crib_index(options->path, &index) != 0) {
+        fprintf(stderr, "Error: Could not write crib index '%s'\n", options->path);
+        exit(1);
+    }
+    fprintf(stderr, "Indexed crib %s: %u keys, %u letters\n",
+            index.header.crib, index.header.entry_count, index.header.crib_length);
+    free_crib_index(&index);
+}
+
+// --lookup-index FILE CIPHERTEXT: one line of key options per candidate
+void run_lookup_index(const EnigmaState* state, const RunOptions* options) {
+    static unsigned int keys[MAX_CRIB_CANDIDATES];
+    CribIndex index;
+    char line[64];
+
+    if (load_crib_index(options->path, &index) != 0) {
+        fprintf(stderr, "Error: '%s' is not a readable crib index\n", options->path);
+        exit(1);
+    }
+
+    // The index only holds for the machine model it was built on
+    int same_model = memcmp(index.header.notches, NOTCH_POSITIONS_INIT, sizeof(index.header.notches)) == 0;
+    for (int i = 0; i < NUM_ROTOR_WIRINGS; i++) {
+        same_model = same_model && strcmp(index.header.wirings[i], ROTOR_WIRINGS[i]) == 0;
+    }
+    if (!same_model) {
+        fprintf(stderr, "Error: '%s' was built on a different machine model; use the same --machine\n",
+                options->path);
+        exit(1);
+    }
+
+    unsigned char cipher[CRIB_INDEX_MAX];
+    if (letters_of(options->text, cipher, CRIB_INDEX_MAX) < (int)index.header.crib_length) {
+        fprintf(stderr, "Error: The ciphertext must have at least %u letters to look up crib %s\n",
+                index.header.crib_length, index.header.crib);
+        exit(1);
+    }
+
+    EnigmaState indexed = *state;
+    for (int r = 0; r < NUM_ROTORS; r++) {
+        indexed.ring_settings[r] = index.header.rings[r];
+    }
+
+    size_t found = lookup_crib_index(&index, state, options->text, keys, MAX_CRIB_CANDIDATES);
+    size_t listed = found < MAX_CRIB_CANDIDATES ? found : MAX_CRIB_CANDIDATES;
+    for (size_t i = 0; i < listed; i++) {
+        EnigmaState machine;
+        position_key(&indexed, keys[i], &machine);
+        format_key_options(&machine, line, sizeof(line));
+        if (index.header.plugboard[0]) {
+            printf("%s -b \"%s\"\n", line, index.header.plugboard);
+        } else {
+            printf("%s\n", line);
+        }
+    }
+    fprintf(stderr, "%lu candidate key(s) for crib %s\n", (unsigned long)found, index.header.crib);
+    if (found > listed) {
+        fprintf(stderr, "Warning: Output truncated at %d keys; use a longer crib\n", MAX_CRIB_CANDIDATES);
+    }
+    free_crib_index(&index);
+}
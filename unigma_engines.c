@@ -0,0 +1,483 @@
+/*
+ * Program Name: Unigma
+ * Program Release Year: 2025
+ * Program Author: Steven S.
+ * Program Link: https://github.com/BitEU/Unigma
+ * Purpose: Experimental engines for Unigma - digram and turnover-segment tables and an engine benchmark
+ */
+
+#include "unigma.h"
+
+// Digram engine
+//
+// The single-letter table engines spend one table hop per letter. The digram
+// engine spends one per pair: for each rotor position it keeps a table from
+// a pair of plain letters (first * 26 + second) to the pair of cipher
+// letters, the first enciphered at that position and the second at the next.
+//
+// Tables for every position of a whole message would be 676 entries per
+// letter and are compiled once per key, so they can never pay for
+// themselves. Instead the machine is split into its right rotor and the
+// core (middle rotor, left rotor and reflector): the core changes only when
+// the middle rotor steps, and while it holds still the right rotor just
+// turns through its 26 positions. Tables are kept per core and right rotor
+// position, one set for a rotor order, rings and plugboard, and shared by
+// every start position - which is what searches and batches of records
+// under one order need. A pair that straddles a middle-rotor step falls back
+// to two single-letter lookups, using the first column of each table.
+//
+// A core's 26 tables are compiled the first time the core is reached, so a
+// run only pays for the cores its messages pass through. The whole set is
+// NUM_POSITIONS x 676 x 2 bytes (about 23 MB), against 463 KB for one
+// single-letter table per position.
+
+#define DIGRAM_SIZE (ALPHABET_SIZE * ALPHABET_SIZE)
+#define NUM_CORES (ALPHABET_SIZE * ALPHABET_SIZE)
+
+// Benchmark shape: every message length is run from BENCH_STARTS start
+// positions spread over all of them
+#define BENCH_STARTS 1024
+#define BENCH_LENGTHS 4
+
+static const size_t BENCH_LENGTH[BENCH_LENGTHS] = { 16, 64, 256, 1024 };
+
+typedef struct {
+    EnigmaState base;                          // Order, rings and plugboard of the tables
+    unsigned char (*pairs)[DIGRAM_SIZE][2];    // Per position: plain pair -> cipher pair
+    unsigned char built[NUM_CORES];            // Cores whose 26 tables are compiled
+} DigramEngine;
+
+// One fused single-letter table per rotor position, compiled by core the
+// same way; the table engine the digram engine is measured against
+typedef struct {
+    EnigmaState base;
+    unsigned char (*tables)[ALPHABET_SIZE + 1];
+    unsigned char built[NUM_CORES];
+} PositionEngine;
+
+// Rotor positions as a table index; index / ALPHABET_SIZE is the core
+static int position_index(const int positions[NUM_ROTORS]) {
+    return (positions[2] * ALPHABET_SIZE + positions[1]) * ALPHABET_SIZE + positions[0];
+}
+
+static void init_digram_engine(DigramEngine* engine, const EnigmaState* state) {
+    memset(engine, 0, sizeof(DigramEngine));
+    engine->base = *state;
+    engine->pairs = (unsigned char (*)[DIGRAM_SIZE][2])memory_alloc(MEM_TABLES,
+                                                                     (size_t)NUM_POSITIONS * sizeof(*engine->pairs));
+    if (!engine->pairs) {
+        fprintf(stderr, "Error: Out of memory compiling digram tables\n");
+        exit(1);
+    }
+}
+
+// Compile the 26 tables of one core
+static void build_digram_core(DigramEngine* engine, int core) {
+    EnigmaState machine = engine->base;
+    unsigned char first[ALPHABET_SIZE + 1];
+    unsigned char second[ALPHABET_SIZE + 1];
+
+    machine.positions[2] = core / ALPHABET_SIZE;
+    machine.positions[1] = core % ALPHABET_SIZE;
+    machine.positions[0] = 0;
+    build_substitution(&machine, first);
+
+    for (int right = 0; right < ALPHABET_SIZE; right++) {
+        unsigned char (*pairs)[2] = engine->pairs[core * ALPHABET_SIZE + right];
+
+        machine.positions[0] = (right + 1) % ALPHABET_SIZE;
+        build_substitution(&machine, second);
+        for (int a = 0; a < ALPHABET_SIZE; a++) {
+            for (int b = 0; b < ALPHABET_SIZE; b++) {
+                pairs[a * ALPHABET_SIZE + b][0] = first[a];
+                pairs[a * ALPHABET_SIZE + b][1] = second[b];
+            }
+        }
+        memcpy(first, second, sizeof(first));
+    }
+    engine->built[core] = 1;
+}
+
+static const unsigned char (*digram_tables(DigramEngine* engine, int index))[2] {
+    if (!engine->built[index / ALPHABET_SIZE]) {
+        build_digram_core(engine, index / ALPHABET_SIZE);
+    }
+    return (const unsigned char (*)[2])engine->pairs[index];
+}
+
+// Encipher length letters (0-25) from the positions in machine, which is
+// left at the last letter's positions like encrypt_block leaves it
+static void digram_encipher(DigramEngine* engine, EnigmaState* machine,
+                            const unsigned char* in, unsigned char* out, size_t length) {
+    size_t i = 0;
+
+    for (; i + 1 < length; i += 2) {
+        step_rotors(machine);
+        int first = position_index(machine->positions);
+        step_rotors(machine);
+        int second = position_index(machine->positions);
+        const unsigned char (*pairs)[2] = digram_tables(engine, first);
+
+        if (first / ALPHABET_SIZE == second / ALPHABET_SIZE) {
+            const unsigned char* pair = pairs[in[i] * ALPHABET_SIZE + in[i + 1]];
+            out[i] = pair[0];
+            out[i + 1] = pair[1];
+        } else {
+            // The middle rotor stepped between the two letters
+            out[i] = pairs[in[i] * ALPHABET_SIZE][0];
+            out[i + 1] = digram_tables(engine, second)[in[i + 1] * ALPHABET_SIZE][0];
+        }
+    }
+    if (i < length) {
+        step_rotors(machine);
+        out[i] = digram_tables(engine, position_index(machine->positions))[in[i] * ALPHABET_SIZE][0];
+    }
+}
+
+static void init_position_engine(PositionEngine* engine, const EnigmaState* state) {
+    memset(engine, 0, sizeof(PositionEngine));
+    engine->base = *state;
+    engine->tables = (unsigned char (*)[ALPHABET_SIZE + 1])memory_alloc(MEM_TABLES,
+                                                                       (size_t)NUM_POSITIONS * sizeof(*engine->tables));
+    if (!engine->tables) {
+        fprintf(stderr, "Error: Out of memory compiling position tables\n");
+        exit(1);
+    }
+}
+
+static void build_position_core(PositionEngine* engine, int core) {
+    EnigmaState machine = engine->base;
+
+    machine.positions[2] = core / ALPHABET_SIZE;
+    machine.positions[1] = core % ALPHABET_SIZE;
+    for (int right = 0; right < ALPHABET_SIZE; right++) {
+        machine.positions[0] = right;
+        build_substitution(&machine, engine->tables[core * ALPHABET_SIZE + right]);
+    }
+    engine->built[core] = 1;
+}
+
+static void position_encipher(PositionEngine* engine, EnigmaState* machine,
+                              const unsigned char* in, unsigned char* out, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        step_rotors(machine);
+        int index = position_index(machine->positions);
+        if (!engine->built[index / ALPHABET_SIZE]) {
+            build_position_core(engine, index / ALPHABET_SIZE);
+        }
+        out[i] = engine->tables[index][in[i]];
+    }
+}
+
+// Turnover-segmented engine
+//
+// Between two middle-rotor turnovers only the right rotor moves, so the
+// core - middle rotor, left rotor, reflector and back - is one fixed
+// permutation for up to 26 letters. The engine keeps two 26 x 26 tables
+// indexed by right-rotor offset and letter, compiled once per key: entry
+// (plugboard, then the right rotor) and exit (the right rotor backwards,
+// then the plugboard). On entering a segment it compiles the 26-entry core,
+// and every letter of the segment is then three lookups:
+//   exit[offset][core[entry[offset][letter]]]
+// How many letters a segment holds follows from the notch distances: the
+// core changes at the step after the right rotor reaches its notch, or
+// right away when the middle rotor sits on its own (the double step).
+// Everything fits in about 1.4 KB, against 463 KB for a table per position.
+
+typedef struct {
+    CompiledMachine compiled;
+    unsigned char entry[ALPHABET_SIZE][ALPHABET_SIZE];  // [right offset][letter] -> core input
+    unsigned char exit[ALPHABET_SIZE][ALPHABET_SIZE];   // [right offset][core output] -> letter
+    unsigned char core[ALPHABET_SIZE];                  // Core of the current segment
+} SegmentEngine;
+
+static void init_segment_engine(SegmentEngine* engine, const EnigmaState* state) {
+    const CompiledMachine* compiled = &engine->compiled;
+
+    compile_machine(state, &engine->compiled);
+    for (int offset = 0; offset < ALPHABET_SIZE; offset++) {
+        for (int c = 0; c < ALPHABET_SIZE; c++) {
+            int in = compiled->forward[0][(compiled->plug[c] + offset) % ALPHABET_SIZE];
+            int out = compiled->reverse[0][(c + offset) % ALPHABET_SIZE];
+
+            engine->entry[offset][c] = (unsigned char)((in + ALPHABET_SIZE - offset) % ALPHABET_SIZE);
+            engine->exit[offset][c] = compiled->plug[(out + ALPHABET_SIZE - offset) % ALPHABET_SIZE];
+        }
+    }
+}
+
+// Compile the core for the middle and left rotor positions in machine.
+// The core is reciprocal, so each pass through it fills two entries.
+static void build_segment_core(SegmentEngine* engine, const EnigmaState* machine) {
+    const CompiledMachine* compiled = &engine->compiled;
+    int middle = mod_positive(machine->positions[1] - compiled->rings[1]);
+    int left = mod_positive(machine->positions[2] - compiled->rings[2]);
+
+    memset(engine->core, PASS_THROUGH, sizeof(engine->core));
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        if (engine->core[c] != PASS_THROUGH) {
+            continue;
+        }
+        int x = (compiled->forward[1][(c + middle) % ALPHABET_SIZE] + ALPHABET_SIZE - middle) % ALPHABET_SIZE;
+        x = (compiled->forward[2][(x + left) % ALPHABET_SIZE] + ALPHABET_SIZE - left) % ALPHABET_SIZE;
+        x = compiled->reflector[x];
+        x = (compiled->reverse[2][(x + left) % ALPHABET_SIZE] + ALPHABET_SIZE - left) % ALPHABET_SIZE;
+        x = (compiled->reverse[1][(x + middle) % ALPHABET_SIZE] + ALPHABET_SIZE - middle) % ALPHABET_SIZE;
+        engine->core[c] = (unsigned char)x;
+        engine->core[x] = (unsigned char)c;
+    }
+}
+
+// Encipher length letters (0-25) from the positions in machine, which is
+// left at the last letter's positions like encrypt_block leaves it
+static void segment_encipher(SegmentEngine* engine, EnigmaState* machine,
+                             const unsigned char* in, unsigned char* out, size_t length) {
+    size_t i = 0;
+
+    while (i < length) {
+        // First letter of a segment: a full step, which may move the core
+        step_rotors(machine);
+        build_segment_core(engine, machine);
+
+        int right = machine->positions[0];
+        size_t run = 1;
+        if (machine->positions[1] != machine->notch_positions[1]) {
+            run += (size_t)mod_positive(machine->notch_positions[0] - right);
+        }
+        if (run > length - i) {
+            run = length - i;
+        }
+
+        int offset = mod_positive(right - engine->compiled.rings[0]);
+        for (size_t k = 0; k < run; k++, i++) {
+            out[i] = engine->exit[offset][engine->core[engine->entry[offset][in[i]]]];
+            offset = offset + 1 == ALPHABET_SIZE ? 0 : offset + 1;
+        }
+        // The rest of the segment only turned the right rotor
+        machine->positions[0] = (right + (int)run - 1) % ALPHABET_SIZE;
+    }
+}
+
+// Engine benchmark
+//
+// Every engine enciphers the same pseudo-random text from the same start
+// positions, under the order, rings and plugboard on the command line:
+//   direct    encipher_letter, the rotor-by-rotor reference path
+//   compiled  compiled_encipher, the independent cross-check path
+//   fused     FusedTables compiled per message, as the stream and record
+//             modes use them
+//   segment   the turnover-segmented engine, compiled once per key
+//   position  shared single-letter tables, one per rotor position
+//   digram    shared digram tables, one per rotor position
+// The shared position and digram tables are built (and timed) once up
+// front, so their per-letter figures are for warm tables; the fused figures
+// include compiling the tables of each message, as the record modes pay it.
+// The break-even column says after how many enciphered letters the digram
+// tables have paid back their extra build time against the position tables
+// at that message length.
+
+enum { BENCH_DIRECT = 0, BENCH_COMPILED, BENCH_FUSED, BENCH_SEGMENT, BENCH_POSITION, BENCH_DIGRAM, BENCH_ENGINES };
+
+static const char* const BENCH_NAMES[BENCH_ENGINES] = { "direct", "compiled", "fused", "segment", "position", "digram" };
+
+static unsigned long mix_output(unsigned long checksum, const unsigned char* out, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        checksum = checksum * 31 + out[i];
+    }
+    return checksum;
+}
+
+static void set_start(EnigmaState* machine, int start) {
+    machine->positions[0] = start % ALPHABET_SIZE;
+    machine->positions[1] = (start / ALPHABET_SIZE) % ALPHABET_SIZE;
+    machine->positions[2] = start / (ALPHABET_SIZE * ALPHABET_SIZE);
+}
+
+// Encipher text from every benchmark start with one engine; returns the
+// checksum of all output and stores the elapsed time
+static unsigned long bench_engine(int engine, const EnigmaState* state, const CompiledMachine* compiled,
+                                  FusedTables* fused, SegmentEngine* segment,
+                                  PositionEngine* position, DigramEngine* digram,
+                                  const unsigned char* text, unsigned char* out, size_t length,
+                                  unsigned long long* elapsed) {
+    unsigned long checksum = 0;
+    unsigned long long started = clock_microseconds();
+
+    for (int s = 0; s < BENCH_STARTS; s++) {
+        EnigmaState machine = *state;
+        set_start(&machine, (int)((long)s * NUM_POSITIONS / BENCH_STARTS));
+
+        switch (engine) {
+        case BENCH_DIRECT:
+            for (size_t i = 0; i < length; i++) {
+                step_rotors(&machine);
+                out[i] = (unsigned char)encipher_letter(text[i], &machine);
+            }
+            break;
+        case BENCH_COMPILED:
+            for (size_t i = 0; i < length; i++) {
+                step_rotors(&machine);
+                out[i] = (unsigned char)compiled_encipher(text[i], machine.positions, compiled);
+            }
+            break;
+        case BENCH_FUSED:
+            reset_fused_tables(fused, &machine);
+            compile_fused_tables(fused, length);
+            for (size_t i = 0; i < length; i++) {
+                out[i] = fused->fused[i * (ALPHABET_SIZE + 1) + text[i]];
+            }
+            break;
+        case BENCH_SEGMENT:
+            segment_encipher(segment, &machine, text, out, length);
+            break;
+        case BENCH_POSITION:
+            position_encipher(position, &machine, text, out, length);
+            break;
+        default:
+            digram_encipher(digram, &machine, text, out, length);
+            break;
+        }
+        checksum = mix_output(checksum, out, length);
+    }
+    *elapsed = clock_microseconds() - started;
+    return checksum;
+}
+
+// Random cable changes made with swap_fused_cable must leave the same fused
+// tables as re-conjugating every table for the resulting plugboard
+#define CABLE_SWAPS 2000
+
+static void check_cable_swaps(const EnigmaState* state) {
+    size_t length = BENCH_LENGTH[BENCH_LENGTHS - 1];
+    FusedTables swapped;
+    FusedTables rebuilt;
+    int plug[ALPHABET_SIZE];
+    char plugboard[MAX_PLUGBOARD_LEN];
+    unsigned long seed = 54321;
+
+    init_fused_tables(&swapped, state);
+    init_fused_tables(&rebuilt, state);
+    compile_fused_tables(&swapped, length);
+    compile_fused_tables(&rebuilt, length);
+    build_plug_map(state->plugboard, plug);
+
+    for (int s = 0; s < CABLE_SWAPS; s++) {
+        seed = seed * 1103515245UL + 12345UL;
+        int a = (int)((seed >> 16) % ALPHABET_SIZE);
+        seed = seed * 1103515245UL + 12345UL;
+        int b = (int)((seed >> 16) % ALPHABET_SIZE);
+
+        swap_fused_cable(&swapped, a, b);
+        plug[plug[a]] = plug[a];
+        plug[plug[b]] = plug[b];
+        plug[a] = b;
+        plug[b] = a;
+        format_plugboard(plug, plugboard, sizeof(plugboard));
+        rekey_fused_plugboard(&rebuilt, plugboard);
+
+        if (memcmp(swapped.plug, plug, sizeof(plug)) != 0 ||
+            memcmp(swapped.fused, rebuilt.fused, length * (ALPHABET_SIZE + 1)) != 0) {
+            fprintf(stderr, "Error: Fused tables after cable swap %d (%c-%c) differ from a full rebuild\n",
+                    s + 1, 'A' + a, 'A' + b);
+            exit(1);
+        }
+    }
+    free_fused_tables(&swapped);
+    free_fused_tables(&rebuilt);
+}
+
+void run_engine_benchmark(const EnigmaState* state) {
+    size_t longest = BENCH_LENGTH[BENCH_LENGTHS - 1];
+    unsigned char* text = (unsigned char*)memory_alloc(MEM_IO, longest);
+    unsigned char* out = (unsigned char*)memory_alloc(MEM_IO, longest);
+    CompiledMachine compiled;
+    FusedTables fused;
+    SegmentEngine segment;
+    PositionEngine position;
+    DigramEngine digram;
+    unsigned long long position_build;
+    unsigned long long digram_build;
+    unsigned long long started;
+    char order[16];
+
+    if (!text || !out) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+
+    // Fixed pseudo-random text, so runs compare
+    unsigned long seed = 12345;
+    for (size_t i = 0; i < longest; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        text[i] = (unsigned char)((seed >> 16) % ALPHABET_SIZE);
+    }
+
+    compile_machine(state, &compiled);
+    init_fused_tables(&fused, state);
+    init_segment_engine(&segment, state);
+    init_position_engine(&position, state);
+    init_digram_engine(&digram, state);
+
+    started = clock_microseconds();
+    for (int core = 0; core < NUM_CORES; core++) {
+        build_position_core(&position, core);
+    }
+    position_build = clock_microseconds() - started;
+
+    started = clock_microseconds();
+    for (int core = 0; core < NUM_CORES; core++) {
+        build_digram_core(&digram, core);
+    }
+    digram_build = clock_microseconds() - started;
+
+    format_rotor_order(state->rotor_order, order, sizeof(order));
+    printf("Engine benchmark: rotors %s, %d starts per message length\n", order, BENCH_STARTS);
+    printf("Tables: position %lu KB built in %.1f ms, digram %lu KB built in %.1f ms\n",
+           (unsigned long)(NUM_POSITIONS * sizeof(*position.tables) / 1024), position_build / 1000.0,
+           (unsigned long)(NUM_POSITIONS * sizeof(*digram.pairs) / 1024), digram_build / 1000.0);
+    printf("Nanoseconds per letter; break-even is the letters digram needs to repay its build\n");
+    printf("%7s", "Letters");
+    for (int e = 0; e < BENCH_ENGINES; e++) {
+        printf(" %9s", BENCH_NAMES[e]);
+    }
+    printf(" %11s\n", "break-even");
+
+    for (int l = 0; l < BENCH_LENGTHS; l++) {
+        size_t length = BENCH_LENGTH[l];
+        double letters = (double)length * BENCH_STARTS;
+        double per_letter[BENCH_ENGINES];
+        unsigned long reference = 0;
+
+        for (int e = 0; e < BENCH_ENGINES; e++) {
+            unsigned long long elapsed;
+            unsigned long checksum = bench_engine(e, state, &compiled, &fused, &segment, &position, &digram,
+                                                  text, out, length, &elapsed);
+            if (e == 0) {
+                reference = checksum;
+            } else if (checksum != reference) {
+                fprintf(stderr, "Error: %s engine output differs from the direct engine\n", BENCH_NAMES[e]);
+                exit(1);
+            }
+            per_letter[e] = elapsed * 1000.0 / letters;
+        }
+
+        printf("%7lu", (unsigned long)length);
+        for (int e = 0; e < BENCH_ENGINES; e++) {
+            printf(" %9.1f", per_letter[e]);
+        }
+        double saved = per_letter[BENCH_POSITION] - per_letter[BENCH_DIGRAM];
+        if (saved > 0) {
+            printf(" %11.0f\n", (digram_build - (double)position_build) * 1000.0 / saved);
+        } else {
+            printf(" %11s\n", "never");
+        }
+    }
+    check_cable_swaps(state);
+    printf("All engines agree; %d incremental cable swaps match full rebuilds\n", CABLE_SWAPS);
+
+    memory_free(digram.pairs);
+    memory_free(position.tables);
+    free_fused_tables(&fused);
+    memory_free(text);
+    memory_free(out);
+}
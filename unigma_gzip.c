@@ -0,0 +1,1185 @@
+/*
+ * Program Name: Unigma
+ * Program Release Year: 2025
+ * Program Author: Steven S.
+ * Program Link: https://github.com/BitEU/Unigma
+ * Purpose: Compressed I/O for Unigma - gzip reading and writing on their own threads around the stream encryptor
+ */
+
+#include "unigma.h"
+
+// File stream mode
+//
+// With -i/-O, --gzip or compressed input, stream mode runs as three stages
+// connected by bounded queues over a small ring of blocks:
+//
+//   reader (inflate) -> encryptor -> writer (deflate)
+//
+// so decompression, encryption and compression overlap instead of taking
+// turns. gzip input is recognised by its magic number (members may be
+// concatenated, as gzip itself allows); zstd input is recognised and refused,
+// since this build carries no zstd decoder. Output is gzip with --gzip or an
+// -O name ending in ".gz". The deflater is a greedy LZ77 matcher over the
+// 32 KB window, with Huffman codes built for each block of tokens: not
+// gzip -9, but close to it on text, at a fraction of the cost.
+
+#define GZIP_WINDOW 32768
+#define GZIP_MIN_MATCH 3
+#define GZIP_MAX_MATCH 258
+#define GZIP_HASH_BITS 15
+#define GZIP_MAX_CHAIN 32             // Hash chain links followed per match search
+#define GZIP_BLOCK_TOKENS 16384       // Literals and matches per Huffman block
+#define GZIP_FAST_BITS 10             // Huffman codes up to this long decode in one lookup
+#define STREAM_RING 8                 // Blocks in flight between the file stream stages
+#define STREAM_RING_BLOCK 65536
+
+static const unsigned char GZIP_MAGIC[2] = { 0x1F, 0x8B };
+static const unsigned char ZSTD_MAGIC[4] = { 0x28, 0xB5, 0x2F, 0xFD };
+
+// Lengths 257..285 and distances 0..29: base value and extra bits
+static const unsigned short LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short DISTANCE_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char DISTANCE_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+// Order the code length code lengths are sent in
+static const unsigned char CODE_LENGTH_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static unsigned long crc_table[256];
+static int crc_table_ready = 0;
+
+// Canonical Huffman code: counts per length and symbols in code order for
+// the bit-by-bit decoder, plus a lookup on the next GZIP_FAST_BITS bits
+typedef struct {
+    unsigned short count[16];
+    unsigned short symbol[288];
+    unsigned short fast[1 << GZIP_FAST_BITS];  // symbol << 4 | length, or 0
+} HuffmanCode;
+
+typedef enum {
+    INFLATE_HEADER,
+    INFLATE_BLOCK,
+    INFLATE_STORED,
+    INFLATE_CODES,
+    INFLATE_TRAILER,
+    INFLATE_DONE
+} InflateState;
+
+typedef struct {
+    FILE* in;
+    unsigned char buffer[STREAM_RING_BLOCK];
+    size_t length;
+    size_t at;
+    unsigned long bits;
+    int count;
+    InflateState state;
+    int last_block;
+    size_t stored_left;
+    int copy_length;
+    int copy_distance;
+    HuffmanCode literals;
+    HuffmanCode distances;
+    unsigned char window[GZIP_WINDOW];
+    size_t window_at;                   // Total bytes produced, mod the window size
+    unsigned long crc;
+    unsigned long size;
+    unsigned long members;
+} Inflater;
+
+typedef struct {
+    FILE* out;
+    unsigned char window[2 * GZIP_WINDOW];
+    size_t length;                      // Bytes in window
+    size_t done;                        // Bytes of window already encoded
+    int head[1 << GZIP_HASH_BITS];      // Latest window position of each hash, -1 if none
+    int prev[2 * GZIP_WINDOW];          // Previous position with the same hash
+    unsigned short token_length[GZIP_BLOCK_TOKENS];  // 0 for a literal
+    unsigned short token_value[GZIP_BLOCK_TOKENS];   // Literal byte or match distance
+    size_t tokens;
+    unsigned long bits;
+    int count;
+    unsigned char buffer[STREAM_RING_BLOCK];
+    size_t used;
+    unsigned long crc;
+    unsigned long size;
+    unsigned long long written;
+} Deflater;
+
+typedef struct {
+    char* data;
+    size_t length;
+} StreamBlock;
+
+// The three stages of file stream mode
+typedef struct {
+    EnigmaState* state;
+    int threads;                        // Threads per block (1 = encrypt serially)
+    FILE* in;
+    FILE* out;
+    int compressed_input;
+    int compress_output;
+    unsigned char prefix[4];            // Bytes read while sniffing the input format
+    size_t prefix_length;
+    Inflater* inflater;
+    Deflater* deflater;
+    StreamBlock blocks[STREAM_RING];
+    BoundedQueue idle;                  // Blocks free for the reader
+    BoundedQueue plain;                 // Read, waiting to be encrypted
+    BoundedQueue cipher;                // Encrypted, waiting to be written
+    unsigned long long bytes_in;        // Bytes read, after decompression
+    unsigned long long bytes_out;       // Bytes written, after compression
+} FileStream;
+
+// CRC-32 as used by gzip
+
+static void crc_init(void) {
+    if (crc_table_ready) {
+        return;
+    }
+    for (unsigned long n = 0; n < 256; n++) {
+        unsigned long c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+    crc_table_ready = 1;
+}
+
+static unsigned long crc_update(unsigned long crc, const unsigned char* data, size_t length) {
+    crc ^= 0xFFFFFFFFUL;
+    for (size_t i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFUL;
+}
+
+// Inflate
+
+static void corrupt_input(const char* what) {
+    fprintf(stderr, "Error: Corrupt gzip input (%s)\n", what);
+    exit(1);
+}
+
+// Next input byte, or -1 at end of input
+static int inflate_byte(Inflater* inflater) {
+    if (inflater->at == inflater->length) {
+        inflater->length = fread(inflater->buffer, 1, sizeof(inflater->buffer), inflater->in);
+        inflater->at = 0;
+        if (inflater->length == 0) {
+            return -1;
+        }
+    }
+    return inflater->buffer[inflater->at++];
+}
+
+static unsigned long inflate_bits(Inflater* inflater, int need) {
+    while (inflater->count < need) {
+        int byte = inflate_byte(inflater);
+        if (byte < 0) {
+            corrupt_input("unexpected end");
+        }
+        inflater->bits |= (unsigned long)byte << inflater->count;
+        inflater->count += 8;
+    }
+
+    unsigned long value = inflater->bits & ((1UL << need) - 1);
+    inflater->bits >>= need;
+    inflater->count -= need;
+    return value;
+}
+
+// Byte-aligned reads (headers, stored blocks, trailers) drop the partial byte
+static void inflate_align(Inflater* inflater) {
+    inflater->bits >>= inflater->count % 8;
+    inflater->count -= inflater->count % 8;
+}
+
+static int inflate_aligned_byte(Inflater* inflater) {
+    if (inflater->count >= 8) {
+        int byte = (int)(inflater->bits & 0xFF);
+        inflater->bits >>= 8;
+        inflater->count -= 8;
+        return byte;
+    }
+    return inflate_byte(inflater);
+}
+
+static unsigned long inflate_word(Inflater* inflater, int bytes) {
+    unsigned long value = 0;
+
+    for (int i = 0; i < bytes; i++) {
+        int byte = inflate_aligned_byte(inflater);
+        if (byte < 0) {
+            corrupt_input("unexpected end");
+        }
+        value |= (unsigned long)byte << (8 * i);
+    }
+    return value;
+}
+
+static void build_huffman(HuffmanCode* code, const unsigned char* lengths, int symbols) {
+    unsigned short offsets[16];
+    int left = 1;
+
+    memset(code->count, 0, sizeof(code->count));
+    memset(code->fast, 0, sizeof(code->fast));
+    for (int s = 0; s < symbols; s++) {
+        code->count[lengths[s]]++;
+    }
+    for (int length = 1; length < 16; length++) {
+        left = left * 2 - code->count[length];
+        if (left < 0) {
+            corrupt_input("over-subscribed code");
+        }
+    }
+
+    offsets[1] = 0;
+    for (int length = 1; length < 15; length++) {
+        offsets[length + 1] = (unsigned short)(offsets[length] + code->count[length]);
+    }
+    for (int s = 0; s < symbols; s++) {
+        if (lengths[s]) {
+            code->symbol[offsets[lengths[s]]++] = (unsigned short)s;
+        }
+    }
+
+    // Lookup table: canonical codes, bit-reversed because deflate sends
+    // codes from their top bit but packs bits from the bottom of each byte
+    unsigned int next = 0;
+    int index = 0;
+    for (int length = 1; length <= GZIP_FAST_BITS; length++) {
+        for (int i = 0; i < code->count[length]; i++) {
+            unsigned int reversed = 0;
+            for (int b = 0; b < length; b++) {
+                reversed |= ((next >> b) & 1) << (length - 1 - b);
+            }
+            for (unsigned int fill = reversed; fill < (1u << GZIP_FAST_BITS); fill += 1u << length) {
+                code->fast[fill] = (unsigned short)(code->symbol[index] << 4 | length);
+            }
+            next++;
+            index++;
+        }
+        next <<= 1;
+    }
+}
+
+static int inflate_symbol(Inflater* inflater, const HuffmanCode* code) {
+    // Top up the bit buffer; running out here is only an error if the code
+    // turns out to need the missing bits
+    while (inflater->count < GZIP_FAST_BITS) {
+        int byte = inflate_byte(inflater);
+        if (byte < 0) {
+            break;
+        }
+        inflater->bits |= (unsigned long)byte << inflater->count;
+        inflater->count += 8;
+    }
+
+    unsigned short entry = code->fast[inflater->bits & ((1u << GZIP_FAST_BITS) - 1)];
+    if (entry && (entry & 15) <= inflater->count) {
+        inflater->bits >>= entry & 15;
+        inflater->count -= entry & 15;
+        return entry >> 4;
+    }
+
+    // Longer codes: walk the canonical code one bit at a time
+    int value = 0;
+    int first = 0;
+    int index = 0;
+    for (int length = 1; length < 16; length++) {
+        value |= (int)inflate_bits(inflater, 1);
+        int count = code->count[length];
+        if (value - count < first) {
+            return code->symbol[index + (value - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        value <<= 1;
+    }
+    corrupt_input("bad code");
+    return -1;
+}
+
+static void inflate_fixed_codes(Inflater* inflater) {
+    unsigned char lengths[288];
+    int s = 0;
+
+    for (; s < 144; s++) {
+        lengths[s] = 8;
+    }
+    for (; s < 256; s++) {
+        lengths[s] = 9;
+    }
+    for (; s < 280; s++) {
+        lengths[s] = 7;
+    }
+    for (; s < 288; s++) {
+        lengths[s] = 8;
+    }
+    build_huffman(&inflater->literals, lengths, 288);
+    for (s = 0; s < 30; s++) {
+        lengths[s] = 5;
+    }
+    build_huffman(&inflater->distances, lengths, 30);
+}
+
+static void inflate_dynamic_codes(Inflater* inflater) {
+    unsigned char lengths[320];
+    unsigned char code_lengths[19];
+    HuffmanCode lengths_code;
+    int literal_count = (int)inflate_bits(inflater, 5) + 257;
+    int distance_count = (int)inflate_bits(inflater, 5) + 1;
+    int code_count = (int)inflate_bits(inflater, 4) + 4;
+
+    if (literal_count > 286 || distance_count > 30) {
+        corrupt_input("bad code counts");
+    }
+    memset(code_lengths, 0, sizeof(code_lengths));
+    for (int i = 0; i < code_count; i++) {
+        code_lengths[CODE_LENGTH_ORDER[i]] = (unsigned char)inflate_bits(inflater, 3);
+    }
+    build_huffman(&lengths_code, code_lengths, 19);
+
+    int total = literal_count + distance_count;
+    for (int i = 0; i < total;) {
+        int symbol = inflate_symbol(inflater, &lengths_code);
+        int repeat;
+        unsigned char value = 0;
+
+        if (symbol < 16) {
+            lengths[i++] = (unsigned char)symbol;
+            continue;
+        }
+        if (symbol == 16) {
+            if (i == 0) {
+                corrupt_input("repeat with no length");
+            }
+            value = lengths[i - 1];
+            repeat = 3 + (int)inflate_bits(inflater, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + (int)inflate_bits(inflater, 3);
+        } else {
+            repeat = 11 + (int)inflate_bits(inflater, 7);
+        }
+        if (i + repeat > total) {
+            corrupt_input("too many lengths");
+        }
+        while (repeat--) {
+            lengths[i++] = value;
+        }
+    }
+    if (lengths[256] == 0) {
+        corrupt_input("no end-of-block code");
+    }
+    build_huffman(&inflater->literals, lengths, literal_count);
+    build_huffman(&inflater->distances, lengths + literal_count, distance_count);
+}
+
+// Start of a gzip member. Returns 0, or -1 at a clean end of input.
+static int inflate_header(Inflater* inflater) {
+    int first = inflate_aligned_byte(inflater);
+
+    if (first < 0) {
+        return -1;
+    }
+    if (first != GZIP_MAGIC[0] || inflate_aligned_byte(inflater) != GZIP_MAGIC[1]) {
+        if (inflater->members > 0) {
+            return -1;  // Trailing garbage after a member, as gzip -d tolerates
+        }
+        corrupt_input("not gzip");
+    }
+    if (inflate_aligned_byte(inflater) != 8) {
+        corrupt_input("unknown compression method");
+    }
+
+    int flags = inflate_aligned_byte(inflater);
+    inflate_word(inflater, 4);  // Modification time
+    inflate_word(inflater, 2);  // Extra flags, OS
+    if (flags & 4) {
+        unsigned long extra = inflate_word(inflater, 2);
+        while (extra--) {
+            inflate_word(inflater, 1);
+        }
+    }
+    for (int field = 8; field <= 16; field <<= 1) {
+        if (flags & field) {
+            int byte;
+            do {
+                byte = inflate_aligned_byte(inflater);
+            } while (byte > 0);
+            if (byte < 0) {
+                corrupt_input("unexpected end");
+            }
+        }
+    }
+    if (flags & 2) {
+        inflate_word(inflater, 2);
+    }
+
+    inflater->crc = 0;
+    inflater->size = 0;
+    inflater->members++;
+    return 0;
+}
+
+static void inflate_init(Inflater* inflater, FILE* in, const unsigned char* prefix, size_t prefix_length) {
+    memset(inflater, 0, sizeof(Inflater));
+    inflater->in = in;
+    memcpy(inflater->buffer, prefix, prefix_length);
+    inflater->length = prefix_length;
+    inflater->state = INFLATE_HEADER;
+}
+
+// Decompress up to size bytes into out. Returns 0 at the end of the input.
+static size_t inflate_read(Inflater* inflater, unsigned char* out, size_t size) {
+    size_t produced = 0;
+    size_t checked = 0;     // Output already added to the member's checksum
+
+    while (produced < size && inflater->state != INFLATE_DONE) {
+        switch (inflater->state) {
+            case INFLATE_HEADER:
+                inflater->state = inflate_header(inflater) == 0 ? INFLATE_BLOCK : INFLATE_DONE;
+                break;
+
+            case INFLATE_BLOCK: {
+                inflater->last_block = (int)inflate_bits(inflater, 1);
+                int type = (int)inflate_bits(inflater, 2);
+                if (type == 0) {
+                    inflate_align(inflater);
+                    unsigned long length = inflate_word(inflater, 2);
+                    if ((inflate_word(inflater, 2) ^ 0xFFFF) != length) {
+                        corrupt_input("bad stored block length");
+                    }
+                    inflater->stored_left = length;
+                    inflater->state = INFLATE_STORED;
+                } else if (type == 1) {
+                    inflate_fixed_codes(inflater);
+                    inflater->state = INFLATE_CODES;
+                } else if (type == 2) {
+                    inflate_dynamic_codes(inflater);
+                    inflater->state = INFLATE_CODES;
+                } else {
+                    corrupt_input("bad block type");
+                }
+                break;
+            }
+
+            case INFLATE_STORED:
+                while (inflater->stored_left > 0 && produced < size) {
+                    int byte = inflate_aligned_byte(inflater);
+                    if (byte < 0) {
+                        corrupt_input("unexpected end");
+                    }
+                    out[produced++] = (unsigned char)byte;
+                    inflater->window[inflater->window_at++ % GZIP_WINDOW] = (unsigned char)byte;
+                    inflater->stored_left--;
+                }
+                if (inflater->stored_left == 0) {
+                    inflater->state = inflater->last_block ? INFLATE_TRAILER : INFLATE_BLOCK;
+                }
+                break;
+
+            case INFLATE_CODES:
+                while (produced < size) {
+                    if (inflater->copy_length > 0) {
+                        unsigned char byte = inflater->window[(inflater->window_at - (size_t)inflater->copy_distance) % GZIP_WINDOW];
+                        out[produced++] = byte;
+                        inflater->window[inflater->window_at++ % GZIP_WINDOW] = byte;
+                        inflater->copy_length--;
+                        continue;
+                    }
+
+                    int symbol = inflate_symbol(inflater, &inflater->literals);
+                    if (symbol < 256) {
+                        out[produced++] = (unsigned char)symbol;
+                        inflater->window[inflater->window_at++ % GZIP_WINDOW] = (unsigned char)symbol;
+                    } else if (symbol == 256) {
+                        inflater->state = inflater->last_block ? INFLATE_TRAILER : INFLATE_BLOCK;
+                        break;
+                    } else {
+                        symbol -= 257;
+                        if (symbol >= 29) {
+                            corrupt_input("bad length code");
+                        }
+                        inflater->copy_length = LENGTH_BASE[symbol] + (int)inflate_bits(inflater, LENGTH_EXTRA[symbol]);
+                        int code = inflate_symbol(inflater, &inflater->distances);
+                        if (code >= 30) {
+                            corrupt_input("bad distance code");
+                        }
+                        inflater->copy_distance = DISTANCE_BASE[code] + (int)inflate_bits(inflater, DISTANCE_EXTRA[code]);
+                        if ((size_t)inflater->copy_distance > inflater->window_at) {
+                            corrupt_input("distance too far back");
+                        }
+                    }
+                }
+                break;
+
+            case INFLATE_TRAILER:
+                inflater->crc = crc_update(inflater->crc, out + checked, produced - checked);
+                inflater->size += (unsigned long)(produced - checked);
+                checked = produced;
+
+                inflate_align(inflater);
+                if (inflate_word(inflater, 4) != (inflater->crc & 0xFFFFFFFFUL) ||
+                    inflate_word(inflater, 4) != (inflater->size & 0xFFFFFFFFUL)) {
+                    corrupt_input("checksum mismatch");
+                }
+                inflater->window_at = 0;
+                inflater->state = INFLATE_HEADER;
+                break;
+
+            case INFLATE_DONE:
+                break;
+        }
+    }
+
+    inflater->crc = crc_update(inflater->crc, out + checked, produced - checked);
+    inflater->size += (unsigned long)(produced - checked);
+    return produced;
+}
+
+// Deflate
+
+static void deflate_flush(Deflater* deflater) {
+    if (deflater->used > 0 && fwrite(deflater->buffer, 1, deflater->used, deflater->out) != deflater->used) {
+        fprintf(stderr, "Error: Could not write compressed output\n");
+        exit(1);
+    }
+    deflater->written += deflater->used;
+    deflater->used = 0;
+}
+
+static void deflate_byte(Deflater* deflater, unsigned char byte) {
+    if (deflater->used == sizeof(deflater->buffer)) {
+        deflate_flush(deflater);
+    }
+    deflater->buffer[deflater->used++] = byte;
+}
+
+static void deflate_bits(Deflater* deflater, unsigned long value, int count) {
+    deflater->bits |= value << deflater->count;
+    deflater->count += count;
+    while (deflater->count >= 8) {
+        deflate_byte(deflater, (unsigned char)(deflater->bits & 0xFF));
+        deflater->bits >>= 8;
+        deflater->count -= 8;
+    }
+}
+
+// Huffman codes go out top bit first, so keep them bit-reversed
+static unsigned short reverse_code(unsigned int code, int length) {
+    unsigned int reversed = 0;
+
+    for (int b = 0; b < length; b++) {
+        reversed |= ((code >> b) & 1) << (length - 1 - b);
+    }
+    return (unsigned short)reversed;
+}
+
+// Code lengths of at most limit bits for the given symbol frequencies; unused
+// symbols get length 0. A tree that comes out too deep is rebuilt from
+// flattened frequencies until it fits.
+static void huffman_lengths(const unsigned long* freq, int symbols, int limit, unsigned char* lengths) {
+    unsigned long weight[2 * 288];
+    int parent[2 * 288];
+    int alive[2 * 288];
+    int leaf_symbol[288];
+
+    for (int shift = 0;; shift++) {
+        int leaves = 0;
+        int nodes;
+        int deepest = 0;
+
+        memset(lengths, 0, (size_t)symbols);
+        for (int s = 0; s < symbols; s++) {
+            if (freq[s]) {
+                weight[leaves] = (freq[s] >> shift) | 1;
+                leaf_symbol[leaves++] = s;
+            }
+        }
+        if (leaves < 2) {
+            if (leaves == 1) {
+                lengths[leaf_symbol[0]] = 1;
+            }
+            return;
+        }
+
+        for (int i = 0; i < leaves; i++) {
+            alive[i] = 1;
+            parent[i] = -1;
+        }
+        for (nodes = leaves; nodes < 2 * leaves - 1; nodes++) {
+            int a = -1;
+            int b = -1;
+            for (int i = 0; i < nodes; i++) {
+                if (!alive[i]) {
+                    continue;
+                }
+                if (a < 0 || weight[i] < weight[a]) {
+                    b = a;
+                    a = i;
+                } else if (b < 0 || weight[i] < weight[b]) {
+                    b = i;
+                }
+            }
+            weight[nodes] = weight[a] + weight[b];
+            alive[nodes] = 1;
+            parent[nodes] = -1;
+            alive[a] = alive[b] = 0;
+            parent[a] = parent[b] = nodes;
+        }
+
+        for (int i = 0; i < leaves; i++) {
+            int depth = 0;
+            for (int node = i; parent[node] >= 0; node = parent[node]) {
+                depth++;
+            }
+            lengths[leaf_symbol[i]] = (unsigned char)depth;
+            if (depth > deepest) {
+                deepest = depth;
+            }
+        }
+        if (deepest <= limit) {
+            return;
+        }
+    }
+}
+
+// Canonical codes for a set of code lengths (RFC 1951 section 3.2.2)
+static void huffman_codes(const unsigned char* lengths, int symbols, unsigned short* codes) {
+    int count[16] = { 0 };
+    unsigned int next[16];
+    unsigned int code = 0;
+
+    for (int s = 0; s < symbols; s++) {
+        count[lengths[s]]++;
+    }
+    count[0] = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        code = (code + (unsigned int)count[bits - 1]) << 1;
+        next[bits] = code;
+    }
+    for (int s = 0; s < symbols; s++) {
+        codes[s] = lengths[s] ? reverse_code(next[lengths[s]]++, lengths[s]) : 0;
+    }
+}
+
+// Every tree gets at least two codes, which keeps strict decoders happy
+static void huffman_pad(unsigned long* freq, int symbols) {
+    int used = 0;
+
+    for (int s = 0; s < symbols; s++) {
+        used += freq[s] != 0;
+    }
+    for (int s = 0; s < symbols && used < 2; s++) {
+        if (!freq[s]) {
+            freq[s] = 1;
+            used++;
+        }
+    }
+}
+
+static int length_symbol(int length) {
+    int code = 28;
+    while (LENGTH_BASE[code] > length) {
+        code--;
+    }
+    return code;
+}
+
+static int distance_symbol(int distance) {
+    int code = 29;
+    while (DISTANCE_BASE[code] > distance) {
+        code--;
+    }
+    return code;
+}
+
+// Run-length code the literal and distance code lengths with symbols 16-18.
+// Returns the number of symbols.
+static int code_length_runs(const unsigned char* lengths, int count, unsigned char* symbols, unsigned char* extras) {
+    int used = 0;
+
+    for (int i = 0; i < count;) {
+        int length = lengths[i];
+        int run = 1;
+
+        while (i + run < count && lengths[i + run] == length) {
+            run++;
+        }
+        i += run;
+        if (length == 0) {
+            while (run >= 11) {
+                int take = run < 138 ? run : 138;
+                symbols[used] = 18;
+                extras[used++] = (unsigned char)(take - 11);
+                run -= take;
+            }
+            if (run >= 3) {
+                symbols[used] = 17;
+                extras[used++] = (unsigned char)(run - 3);
+                run = 0;
+            }
+        } else {
+            symbols[used] = (unsigned char)length;
+            extras[used++] = 0;
+            run--;
+            while (run >= 3) {
+                int take = run < 6 ? run : 6;
+                symbols[used] = 16;
+                extras[used++] = (unsigned char)(take - 3);
+                run -= take;
+            }
+        }
+        while (run-- > 0) {
+            symbols[used] = (unsigned char)length;
+            extras[used++] = 0;
+        }
+    }
+    return used;
+}
+
+// Send the buffered tokens as one block with Huffman codes built for them
+static void deflate_block(Deflater* deflater, int final) {
+    unsigned long literal_freq[286] = { 0 };
+    unsigned long distance_freq[30] = { 0 };
+    unsigned long run_freq[19] = { 0 };
+    unsigned char literal_lengths[286];
+    unsigned char distance_lengths[30];
+    unsigned char run_lengths[19];
+    unsigned short literal_codes[286];
+    unsigned short distance_codes[30];
+    unsigned short run_codes[19];
+    unsigned char all_lengths[286 + 30];
+    unsigned char runs[286 + 30];
+    unsigned char run_extras[286 + 30];
+    static const unsigned char RUN_EXTRA[3] = { 2, 3, 7 };
+    int literal_count = 286;
+    int distance_count = 30;
+    int run_length_count = 19;
+
+    for (size_t t = 0; t < deflater->tokens; t++) {
+        if (deflater->token_length[t] == 0) {
+            literal_freq[deflater->token_value[t]]++;
+        } else {
+            literal_freq[257 + length_symbol(deflater->token_length[t])]++;
+            distance_freq[distance_symbol(deflater->token_value[t])]++;
+        }
+    }
+    literal_freq[256] = 1;
+    huffman_pad(literal_freq, 286);
+    huffman_pad(distance_freq, 30);
+    huffman_lengths(literal_freq, 286, 15, literal_lengths);
+    huffman_lengths(distance_freq, 30, 15, distance_lengths);
+    huffman_codes(literal_lengths, 286, literal_codes);
+    huffman_codes(distance_lengths, 30, distance_codes);
+
+    while (literal_count > 257 && literal_lengths[literal_count - 1] == 0) {
+        literal_count--;
+    }
+    while (distance_count > 1 && distance_lengths[distance_count - 1] == 0) {
+        distance_count--;
+    }
+    memcpy(all_lengths, literal_lengths, (size_t)literal_count);
+    memcpy(all_lengths + literal_count, distance_lengths, (size_t)distance_count);
+    int run_count = code_length_runs(all_lengths, literal_count + distance_count, runs, run_extras);
+
+    for (int r = 0; r < run_count; r++) {
+        run_freq[runs[r]]++;
+    }
+    huffman_pad(run_freq, 19);
+    huffman_lengths(run_freq, 19, 7, run_lengths);
+    huffman_codes(run_lengths, 19, run_codes);
+    while (run_length_count > 4 && run_lengths[CODE_LENGTH_ORDER[run_length_count - 1]] == 0) {
+        run_length_count--;
+    }
+
+    deflate_bits(deflater, (unsigned long)final, 1);
+    deflate_bits(deflater, 2, 2);
+    deflate_bits(deflater, (unsigned long)(literal_count - 257), 5);
+    deflate_bits(deflater, (unsigned long)(distance_count - 1), 5);
+    deflate_bits(deflater, (unsigned long)(run_length_count - 4), 4);
+    for (int i = 0; i < run_length_count; i++) {
+        deflate_bits(deflater, run_lengths[CODE_LENGTH_ORDER[i]], 3);
+    }
+    for (int r = 0; r < run_count; r++) {
+        deflate_bits(deflater, run_codes[runs[r]], run_lengths[runs[r]]);
+        if (runs[r] >= 16) {
+            deflate_bits(deflater, run_extras[r], RUN_EXTRA[runs[r] - 16]);
+        }
+    }
+
+    for (size_t t = 0; t < deflater->tokens; t++) {
+        int length = deflater->token_length[t];
+        int value = deflater->token_value[t];
+
+        if (length == 0) {
+            deflate_bits(deflater, literal_codes[value], literal_lengths[value]);
+            continue;
+        }
+        int code = length_symbol(length);
+        deflate_bits(deflater, literal_codes[257 + code], literal_lengths[257 + code]);
+        deflate_bits(deflater, (unsigned long)(length - LENGTH_BASE[code]), LENGTH_EXTRA[code]);
+        code = distance_symbol(value);
+        deflate_bits(deflater, distance_codes[code], distance_lengths[code]);
+        deflate_bits(deflater, (unsigned long)(value - DISTANCE_BASE[code]), DISTANCE_EXTRA[code]);
+    }
+    deflate_bits(deflater, literal_codes[256], literal_lengths[256]);
+    deflater->tokens = 0;
+}
+
+// Queue a literal (length 0, value = byte) or a match (value = distance)
+static void deflate_token(Deflater* deflater, int length, int value) {
+    deflater->token_length[deflater->tokens] = (unsigned short)length;
+    deflater->token_value[deflater->tokens] = (unsigned short)value;
+    if (++deflater->tokens == GZIP_BLOCK_TOKENS) {
+        deflate_block(deflater, 0);
+    }
+}
+
+static unsigned int deflate_hash(const unsigned char* p) {
+    return ((unsigned int)p[0] << 10 ^ (unsigned int)p[1] << 5 ^ p[2]) & ((1u << GZIP_HASH_BITS) - 1);
+}
+
+static void deflate_insert(Deflater* deflater, size_t at) {
+    unsigned int hash = deflate_hash(deflater->window + at);
+    deflater->prev[at] = deflater->head[hash];
+    deflater->head[hash] = (int)at;
+}
+
+// Encode the window up to end, leaving room for a full match when more input
+// may follow
+static void deflate_window(Deflater* deflater, int final) {
+    size_t end = final ? deflater->length
+                       : (deflater->length > GZIP_MAX_MATCH ? deflater->length - GZIP_MAX_MATCH : 0);
+    size_t at = deflater->done;
+
+    while (at < end) {
+        int best_length = 0;
+        int best_distance = 0;
+        size_t available = deflater->length - at;
+
+        if (available >= GZIP_MIN_MATCH) {
+            int limit = available < GZIP_MAX_MATCH ? (int)available : GZIP_MAX_MATCH;
+            int candidate = deflater->head[deflate_hash(deflater->window + at)];
+
+            for (int chain = 0; candidate >= 0 && chain < GZIP_MAX_CHAIN; chain++) {
+                int distance = (int)at - candidate;
+                if (distance > GZIP_WINDOW) {
+                    break;
+                }
+                const unsigned char* a = deflater->window + at;
+                const unsigned char* b = deflater->window + candidate;
+                int length = 0;
+                while (length < limit && a[length] == b[length]) {
+                    length++;
+                }
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = distance;
+                    if (length == limit) {
+                        break;
+                    }
+                }
+                candidate = deflater->prev[candidate];
+            }
+        }
+
+        if (best_length >= GZIP_MIN_MATCH) {
+            deflate_token(deflater, best_length, best_distance);
+            for (int i = 0; i < best_length; i++) {
+                if (deflater->length - (at + (size_t)i) >= GZIP_MIN_MATCH) {
+                    deflate_insert(deflater, at + (size_t)i);
+                }
+            }
+            at += (size_t)best_length;
+        } else {
+            deflate_token(deflater, 0, deflater->window[at]);
+            if (available >= GZIP_MIN_MATCH) {
+                deflate_insert(deflater, at);
+            }
+            at++;
+        }
+    }
+    deflater->done = at;
+}
+
+static void deflate_init(Deflater* deflater, FILE* out) {
+    static const unsigned char header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+
+    memset(deflater, 0, sizeof(Deflater));
+    deflater->out = out;
+    memset(deflater->head, 0xFF, sizeof(deflater->head));
+    for (size_t i = 0; i < sizeof(header); i++) {
+        deflate_byte(deflater, header[i]);
+    }
+}
+
+static void deflate_write(Deflater* deflater, const unsigned char* data, size_t length) {
+    deflater->crc = crc_update(deflater->crc, data, length);
+    deflater->size += (unsigned long)length;
+
+    while (length > 0) {
+        size_t room = sizeof(deflater->window) - deflater->length;
+        size_t take = length < room ? length : room;
+
+        memcpy(deflater->window + deflater->length, data, take);
+        deflater->length += take;
+        data += take;
+        length -= take;
+        deflate_window(deflater, 0);
+
+        // Window full: slide the last 32 KB down and rebase the hash chains
+        if (deflater->length == sizeof(deflater->window)) {
+            memmove(deflater->window, deflater->window + GZIP_WINDOW, GZIP_WINDOW);
+            deflater->length -= GZIP_WINDOW;
+            deflater->done -= GZIP_WINDOW;
+            for (int i = 0; i < (1 << GZIP_HASH_BITS); i++) {
+                deflater->head[i] = deflater->head[i] >= GZIP_WINDOW ? deflater->head[i] - GZIP_WINDOW : -1;
+            }
+            for (int i = 0; i < GZIP_WINDOW; i++) {
+                int link = deflater->prev[i + GZIP_WINDOW];
+                deflater->prev[i] = link >= GZIP_WINDOW ? link - GZIP_WINDOW : -1;
+            }
+        }
+    }
+}
+
+static void deflate_finish(Deflater* deflater) {
+    deflate_window(deflater, 1);
+    deflate_block(deflater, 1);
+    if (deflater->count > 0) {
+        deflate_bits(deflater, 0, 8 - deflater->count);
+    }
+    for (int i = 0; i < 4; i++) {
+        deflate_byte(deflater, (unsigned char)(deflater->crc >> (8 * i)));
+    }
+    for (int i = 0; i < 4; i++) {
+        deflate_byte(deflater, (unsigned char)(deflater->size >> (8 * i)));
+    }
+    deflate_flush(deflater);
+}
+
+// File stream stages
+
+// Fill a block from the input. Returns 0 at the end of the input.
+static size_t stream_read(FileStream* stream, StreamBlock* block) {
+    if (stream->compressed_input) {
+        block->length = inflate_read(stream->inflater, (unsigned char*)block->data, STREAM_RING_BLOCK);
+    } else {
+        size_t length = 0;
+        while (stream->prefix_length > 0 && length < STREAM_RING_BLOCK) {
+            block->data[length++] = (char)stream->prefix[4 - stream->prefix_length--];
+        }
+        if (stream->threads > 1) {
+            // Whole blocks, or the threads would get a line each
+            block->length = length + fread(block->data + length, 1, STREAM_RING_BLOCK - length, stream->in);
+        } else {
+            block->length = length + read_block(stream->in, block->data + length, STREAM_RING_BLOCK - length);
+        }
+    }
+    stream->bytes_in += block->length;
+    return block->length;
+}
+
+static void stream_write(FileStream* stream, const StreamBlock* block) {
+    if (stream->compress_output) {
+        deflate_write(stream->deflater, (const unsigned char*)block->data, block->length);
+    } else {
+        if (fwrite(block->data, 1, block->length, stream->out) != block->length) {
+            fprintf(stderr, "Error: Could not write output\n");
+            exit(1);
+        }
+        fflush(stream->out);
+        stream->bytes_out += block->length;
+    }
+}
+
+#ifndef UNIVAC
+// Thread 0 encrypts, thread 1 reads (and inflates), thread 2 writes (and deflates)
+static void file_stream_stage(void* context, int stage) {
+    FileStream* stream = (FileStream*)context;
+    StreamBlock* block;
+
+    if (stage == 1) {
+        while ((block = (StreamBlock*)queue_pop(&stream->idle)) != NULL) {
+            if (stream_read(stream, block) == 0) {
+                break;
+            }
+            queue_push(&stream->plain, block);
+        }
+        queue_close(&stream->plain);
+    } else if (stage == 0) {
+        while ((block = (StreamBlock*)queue_pop(&stream->plain)) != NULL) {
+            encrypt_block_parallel(stream->state, block->data, block->length, stream->threads);
+            queue_push(&stream->cipher, block);
+        }
+        queue_close(&stream->cipher);
+    } else {
+        while ((block = (StreamBlock*)queue_pop(&stream->cipher)) != NULL) {
+            stream_write(stream, block);
+            queue_push(&stream->idle, block);
+        }
+        queue_close(&stream->idle);
+    }
+}
+#endif
+
+// Whether stdin may be compressed and so needs run_file_stream. Only peeks
+// at the first byte, which is pushed back; the stream checks the whole magic.
+int input_may_be_compressed(FILE* in) {
+    int c = getc(in);
+
+    if (c == EOF) {
+        return 0;
+    }
+    ungetc(c, in);
+    return c == GZIP_MAGIC[0] || c == ZSTD_MAGIC[0];
+}
+
+// Whether bytes start with the whole gzip or zstd magic. Input too short to
+// hold either is plain text.
+int has_compressed_magic(const unsigned char* bytes, size_t length) {
+    return (length >= sizeof(GZIP_MAGIC) && memcmp(bytes, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0) ||
+           (length >= sizeof(ZSTD_MAGIC) && memcmp(bytes, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0);
+}
+
+// Stream mode through files and/or compression (-i, -O, --gzip or
+// compressed input). The input format is sniffed from its first bytes.
+void run_file_stream(EnigmaState* state, const RunOptions* options, RunStats* stats) {
+    const char* output_path = options->output_path;
+    FILE* in = options->input_path ? fopen(options->input_path, "rb") : stdin;
+    FILE* out = output_path ? fopen(output_path, "wb") : stdout;
+
+    if (!in) {
+        fprintf(stderr, "Error: Could not open input file '%s'\n", options->input_path);
+        exit(1);
+    }
+    if (!out) {
+        fprintf(stderr, "Error: Could not create output file '%s'\n", output_path);
+        exit(1);
+    }
+
+    encrypt_file_stream(state, in, out, options->threads > 1 ? options->threads : 1,
+                        options->compress_output ||
+                        (output_path && strlen(output_path) > 3 &&
+                         strcmp(output_path + strlen(output_path) - 3, ".gz") == 0),
+                        stats);
+
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Error: Could not write output file '%s'\n", output_path);
+        exit(1);
+    }
+}
+
+// Run the stream pipeline from in to out, encrypting each block over threads
+// threads and compressing the output if asked. The files stay open.
+void encrypt_file_stream(EnigmaState* state, FILE* in, FILE* out, int threads, int compress_output, RunStats* stats) {
+    FileStream stream;
+
+    memset(&stream, 0, sizeof(FileStream));
+    stream.state = state;
+    stream.threads = threads;
+    stream.in = in;
+    stream.out = out;
+    stream.compress_output = compress_output;
+    crc_init();
+
+    // Sniff: only a leading 0x1F or 0x28 can start a format we know
+    int c = getc(stream.in);
+    if (c == GZIP_MAGIC[0] || c == ZSTD_MAGIC[0]) {
+        stream.prefix[0] = (unsigned char)c;
+        stream.prefix_length = 1;
+        while (stream.prefix_length < 4 && (c = getc(stream.in)) != EOF) {
+            stream.prefix[stream.prefix_length++] = (unsigned char)c;
+        }
+        if (stream.prefix_length == 4 && memcmp(stream.prefix, ZSTD_MAGIC, 4) == 0) {
+            fprintf(stderr, "Error: Input is zstd-compressed; this build only reads gzip\n");
+            exit(1);
+        }
+        stream.compressed_input = stream.prefix_length >= 2 && memcmp(stream.prefix, GZIP_MAGIC, 2) == 0;
+        if (!stream.compressed_input) {
+            // Plain text after all: hand the sniffed bytes to the reader first
+            memmove(stream.prefix + 4 - stream.prefix_length, stream.prefix, stream.prefix_length);
+        }
+    } else if (c != EOF) {
+        ungetc(c, stream.in);
+    }
+
+    if (stream.compressed_input) {
+        stream.inflater = (Inflater*)memory_alloc(MEM_IO, sizeof(Inflater));
+        if (!stream.inflater) {
+            fprintf(stderr, "Error: Out of memory for decompression\n");
+            exit(1);
+        }
+        inflate_init(stream.inflater, stream.in, stream.prefix, stream.prefix_length);
+        stream.prefix_length = 0;
+    }
+    if (stream.compress_output) {
+        stream.deflater = (Deflater*)memory_alloc(MEM_IO, sizeof(Deflater));
+        if (!stream.deflater) {
+            fprintf(stderr, "Error: Out of memory for compression\n");
+            exit(1);
+        }
+        deflate_init(stream.deflater, stream.out);
+    }
+
+    for (int b = 0; b < STREAM_RING; b++) {
+        stream.blocks[b].data = (char*)memory_alloc(MEM_IO, STREAM_RING_BLOCK);
+        if (!stream.blocks[b].data) {
+            fprintf(stderr, "Error: Out of memory for stream blocks\n");
+            exit(1);
+        }
+    }
+
+#ifndef UNIVAC
+    queue_init(&stream.idle, STREAM_RING);
+    queue_init(&stream.plain, STREAM_RING);
+    queue_init(&stream.cipher, STREAM_RING);
+    for (int b = 0; b < STREAM_RING; b++) {
+        queue_push(&stream.idle, &stream.blocks[b]);
+    }
+    run_workers(3, file_stream_stage, &stream);
+    stats->queue_full_waits += stream.idle.full_waits + stream.plain.full_waits + stream.cipher.full_waits;
+    stats->queue_empty_waits += stream.idle.empty_waits + stream.plain.empty_waits + stream.cipher.empty_waits;
+    queue_destroy(&stream.idle);
+    queue_destroy(&stream.plain);
+    queue_destroy(&stream.cipher);
+#else
+    while (stream_read(&stream, &stream.blocks[0]) > 0) {
+        encrypt_block_parallel(state, stream.blocks[0].data, stream.blocks[0].length, stream.threads);
+        stream_write(&stream, &stream.blocks[0]);
+    }
+#endif
+
+    if (stream.compress_output) {
+        deflate_finish(stream.deflater);
+        stream.bytes_out = stream.deflater->written;
+        memory_free(stream.deflater);
+    }
+    memory_free(stream.inflater);
+    stats->bytes_in += stream.bytes_in;
+    stats->bytes_out += stream.bytes_out;
+    for (int b = 0; b < STREAM_RING; b++) {
+        memory_free(stream.blocks[b].data);
+    }
+    fflush(stream.out);
+}
@@ -0,0 +1,233 @@
+/*
+ * Program Name: Unigma
+ * Program Release Year: 2025
+ * Program Author: Steven S.
+ * Program Link: https://github.com/BitEU/Unigma
+ * Purpose: Memory accounting for Unigma - allocations tracked per subsystem, with limits
+ */
+
+#include "unigma.h"
+
+// Every allocation goes through memory_alloc and friends with the category
+// of the subsystem that owns it. A small header in front of each block keeps
+// its size and category, so memory_free needs only the pointer.
+//
+// Limits (--mem-limit) are soft for compiled tables while a key cache is
+// running: the caches evict their least recently used keys until the tables
+// are back under the limit. Without one (and for the other categories)
+// nothing can be dropped, so an allocation that would pass the limit fails
+// and the run stops with an error, rather than being killed by the system
+// when memory runs out.
+
+typedef union {
+    struct {
+        size_t size;
+        int category;
+    } block;
+    char align[16];                 // Keep the caller's memory 16-byte aligned
+} MemoryHeader;
+
+static const char* const MEMORY_NAMES[MEM_CATEGORIES] = {
+    "tables", "keycache", "sessions", "search", "io", "models"
+};
+
+// Owners currently able to give memory back when over the limit, by category
+static int memory_evictors[MEM_CATEGORIES];
+
+#ifndef UNIVAC
+static volatile LONGLONG memory_current[MEM_CATEGORIES];
+static volatile LONGLONG memory_peak[MEM_CATEGORIES];
+static volatile LONGLONG memory_evictions[MEM_CATEGORIES];
+#else
+static long long memory_current[MEM_CATEGORIES];
+static long long memory_peak[MEM_CATEGORIES];
+static long long memory_evictions[MEM_CATEGORIES];
+#endif
+static unsigned long long memory_limit[MEM_CATEGORIES];   // 0 = no limit
+
+// Add delta bytes to a category and return the new total
+static long long memory_add(int category, long long delta) {
+#ifndef UNIVAC
+    LONGLONG now = InterlockedExchangeAdd64(&memory_current[category], delta) + delta;
+    LONGLONG peak = memory_peak[category];
+
+    while (now > peak) {
+        LONGLONG seen = InterlockedCompareExchange64(&memory_peak[category], now, peak);
+        if (seen == peak) {
+            break;
+        }
+        peak = seen;
+    }
+    return now;
+#else
+    memory_current[category] += delta;
+    if (memory_current[category] > memory_peak[category]) {
+        memory_peak[category] = memory_current[category];
+    }
+    return memory_current[category];
+#endif
+}
+
+// Charge size bytes to a category. Returns -1 (and charges nothing) if that
+// would pass a limit that cannot be met by eviction.
+static int memory_charge(int category, size_t size) {
+    long long now = memory_add(category, (long long)size);
+
+    if (memory_limit[category] && memory_evictors[category] == 0 &&
+        (unsigned long long)now > memory_limit[category]) {
+        memory_add(category, -(long long)size);
+        fprintf(stderr, "Error: %s memory limit of %llu bytes reached\n",
+                MEMORY_NAMES[category], memory_limit[category]);
+        return -1;
+    }
+    return 0;
+}
+
+void* memory_alloc(MemoryCategory category, size_t size) {
+    if (memory_charge(category, size) != 0) {
+        return NULL;
+    }
+
+    MemoryHeader* header = (MemoryHeader*)malloc(sizeof(MemoryHeader) + size);
+    if (!header) {
+        memory_add(category, -(long long)size);
+        return NULL;
+    }
+    header->block.size = size;
+    header->block.category = category;
+    return header + 1;
+}
+
+void* memory_calloc(MemoryCategory category, size_t count, size_t size) {
+    if (size && count > ((size_t)-1 - sizeof(MemoryHeader)) / size) {
+        return NULL;
+    }
+
+    void* block = memory_alloc(category, count * size);
+    if (block) {
+        memset(block, 0, count * size);
+    }
+    return block;
+}
+
+// Resize a block, keeping its category; a NULL block is allocated in category
+void* memory_realloc(MemoryCategory category, void* block, size_t size) {
+    if (!block) {
+        return memory_alloc(category, size);
+    }
+
+    MemoryHeader* header = (MemoryHeader*)block - 1;
+    int owner = header->block.category;
+    size_t old_size = header->block.size;
+
+    if (size > old_size && memory_charge(owner, size - old_size) != 0) {
+        return NULL;
+    }
+    MemoryHeader* grown = (MemoryHeader*)realloc(header, sizeof(MemoryHeader) + size);
+    if (!grown) {
+        if (size > old_size) {
+            memory_add(owner, -(long long)(size - old_size));
+        }
+        return NULL;
+    }
+    if (size < old_size) {
+        memory_add(owner, -(long long)(old_size - size));
+    }
+    grown->block.size = size;
+    return grown + 1;
+}
+
+void memory_free(void* block) {
+    if (!block) {
+        return;
+    }
+
+    MemoryHeader* header = (MemoryHeader*)block - 1;
+    memory_add(header->block.category, -(long long)header->block.size);
+    free(header);
+}
+
+int memory_over_limit(MemoryCategory category) {
+    return memory_limit[category] && (unsigned long long)memory_current[category] > memory_limit[category];
+}
+
+// Register (delta 1) or retire (delta -1) an owner that evicts memory of a
+// category when it is over the limit. Called from the main thread only.
+void memory_evictor(MemoryCategory category, int delta) {
+    memory_evictors[category] += delta;
+}
+
+void memory_note_eviction(MemoryCategory category) {
+#ifndef UNIVAC
+    InterlockedExchangeAdd64(&memory_evictions[category], 1);
+#else
+    memory_evictions[category]++;
+#endif
+}
+
+// Parse "CATEGORY=SIZE", where SIZE may end in K, M or G. Returns 0 on success.
+int set_memory_limit(const char* spec) {
+    const char* equals = strchr(spec, '=');
+    char* end;
+
+    if (!equals) {
+        return -1;
+    }
+    for (int c = 0; c < MEM_CATEGORIES; c++) {
+        size_t length = strlen(MEMORY_NAMES[c]);
+        if ((size_t)(equals - spec) != length || strncmp(spec, MEMORY_NAMES[c], length) != 0) {
+            continue;
+        }
+
+        unsigned long long limit = strtoull(equals + 1, &end, 10);
+        if (end == equals + 1) {
+            return -1;
+        }
+        switch (toupper((unsigned char)*end)) {
+            case 'K': limit <<= 10; end++; break;
+            case 'M': limit <<= 20; end++; break;
+            case 'G': limit <<= 30; end++; break;
+            default: break;
+        }
+        if (*end != '\0' || limit == 0) {
+            return -1;
+        }
+        memory_limit[c] = limit;
+        return 0;
+    }
+    return -1;
+}
+
+static void format_bytes(unsigned long long bytes, char* out, size_t size) {
+    if (bytes >= 10ULL << 20) {
+        snprintf(out, size, "%.1f MB", (double)bytes / (1 << 20));
+    } else if (bytes >= 10ULL << 10) {
+        snprintf(out, size, "%.1f KB", (double)bytes / (1 << 10));
+    } else {
+        snprintf(out, size, "%llu B", bytes);
+    }
+}
+
+// Current and peak bytes of every category that was used
+void print_memory_stats(void) {
+    char current[32];
+    char peak[32];
+    char limit[32];
+
+    for (int c = 0; c < MEM_CATEGORIES; c++) {
+        if (memory_peak[c] == 0) {
+            continue;
+        }
+        format_bytes((unsigned long long)memory_current[c], current, sizeof(current));
+        format_bytes((unsigned long long)memory_peak[c], peak, sizeof(peak));
+        fprintf(stderr, "Memory %-10s %s now, %s peak", MEMORY_NAMES[c], current, peak);
+        if (memory_limit[c]) {
+            format_bytes(memory_limit[c], limit, sizeof(limit));
+            fprintf(stderr, ", limit %s", limit);
+        }
+        if (memory_evictions[c]) {
+            fprintf(stderr, ", %lld evictions", (long long)memory_evictions[c]);
+        }
+        fprintf(stderr, "\n");
+    }
+}
@@ -0,0 +1,464 @@
+/*
+ * Program Name: Unigma
+ * Program Release Year: 2025
+ * Program Author: Steven S.
+ * Program Link: https://github.com/BitEU/Unigma
+ * Purpose: Structured records for Unigma - CSV, TSV and JSONL fields encrypted in record mode
+ */
+
+#include "unigma.h"
+
+// Structured record mode
+//
+// With --format csv|tsv|jsonl, record mode encrypts chosen fields of each
+// record (--fields), every field as its own message from the start key, and
+// leaves everything else byte for byte as it was.
+//
+// The input is read in large chunks and indexed 64 bytes at a time: each
+// block is turned into bitmasks of its quotes, separators and newlines, eight
+// bytes per 64-bit word at once, and the bytes inside quotes are masked out
+// with a prefix XOR of the quote bits, so a separator or newline inside a
+// quoted field is never mistaken for structure. What is left is one bit per
+// structural byte, and the fields fall out of walking the set bits.
+//
+// Fields are handed to encrypt_record_batch as pointers into the chunk, so
+// they are encrypted where they lie, and the chunk is written back with one
+// fwrite: the untouched columns never pass through the program byte by byte.
+//
+// CSV follows RFC 4180 quoting (quoted fields may hold separators, newlines
+// and doubled quotes); TSV has no quoting. In JSONL the fields are the string
+// values of the named top-level keys. Letters in JSON escapes (\n, \u00e9)
+// are hidden from the encryptor and so neither change nor step the rotors.
+
+#define RECORD_CHUNK (1 << 20)          // Input bytes indexed at a time
+#define MAX_RECORD_FIELDS 256           // CSV/TSV columns --fields can select
+#define MAX_JSON_FIELDS 64              // JSONL keys --fields can name
+
+typedef struct {
+    RecordFormat format;
+    unsigned char separator;
+    int all_fields;                     // No --fields: every field is encrypted
+    unsigned char selected[MAX_RECORD_FIELDS];
+    const char* names[MAX_JSON_FIELDS];
+    size_t name_lengths[MAX_JSON_FIELDS];
+    int name_count;
+    int skip_header;                    // First record still to pass through
+    FusedTables tables;
+    char* spans[RECORD_BATCH];          // Fields waiting for encryption, in place
+    size_t span_lengths[RECORD_BATCH];
+    int span_count;
+    char** hidden;                      // JSON escape letters hidden for the batch
+    char* hidden_letters;
+    size_t hidden_count;
+    size_t hidden_capacity;
+    unsigned long long* structure;      // One bit per structural byte of the chunk
+    size_t structure_words;
+    unsigned long batches;
+    unsigned long records;
+    unsigned long fields;
+} RecordScanner;
+
+// Block bitmasks
+
+// Bit i set where byte i of the 8-byte word equals c: the high bit of each
+// zero byte of word ^ c, gathered into the low 8 bits by one multiply
+static unsigned int match_bytes(unsigned long long word, unsigned char c) {
+    unsigned long long x = word ^ (0x0101010101010101ULL * c);
+    unsigned long long zero = ~(((x & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | x) & 0x8080808080808080ULL;
+    return (unsigned int)(((zero >> 7) * 0x0102040810204080ULL) >> 56);
+}
+
+// Load 8 bytes as a little-endian word whatever the machine order
+static unsigned long long load_word(const unsigned char* p) {
+    unsigned long long word = 0;
+
+    for (int i = 7; i >= 0; i--) {
+        word = (word << 8) | p[i];
+    }
+    return word;
+}
+
+// Bitmask of the bytes of a 64-byte block equal to c
+static unsigned long long block_mask(const unsigned long long words[8], unsigned char c) {
+    unsigned long long mask = 0;
+
+    for (int w = 0; w < 8; w++) {
+        mask |= (unsigned long long)match_bytes(words[w], c) << (8 * w);
+    }
+    return mask;
+}
+
+// Bit i set when an odd number of bits at or below i are set
+static unsigned long long prefix_xor(unsigned long long bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+// Index the structure of data[0..length): one bit per byte that is a
+// separator, newline or (JSON) bracket, colon or unescaped quote outside
+// strings. Returns the length up to and including the last structural
+// newline, or length itself at the end of the input.
+static size_t index_structure(RecordScanner* scanner, const unsigned char* data, size_t length, int at_end) {
+    size_t blocks = (length + 63) / 64;
+    unsigned long long in_string = 0;   // All ones when the previous block ended inside quotes
+    unsigned long long escape_carry = 0;
+    size_t complete = 0;
+
+    if (blocks > scanner->structure_words) {
+        scanner->structure = (unsigned long long*)memory_realloc(MEM_IO, scanner->structure,
+                                                                 blocks * sizeof(unsigned long long));
+        if (!scanner->structure) {
+            fprintf(stderr, "Error: Out of memory indexing records\n");
+            exit(1);
+        }
+        scanner->structure_words = blocks;
+    }
+
+    for (size_t b = 0; b < blocks; b++) {
+        unsigned char tail[64];
+        const unsigned char* block = data + b * 64;
+        unsigned long long words[8];
+        unsigned long long valid = ~0ULL;
+
+        if (b * 64 + 64 > length) {
+            size_t left = length - b * 64;
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block, left);
+            block = tail;
+            valid = (1ULL << left) - 1;
+        }
+        for (int w = 0; w < 8; w++) {
+            words[w] = load_word(block + 8 * w);
+        }
+
+        unsigned long long quotes = 0;
+        unsigned long long newlines = block_mask(words, '\n');
+        unsigned long long structural;
+
+        if (scanner->format == RECORD_JSONL) {
+            unsigned long long backslashes = block_mask(words, '\\');
+            unsigned long long escaped = escape_carry;
+
+            // Backslashes are rare, so their runs are followed one by one
+            escape_carry = 0;
+            while (backslashes) {
+                int i = lowest_bit(backslashes);
+                backslashes &= backslashes - 1;
+                if ((escaped >> i) & 1) {
+                    continue;
+                }
+                if (i == 63) {
+                    escape_carry = 1;
+                } else {
+                    escaped |= 1ULL << (i + 1);
+                }
+            }
+            quotes = block_mask(words, '"') & ~escaped;
+            structural = block_mask(words, ':') | block_mask(words, ',') |
+                         block_mask(words, '{') | block_mask(words, '}') |
+                         block_mask(words, '[') | block_mask(words, ']') | newlines;
+        } else {
+            if (scanner->format == RECORD_CSV) {
+                quotes = block_mask(words, '"');
+            }
+            structural = block_mask(words, scanner->separator) | newlines;
+        }
+
+        // Inside a string from an opening quote up to (not including) its
+        // closing quote
+        unsigned long long inside = prefix_xor(quotes) ^ in_string;
+        in_string = (unsigned long long)0 - (inside >> 63);
+
+        structural = ((structural & ~inside) | (scanner->format == RECORD_JSONL ? quotes : 0)) & valid;
+        scanner->structure[b] = structural;
+
+        unsigned long long ends = newlines & ~inside & valid;
+        if (ends) {
+            int last = 63;
+            while (!((ends >> last) & 1)) {
+                last--;
+            }
+            complete = b * 64 + (size_t)last + 1;
+        }
+    }
+    return at_end ? length : complete;
+}
+
+// Batches
+
+// Hide the letters of JSON escapes in a field until its batch is encrypted
+static void hide_escapes(RecordScanner* scanner, char* field, size_t length) {
+    char* end = field + length;
+    char* p = field;
+
+    while ((p = (char*)memchr(p, '\\', (size_t)(end - p))) != NULL && p + 1 < end) {
+        size_t hide = p[1] == 'u' ? 5 : 1;
+
+        for (size_t k = 1; k <= hide && p + k < end; k++) {
+            if (!isalpha((unsigned char)p[k])) {
+                continue;
+            }
+            if (scanner->hidden_count == scanner->hidden_capacity) {
+                scanner->hidden_capacity = scanner->hidden_capacity ? 2 * scanner->hidden_capacity : 256;
+                scanner->hidden = (char**)memory_realloc(MEM_IO, scanner->hidden,
+                                                         scanner->hidden_capacity * sizeof(char*));
+                scanner->hidden_letters = (char*)memory_realloc(MEM_IO, scanner->hidden_letters,
+                                                                scanner->hidden_capacity);
+                if (!scanner->hidden || !scanner->hidden_letters) {
+                    fprintf(stderr, "Error: Out of memory for JSON escapes\n");
+                    exit(1);
+                }
+            }
+            scanner->hidden[scanner->hidden_count] = p + k;
+            scanner->hidden_letters[scanner->hidden_count++] = p[k];
+            p[k] = '\0';
+        }
+        p += 1 + hide;
+    }
+}
+
+static void flush_fields(RecordScanner* scanner) {
+    if (scanner->span_count > 0) {
+        encrypt_record_batch(&scanner->tables, scanner->spans, scanner->span_lengths, scanner->span_count);
+        scanner->batches++;
+        scanner->span_count = 0;
+    }
+    for (size_t h = 0; h < scanner->hidden_count; h++) {
+        *scanner->hidden[h] = scanner->hidden_letters[h];
+    }
+    scanner->hidden_count = 0;
+}
+
+static void add_field(RecordScanner* scanner, char* field, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (scanner->format == RECORD_JSONL) {
+        hide_escapes(scanner, field, length);
+    }
+    scanner->spans[scanner->span_count] = field;
+    scanner->span_lengths[scanner->span_count++] = length;
+    scanner->fields++;
+    if (scanner->span_count == RECORD_BATCH) {
+        flush_fields(scanner);
+    }
+}
+
+// Field walkers: follow the structural bits of data[0..length)
+
+static void walk_delimited(RecordScanner* scanner, char* data, size_t length) {
+    size_t field_start = 0;
+    int column = 0;
+
+    for (size_t b = 0; b * 64 < length; b++) {
+        unsigned long long bits = scanner->structure[b];
+
+        while (bits) {
+            size_t at = b * 64 + (size_t)lowest_bit(bits);
+            bits &= bits - 1;
+            if (at >= length) {
+                break;
+            }
+
+            if (!scanner->skip_header &&
+                (scanner->all_fields || (column < MAX_RECORD_FIELDS && scanner->selected[column]))) {
+                add_field(scanner, data + field_start, at - field_start);
+            }
+            if (data[at] == '\n') {
+                column = 0;
+                scanner->records++;
+                scanner->skip_header = 0;
+            } else {
+                column++;
+            }
+            field_start = at + 1;
+        }
+    }
+    // Last record of the input without a newline
+    if (field_start < length) {
+        if (!scanner->skip_header &&
+            (scanner->all_fields || (column < MAX_RECORD_FIELDS && scanner->selected[column]))) {
+            add_field(scanner, data + field_start, length - field_start);
+        }
+        scanner->records++;
+    }
+}
+
+static int json_key_selected(const RecordScanner* scanner, const char* key, size_t length) {
+    if (scanner->all_fields) {
+        return 1;
+    }
+    for (int n = 0; n < scanner->name_count; n++) {
+        if (scanner->name_lengths[n] == length && memcmp(scanner->names[n], key, length) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void walk_json(RecordScanner* scanner, char* data, size_t length) {
+    size_t string_start = 0;
+    int in_string = 0;
+    int depth = 0;
+    int expect_value = 0;               // At depth 1, the next string is a value
+    int key_selected = 0;
+
+    for (size_t b = 0; b * 64 < length; b++) {
+        unsigned long long bits = scanner->structure[b];
+
+        while (bits) {
+            size_t at = b * 64 + (size_t)lowest_bit(bits);
+            bits &= bits - 1;
+            if (at >= length) {
+                break;
+            }
+
+            switch (data[at]) {
+                case '"':
+                    if (!in_string) {
+                        string_start = at + 1;
+                        in_string = 1;
+                        break;
+                    }
+                    in_string = 0;
+                    if (depth != 1) {
+                        break;
+                    }
+                    if (!expect_value) {
+                        key_selected = json_key_selected(scanner, data + string_start, at - string_start);
+                    } else if (key_selected && !scanner->skip_header) {
+                        add_field(scanner, data + string_start, at - string_start);
+                    }
+                    break;
+                case '{':
+                case '[':
+                    depth++;
+                    expect_value = 0;
+                    break;
+                case '}':
+                case ']':
+                    depth--;
+                    break;
+                case ':':
+                    expect_value = 1;
+                    break;
+                case ',':
+                    if (depth == 1) {
+                        expect_value = 0;
+                    }
+                    break;
+                case '\n':
+                    depth = 0;
+                    in_string = 0;
+                    expect_value = 0;
+                    scanner->records++;
+                    scanner->skip_header = 0;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    if (length > 0 && data[length - 1] != '\n') {
+        scanner->records++;
+    }
+}
+
+// Options
+
+// --fields: column numbers (1-based) for CSV/TSV, key names for JSONL
+static void parse_record_fields(RecordScanner* scanner, const char* fields) {
+    const char* p = fields;
+
+    scanner->all_fields = fields == NULL;
+    while (p && *p) {
+        const char* end = strchr(p, ',');
+        size_t length = end ? (size_t)(end - p) : strlen(p);
+
+        if (scanner->format == RECORD_JSONL) {
+            if (scanner->name_count == MAX_JSON_FIELDS) {
+                fprintf(stderr, "Error: At most %d --fields names\n", MAX_JSON_FIELDS);
+                exit(1);
+            }
+            scanner->names[scanner->name_count] = p;
+            scanner->name_lengths[scanner->name_count++] = length;
+        } else {
+            int column = atoi(p);
+            if (column < 1 || column > MAX_RECORD_FIELDS) {
+                fprintf(stderr, "Error: --fields columns must be numbers from 1 to %d\n", MAX_RECORD_FIELDS);
+                exit(1);
+            }
+            scanner->selected[column - 1] = 1;
+        }
+        p = end ? end + 1 : NULL;
+    }
+}
+
+// Record mode with --format: encrypt the chosen fields of stdin's records
+void run_structured_records(const EnigmaState* state, const RunOptions* options, RunStats* stats) {
+    static RecordScanner scanner;
+    size_t capacity = RECORD_CHUNK;
+    size_t filled = 0;
+    int at_end = 0;
+    char* buffer = (char*)memory_alloc(MEM_IO, capacity);
+
+    if (!buffer) {
+        fprintf(stderr, "Error: Out of memory for record input\n");
+        exit(1);
+    }
+    memset(&scanner, 0, sizeof(RecordScanner));
+    scanner.format = options->record_format;
+    scanner.separator = options->record_format == RECORD_TSV ? '\t' : ',';
+    scanner.skip_header = options->record_header;
+    parse_record_fields(&scanner, options->fields);
+    init_fused_tables(&scanner.tables, state);
+
+    while (!at_end) {
+        // A record longer than the buffer grows it
+        if (filled == capacity) {
+            capacity *= 2;
+            buffer = (char*)memory_realloc(MEM_IO, buffer, capacity);
+            if (!buffer) {
+                fprintf(stderr, "Error: Out of memory for record input\n");
+                exit(1);
+            }
+        }
+        size_t got = fread(buffer + filled, 1, capacity - filled, stdin);
+        filled += got;
+        at_end = got == 0;
+
+        size_t complete = index_structure(&scanner, (const unsigned char*)buffer, filled, at_end);
+        if (complete == 0) {
+            continue;
+        }
+        if (scanner.format == RECORD_JSONL) {
+            walk_json(&scanner, buffer, complete);
+        } else {
+            walk_delimited(&scanner, buffer, complete);
+        }
+        flush_fields(&scanner);
+
+        if (fwrite(buffer, 1, complete, stdout) != complete) {
+            fprintf(stderr, "Error: Could not write output\n");
+            exit(1);
+        }
+        memmove(buffer, buffer + complete, filled - complete);
+        filled -= complete;
+    }
+
+    stats->records += scanner.records;
+    stats->fields += scanner.fields;
+    stats->key_groups = scanner.batches ? 1 : 0;
+    stats->table_misses = scanner.batches ? 1 : 0;
+    stats->table_hits = scanner.batches ? scanner.batches - 1 : 0;
+    free_fused_tables(&scanner.tables);
+    memory_free(scanner.structure);
+    memory_free(scanner.hidden);
+    memory_free(scanner.hidden_letters);
+    memory_free(buffer);
+}
@@ -0,0 +1,1440 @@
+/*
+ * Program Name: Unigma
+ * Program Release Year: 2025
+ * Program Author: Steven S.
+ * Program Link: https://github.com/BitEU/Unigma
+ * Purpose: Ciphertext-only key search for Unigma - scoring, joint daily-key recovery and the attack pipeline
+ */
+
+#include "unigma.h"
+
+// Scoring
+
+// Index of coincidence of a letter histogram
+double ioc_score(const unsigned long counts[ALPHABET_SIZE]) {
+    unsigned long total = 0;
+    double sum = 0.0;
+
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        total += counts[i];
+        sum += (double)counts[i] * (double)(counts[i] ? counts[i] - 1 : 0);
+    }
+    if (total < 2) {
+        return 0.0;
+    }
+    return sum / ((double)total * (double)(total - 1));
+}
+
+// Index of coincidence over bigrams (676 cells), a sharper plugboard signal
+double bigram_ioc_score(const unsigned long counts[ALPHABET_SIZE * ALPHABET_SIZE]) {
+    unsigned long total = 0;
+    double sum = 0.0;
+
+    for (int i = 0; i < ALPHABET_SIZE * ALPHABET_SIZE; i++) {
+        total += counts[i];
+        sum += (double)counts[i] * (double)(counts[i] ? counts[i] - 1 : 0);
+    }
+    if (total < 2) {
+        return 0.0;
+    }
+    return sum / ((double)total * (double)(total - 1));
+}
+
+// Joint daily-key recovery
+//
+// Every message of the day shares rotor order, rings and plugboard; only the
+// start positions differ. The search runs each rotor order through stages:
+//   1. find each message's DAILY_KEY_STARTS best start positions on its own
+//      (rings AAA, no plugboard). Without the plugboard the true start seldom
+//      scores best, but it is usually among the first few;
+//   2. try every middle/right ring setting, keeping the wiring offsets found
+//      so far and moving only the turnovers. The first sweep also picks each
+//      message's start from its candidates: the one that fits each ring
+//      setting best;
+//   3. hill-climb the plugboard on the pooled statistics of all messages,
+//      using each message's plugboard-free scrambler tables;
+//   4. re-find the start positions with the plugboard in place and repeat
+//      from stage 2, DAILY_KEY_ROUNDS times in all.
+// Pooling is what lets short messages contribute: none of them needs to
+// carry enough statistics by itself. The best order's key is only reported
+// as recovered if its pooled bigram IoC reaches DAILY_KEY_CONFIDENT.
+
+typedef struct {
+    unsigned char* cipher;              // Ciphertext letters (0-25)
+    size_t length;
+    int positions[NUM_ROTORS];          // Best start positions found so far
+    int starts[DAILY_KEY_STARTS][NUM_ROTORS];   // Best starts of the last position search, best first
+    FusedTables tables;                 // Scrambler tables at those positions
+} DailyMessage;
+
+typedef struct {
+    EnigmaState base;                   // Order, rings and plugboard under test
+    DailyMessage* messages;
+    int count;
+    int workers;
+    int use_bigrams;                    // Score positions on bigrams (plugboard known)
+    int keep_left;                      // Search only middle/right positions, keeping the left
+    int starts;                         // Starts per message the ring sweep picks from (1: positions)
+} DailySearch;
+
+// Shared state of one plugboard hill-climb step
+typedef struct {
+    const DailySearch* search;
+    const int* plug;                    // Current plugboard
+    int use_bigrams;
+    FusedTables* tables;                // Per worker: every message's tables under plug
+    unsigned long* bigrams;             // Per worker: 676 bigram counters
+    double best_score[MAX_THREADS];     // Best trial per worker
+    int best_pair[MAX_THREADS];         // a * 26 + b of that trial, or -1
+} PlugTrial;
+
+// Shared state of the ring sweep
+typedef struct {
+    const DailySearch* search;
+    double best_score[MAX_THREADS];
+    int best_rings[MAX_THREADS];        // middle * 26 + right
+} RingTrial;
+
+// Decrypt a message from start with the compiled machine and count letters.
+// With cells (676 zeroed counters) and a scratch array of length letters,
+// also returns the bigram coincidences sum n(n-1), kept up to date as each
+// bigram is added; the cells are left zeroed again for the next call.
+static double count_decrypt(const EnigmaState* start, const CompiledMachine* compiled,
+                            const unsigned char* cipher, size_t length, unsigned long counts[ALPHABET_SIZE],
+                            unsigned long* cells, unsigned short* touched) {
+    EnigmaState machine = *start;
+    double coincidences = 0.0;
+    int previous = -1;
+
+    memset(counts, 0, ALPHABET_SIZE * sizeof(unsigned long));
+    for (size_t i = 0; i < length; i++) {
+        step_rotors(&machine);
+        int c = compiled_encipher(cipher[i], machine.positions, compiled);
+        counts[c]++;
+        if (cells && previous >= 0) {
+            unsigned short cell = (unsigned short)(previous * ALPHABET_SIZE + c);
+            coincidences += 2.0 * (double)cells[cell]++;
+            touched[i] = cell;
+        }
+        previous = c;
+    }
+
+    if (cells) {
+        for (size_t i = 1; i < length; i++) {
+            cells[touched[i]] = 0;
+        }
+    }
+    return coincidences;
+}
+
+// Stage 1/4 worker: best start positions for each of this worker's messages,
+// with the DAILY_KEY_STARTS best kept in the message's starts. Scored on
+// letter IoC, or on bigram coincidences once a plugboard is known.
+static void daily_positions_worker(void* context, int worker) {
+    DailySearch* search = (DailySearch*)context;
+    CompiledMachine compiled;
+    unsigned long counts[ALPHABET_SIZE];
+    unsigned long* cells = NULL;
+
+    compile_machine(&search->base, &compiled);
+    if (search->use_bigrams) {
+        cells = (unsigned long*)memory_calloc(MEM_SEARCH, ALPHABET_SIZE * ALPHABET_SIZE, sizeof(unsigned long));
+        if (!cells) {
+            fprintf(stderr, "Error: Out of memory in position search\n");
+            exit(1);
+        }
+    }
+
+    for (int m = worker; m < search->count; m += search->workers) {
+        DailyMessage* message = &search->messages[m];
+        EnigmaState machine = search->base;
+        unsigned short* touched = NULL;
+        double kept[DAILY_KEY_STARTS];
+        int kept_count = 0;
+
+        if (cells) {
+            touched = (unsigned short*)memory_alloc(MEM_SEARCH, message->length * sizeof(unsigned short));
+            if (!touched) {
+                fprintf(stderr, "Error: Out of memory in position search\n");
+                exit(1);
+            }
+        }
+
+        int first = search->keep_left ? message->positions[2] * ALPHABET_SIZE * ALPHABET_SIZE : 0;
+        int last = search->keep_left ? first + ALPHABET_SIZE * ALPHABET_SIZE : NUM_POSITIONS;
+
+        for (int p = first; p < last; p++) {
+            machine.positions[2] = p / (ALPHABET_SIZE * ALPHABET_SIZE);
+            machine.positions[1] = p / ALPHABET_SIZE % ALPHABET_SIZE;
+            machine.positions[0] = p % ALPHABET_SIZE;
+
+            double score = count_decrypt(&machine, &compiled, message->cipher, message->length, counts, cells, touched);
+            if (!cells) {
+                score = ioc_score(counts);
+            }
+            if (kept_count == DAILY_KEY_STARTS && score <= kept[kept_count - 1]) {
+                continue;
+            }
+            int i = kept_count < DAILY_KEY_STARTS ? kept_count++ : kept_count - 1;
+            while (i > 0 && kept[i - 1] < score) {
+                kept[i] = kept[i - 1];
+                memcpy(message->starts[i], message->starts[i - 1], sizeof(message->starts[i]));
+                i--;
+            }
+            kept[i] = score;
+            memcpy(message->starts[i], machine.positions, sizeof(message->starts[i]));
+            if (i == 0) {
+                memcpy(message->positions, machine.positions, sizeof(message->positions));
+            }
+        }
+        memory_free(touched);
+        UNIGMA_PROBE3(search__unit, "daily-positions", m, worker);
+    }
+    memory_free(cells);
+}
+
+// Decrypt a message from start, adding its bigram counts to bigrams.
+// Returns the message's own bigram coincidences (sum of n(n-1)).
+static double add_decrypt_bigrams(const EnigmaState* start, const CompiledMachine* compiled,
+                                  const unsigned char* cipher, size_t length, unsigned long* bigrams,
+                                  unsigned long* scratch) {
+    EnigmaState machine = *start;
+    double coincidences = 0.0;
+    int previous = -1;
+
+    memset(scratch, 0, ALPHABET_SIZE * ALPHABET_SIZE * sizeof(unsigned long));
+    for (size_t i = 0; i < length; i++) {
+        step_rotors(&machine);
+        int c = compiled_encipher(cipher[i], machine.positions, compiled);
+        if (previous >= 0) {
+            scratch[previous * ALPHABET_SIZE + c]++;
+        }
+        previous = c;
+    }
+    for (int i = 0; i < ALPHABET_SIZE * ALPHABET_SIZE; i++) {
+        coincidences += (double)scratch[i] * (double)(scratch[i] ? scratch[i] - 1 : 0);
+        if (bigrams) {
+            bigrams[i] += scratch[i];
+        }
+    }
+    return coincidences;
+}
+
+// Start positions of a message under candidate rings: the same wiring offsets
+// as under the current rings, turnovers moved. A message whose positions were
+// fitted under the wrong rings may also have the middle rotor one step off,
+// so the middle is allowed to move by one. Tried from each of the message's
+// first search->starts starts (or its positions alone); the best fit goes to
+// fitted.
+static void fit_message_rings(const DailySearch* search, const DailyMessage* message,
+                              const CompiledMachine* compiled, int middle, int right,
+                              unsigned long* bigrams, unsigned long* scratch, int fitted[NUM_ROTORS]) {
+    static const int shifts[3] = { 0, -1, 1 };
+    EnigmaState machine = search->base;
+    double best = -1.0;
+
+    machine.ring_settings[1] = middle;
+    machine.ring_settings[0] = right;
+
+    for (int s = 0; s < search->starts; s++) {
+        const int* start = search->starts > 1 ? message->starts[s] : message->positions;
+
+        machine.positions[2] = start[2];
+        machine.positions[0] = mod_positive(start[0] + right - search->base.ring_settings[0]);
+        for (int i = 0; i < 3; i++) {
+            machine.positions[1] = mod_positive(start[1] + middle - search->base.ring_settings[1] + shifts[i]);
+            double score = add_decrypt_bigrams(&machine, compiled, message->cipher, message->length, NULL, scratch);
+            if (score > best) {
+                best = score;
+                memcpy(fitted, machine.positions, sizeof(machine.positions));
+            }
+        }
+    }
+
+    if (bigrams) {
+        memcpy(machine.positions, fitted, sizeof(machine.positions));
+        add_decrypt_bigrams(&machine, compiled, message->cipher, message->length, bigrams, scratch);
+    }
+}
+
+// Stage 2 worker: pooled score of every ring setting assigned to this worker.
+// Moving a turnover changes only a few letters per 26, so the sweep scores on
+// bigrams, which those few letters disturb far more than the letter counts.
+static void daily_rings_worker(void* context, int worker) {
+    RingTrial* trial = (RingTrial*)context;
+    const DailySearch* search = trial->search;
+    unsigned long* bigrams = (unsigned long*)memory_alloc(MEM_SEARCH, 2 * ALPHABET_SIZE * ALPHABET_SIZE * sizeof(unsigned long));
+
+    if (!bigrams) {
+        fprintf(stderr, "Error: Out of memory in ring search\n");
+        exit(1);
+    }
+    trial->best_score[worker] = -1.0;
+    trial->best_rings[worker] = 0;
+
+    for (int rings = worker; rings < ALPHABET_SIZE * ALPHABET_SIZE; rings += search->workers) {
+        EnigmaState machine = search->base;
+        CompiledMachine compiled;
+        int middle = rings / ALPHABET_SIZE;
+        int right = rings % ALPHABET_SIZE;
+
+        machine.ring_settings[1] = middle;
+        machine.ring_settings[0] = right;
+        compile_machine(&machine, &compiled);
+        memset(bigrams, 0, ALPHABET_SIZE * ALPHABET_SIZE * sizeof(unsigned long));
+
+        for (int m = 0; m < search->count; m++) {
+            int fitted[NUM_ROTORS];
+
+            fit_message_rings(search, &search->messages[m], &compiled, middle, right,
+                              bigrams, bigrams + ALPHABET_SIZE * ALPHABET_SIZE, fitted);
+        }
+
+        double score = bigram_ioc_score(bigrams);
+        if (score > trial->best_score[worker]) {
+            trial->best_score[worker] = score;
+            trial->best_rings[worker] = rings;
+        }
+    }
+    memory_free(bigrams);
+}
+
+// Move the search to the given middle/right rings, fitting each message's
+// start positions to them. The messages' candidate starts are used up: later
+// sweeps fit from the positions alone.
+static void adopt_rings(DailySearch* search, int middle, int right, unsigned long* scratch) {
+    EnigmaState ringed = search->base;
+    CompiledMachine compiled;
+
+    ringed.ring_settings[1] = middle;
+    ringed.ring_settings[0] = right;
+    compile_machine(&ringed, &compiled);
+    for (int m = 0; m < search->count; m++) {
+        DailyMessage* message = &search->messages[m];
+        int fitted[NUM_ROTORS];
+
+        fit_message_rings(search, message, &compiled, middle, right, NULL, scratch, fitted);
+        memcpy(message->positions, fitted, sizeof(message->positions));
+    }
+    search->base.ring_settings[1] = middle;
+    search->base.ring_settings[0] = right;
+    search->starts = 1;
+}
+
+// Pooled bigram score of all messages decrypted with plug through their
+// scrambler tables; bigrams is the caller's 676 counters, cleared here
+static double plug_score(const DailySearch* search, const int plug[ALPHABET_SIZE], unsigned long* bigrams) {
+    memset(bigrams, 0, ALPHABET_SIZE * ALPHABET_SIZE * sizeof(unsigned long));
+
+    for (int m = 0; m < search->count; m++) {
+        const DailyMessage* message = &search->messages[m];
+        int previous = -1;
+
+        for (size_t i = 0; i < message->length; i++) {
+            const unsigned char* scrambler = message->tables.scrambler + i * ALPHABET_SIZE;
+            int c = plug[scrambler[plug[message->cipher[i]]]];
+            if (previous >= 0) {
+                bigrams[previous * ALPHABET_SIZE + c]++;
+            }
+            previous = c;
+        }
+    }
+    return bigram_ioc_score(bigrams);
+}
+
+// Connect a and b in plug, unplugging their old partners (a == b unplugs a)
+static void plug_swap(int plug[ALPHABET_SIZE], int a, int b) {
+    plug[plug[a]] = plug[a];
+    plug[plug[b]] = plug[b];
+    plug[a] = b;
+    plug[b] = a;
+}
+
+// Pooled score of all messages decrypted through their fused tables, which
+// already have the plugboard under trial applied
+static double fused_score(const DailySearch* search, const FusedTables* tables, int use_bigrams,
+                          unsigned long* bigrams) {
+    unsigned long counts[ALPHABET_SIZE];
+
+    memset(counts, 0, sizeof(counts));
+    if (use_bigrams) {
+        memset(bigrams, 0, ALPHABET_SIZE * ALPHABET_SIZE * sizeof(unsigned long));
+    }
+
+    for (int m = 0; m < search->count; m++) {
+        const DailyMessage* message = &search->messages[m];
+        const unsigned char* fused = tables[m].fused;
+        int previous = -1;
+
+        for (size_t i = 0; i < message->length; i++) {
+            int c = fused[i * (ALPHABET_SIZE + 1) + message->cipher[i]];
+            counts[c]++;
+            if (use_bigrams && previous >= 0) {
+                bigrams[previous * ALPHABET_SIZE + c]++;
+            }
+            previous = c;
+        }
+    }
+    return use_bigrams ? bigram_ioc_score(bigrams) : ioc_score(counts);
+}
+
+// Make the cable change a-b (a == b unplugs a) in count messages' tables
+static void swap_cables(FusedTables* tables, int count, int a, int b) {
+    for (int m = 0; m < count; m++) {
+        swap_fused_cable(&tables[m], a, b);
+    }
+}
+
+// Stage 3 worker: try this worker's share of the 325 cable changes. Each
+// trial rewrites only the table entries its cable touches, and is undone
+// the same way once scored.
+static void daily_plug_worker(void* context, int worker) {
+    PlugTrial* trial = (PlugTrial*)context;
+    int count = trial->search->count;
+    FusedTables* tables = trial->tables + (size_t)worker * count;
+    unsigned long* bigrams = trial->bigrams + (size_t)worker * ALPHABET_SIZE * ALPHABET_SIZE;
+    int pair = 0;
+
+    trial->best_score[worker] = -1.0;
+    trial->best_pair[worker] = -1;
+
+    for (int a = 0; a < ALPHABET_SIZE; a++) {
+        for (int b = a + 1; b < ALPHABET_SIZE; b++, pair++) {
+            if (pair % trial->search->workers != worker) {
+                continue;
+            }
+
+            int partner_a = trial->plug[a];
+            int partner_b = trial->plug[b];
+            swap_cables(tables, count, a, partner_a == b ? a : b);  // Already connected: try removing the cable
+
+            double score = fused_score(trial->search, tables, trial->use_bigrams, bigrams);
+            if (score > trial->best_score[worker]) {
+                trial->best_score[worker] = score;
+                trial->best_pair[worker] = a * ALPHABET_SIZE + b;
+            }
+
+            // Back to the current plugboard
+            swap_cables(tables, count, a, a);
+            swap_cables(tables, count, b, b);
+            if (partner_a != a) {
+                swap_cables(tables, count, a, partner_a);
+            }
+            if (partner_b != b && partner_b != a) {
+                swap_cables(tables, count, b, partner_b);
+            }
+        }
+    }
+}
+
+// Compile each message's scrambler tables at its current start positions
+static void compile_daily_tables(DailySearch* search) {
+    for (int m = 0; m < search->count; m++) {
+        DailyMessage* message = &search->messages[m];
+        EnigmaState machine = search->base;
+
+        memcpy(machine.positions, message->positions, sizeof(machine.positions));
+        reset_fused_tables(&message->tables, &machine);
+        compile_fused_tables(&message->tables, message->length);
+    }
+}
+
+// Greedy plugboard hill-climb on the pooled score; plug is updated in place.
+// Climbs on letter IoC first, then refines on bigram IoC. Each worker keeps
+// its own copy of the messages' tables, kept in step with plug.
+static double climb_plugboard(DailySearch* search, int plug[ALPHABET_SIZE]) {
+    PlugTrial trial;
+    double current = 0.0;
+    int tables = search->workers * search->count;
+    char plugboard[MAX_PLUGBOARD_LEN];
+
+    trial.search = search;
+    trial.plug = plug;
+    trial.tables = (FusedTables*)memory_calloc(MEM_SEARCH, (size_t)tables, sizeof(FusedTables));
+    trial.bigrams = (unsigned long*)memory_alloc(MEM_SEARCH,
+        (size_t)search->workers * ALPHABET_SIZE * ALPHABET_SIZE * sizeof(unsigned long));
+    if (!trial.tables || !trial.bigrams) {
+        fprintf(stderr, "Error: Out of memory climbing the plugboard\n");
+        exit(1);
+    }
+    format_plugboard(plug, plugboard, sizeof(plugboard));
+    for (int t = 0; t < tables; t++) {
+        copy_fused_tables(&trial.tables[t], &search->messages[t % search->count].tables);
+        rekey_fused_plugboard(&trial.tables[t], plugboard);
+    }
+
+    for (trial.use_bigrams = 0; trial.use_bigrams <= 1; trial.use_bigrams++) {
+        current = fused_score(search, trial.tables, trial.use_bigrams, trial.bigrams);
+
+        for (;;) {
+            run_workers(search->workers, daily_plug_worker, &trial);
+
+            int best = 0;
+            for (int w = 1; w < search->workers; w++) {
+                if (trial.best_score[w] > trial.best_score[best]) {
+                    best = w;
+                }
+            }
+            if (trial.best_pair[best] < 0 || trial.best_score[best] <= current) {
+                break;
+            }
+
+            int a = trial.best_pair[best] / ALPHABET_SIZE;
+            int b = trial.best_pair[best] % ALPHABET_SIZE;
+            if (plug[a] == b) {
+                b = a;
+            }
+            swap_cables(trial.tables, tables, a, b);
+            plug_swap(plug, a, b);
+            current = trial.best_score[best];
+        }
+    }
+
+    for (int t = 0; t < tables; t++) {
+        free_fused_tables(&trial.tables[t]);
+    }
+    memory_free(trial.tables);
+    memory_free(trial.bigrams);
+    return current;
+}
+
+// Turn a plug permutation into a plugboard string ("AB CD ...")
+void format_plugboard(const int plug[ALPHABET_SIZE], char* out, size_t size) {
+    size_t length = 0;
+
+    out[0] = '\0';
+    for (int i = 0; i < ALPHABET_SIZE && length + 4 <= size; i++) {
+        if (plug[i] > i) {
+            if (length > 0) {
+                out[length++] = ' ';
+            }
+            out[length++] = (char)('A' + i);
+            out[length++] = (char)('A' + plug[i]);
+            out[length] = '\0';
+        }
+    }
+}
+
+// Read one message per line, letters only
+static int read_daily_messages(const char* path, DailyMessage* messages, int max_messages) {
+    FILE* in = fopen(path, "r");
+    char* line = NULL;
+    size_t capacity = 0;
+    long length;
+    int count = 0;
+
+    if (!in) {
+        fprintf(stderr, "Error: Could not open message file '%s'\n", path);
+        exit(1);
+    }
+
+    while (count < max_messages && (length = read_line(in, &line, &capacity)) >= 0) {
+        DailyMessage* message = &messages[count];
+
+        memset(message, 0, sizeof(DailyMessage));
+        message->cipher = (unsigned char*)memory_alloc(MEM_SEARCH, (size_t)length + 1);
+        if (!message->cipher) {
+            fprintf(stderr, "Error: Out of memory reading messages\n");
+            exit(1);
+        }
+        message->length = (size_t)letters_of(line, message->cipher, (int)length);
+        if (message->length > 0) {
+            count++;
+        } else {
+            memory_free(message->cipher);
+        }
+    }
+
+    memory_free(line);
+    fclose(in);
+    return count;
+}
+
+// --daily-key FILE
+void run_daily_key(const EnigmaState* state, const RunOptions* options) {
+    static DailyMessage messages[MAX_DAILY_MESSAGES];
+    DailySearch search;
+    int best_plug[ALPHABET_SIZE];
+    int best_positions[MAX_DAILY_MESSAGES][NUM_ROTORS];
+    EnigmaState best_key = *state;
+    double best_score = -1.0;
+    char plugboard[MAX_PLUGBOARD_LEN];
+    static unsigned long scratch[ALPHABET_SIZE * ALPHABET_SIZE];
+
+    search.count = read_daily_messages(options->path, messages, MAX_DAILY_MESSAGES);
+    search.messages = messages;
+    search.workers = options->threads > 0 ? options->threads : default_thread_count();
+    search.use_bigrams = 0;
+    search.keep_left = 0;
+    search.starts = 1;
+    if (search.count == 0) {
+        fprintf(stderr, "Error: No messages in '%s'\n", options->path);
+        exit(1);
+    }
+
+    // Every rotor order: the letter IoC of stage 1 cannot tell the right one
+    // from the rest until rings and plugboard are in place
+    for (int o = 0; o < NUM_ROTOR_ORDERS; o++) {
+        int plug[ALPHABET_SIZE];
+        double score = 0.0;
+
+        search.base = *state;
+        search.base.plugboard[0] = '\0';
+        for (int i = 0; i < NUM_ROTORS; i++) {
+            search.base.ring_settings[i] = 0;
+        }
+        for (int i = 0; i < ALPHABET_SIZE; i++) {
+            plug[i] = i;
+        }
+        apply_rotor_order(&search.base, ROTOR_ORDERS[o]);
+
+        // Stage 1: candidate starts per message
+        search.use_bigrams = 0;
+        run_workers(search.workers, daily_positions_worker, &search);
+        search.use_bigrams = 1;
+        search.starts = DAILY_KEY_STARTS;
+
+        // Stages 2-4, repeated so that the rings and positions are re-found
+        // with the plugboard recovered so far
+        for (int round = 0; round < DAILY_KEY_ROUNDS; round++) {
+            RingTrial rings;
+
+            if (round > 0) {
+                run_workers(search.workers, daily_positions_worker, &search);
+            }
+
+            // Stage 2: rings
+            rings.search = &search;
+            run_workers(search.workers, daily_rings_worker, &rings);
+            int best = 0;
+            for (int w = 1; w < search.workers; w++) {
+                if (rings.best_score[w] > rings.best_score[best]) {
+                    best = w;
+                }
+            }
+            adopt_rings(&search, rings.best_rings[best] / ALPHABET_SIZE, rings.best_rings[best] % ALPHABET_SIZE, scratch);
+
+            // Stage 3: plugboard on the pooled statistics
+            compile_daily_tables(&search);
+            score = climb_plugboard(&search, plug);
+            format_plugboard(plug, search.base.plugboard, MAX_PLUGBOARD_LEN);
+        }
+
+        // Messages whose positions could not be found alone get another try
+        // now that the whole daily key is known
+        run_workers(search.workers, daily_positions_worker, &search);
+        compile_daily_tables(&search);
+        score = plug_score(&search, plug, scratch);
+
+        fprintf(stderr, "Order %d%d%d: score %.5f\n", ROTOR_ORDERS[o][0] + 1, ROTOR_ORDERS[o][1] + 1,
+                ROTOR_ORDERS[o][2] + 1, score);
+        if (score > best_score) {
+            best_score = score;
+            best_key = search.base;
+            memcpy(best_plug, plug, sizeof(best_plug));
+            for (int m = 0; m < search.count; m++) {
+                memcpy(best_positions[m], messages[m].positions, sizeof(best_positions[m]));
+            }
+        }
+    }
+
+    // Report the daily key and every message's start and decrypt
+    format_plugboard(best_plug, plugboard, sizeof(plugboard));
+    SAFE_STRCPY(best_key.plugboard, plugboard, MAX_PLUGBOARD_LEN);
+    for (int m = 0; m < search.count; m++) {
+        EnigmaState machine = best_key;
+        char key[64];
+
+        memcpy(machine.positions, best_positions[m], sizeof(machine.positions));
+        format_key_options(&machine, key, sizeof(key));
+        if (plugboard[0]) {
+            printf("%s -b \"%s\"\t", key, plugboard);
+        } else {
+            printf("%s\t", key);
+        }
+        for (size_t i = 0; i < messages[m].length; i++) {
+            step_rotors(&machine);
+            putchar('A' + encipher_letter(messages[m].cipher[i], &machine));
+        }
+        putchar('\n');
+
+        memory_free(messages[m].cipher);
+        free_fused_tables(&messages[m].tables);
+    }
+    if (best_score >= DAILY_KEY_CONFIDENT) {
+        fprintf(stderr, "Recovered daily key from %d message(s), pooled bigram IoC %.5f\n", search.count, best_score);
+    } else {
+        fprintf(stderr, "Warning: Low confidence: pooled bigram IoC %.5f of the best key is below %.4f; "
+                "the key above is likely wrong (more or longer messages help)\n", best_score, DAILY_KEY_CONFIDENT);
+    }
+}
+
+// Ciphertext-only attack pipeline
+//
+// --attack recovers one message's key with the daily-key stages run as a
+// pipeline, each stage on its own threads (--stage-threads):
+//   0. positions: for every rotor order and left rotor position, the middle
+//      and right start positions with the best letter IoC (rings AAA, no
+//      plugboard);
+//   1. rings: the daily-key ring sweep at those positions;
+//   2. plugboard: the plugboard hill-climb at the ringed positions;
+//   3. final: middle and right start positions found again with the
+//      plugboard in place, scored on bigram IoC. The left position is the one
+//      stage 0 found: the ring sweep only moves the other two.
+// Survivors are handed on through bounded queues as soon as they are found,
+// so the later stages work while the first is still sweeping. A candidate
+// only enters a stage if its score ranks among the best that stage has
+// admitted so far, which bounds the costly stages without waiting for the
+// earlier ones to finish. The six rotor orders are compiled once and shared
+// by the position threads. On UNIVAC each survivor goes through the remaining
+// stages as soon as it is found.
+
+#define ATTACK_BOARD 32                 // Widest stage admission board
+
+// Stage 0 has no admission; the others take the best this many seen so far
+static const int ATTACK_WIDTH[ATTACK_STAGES] = { 0, 32, 6, 3 };
+static const char* const ATTACK_STAGE_NAMES[ATTACK_STAGES] = { "positions", "rings", "plugboard", "final" };
+
+typedef struct {
+    int order;                          // Index into ROTOR_ORDERS
+    int rings[NUM_ROTORS];
+    int positions[NUM_ROTORS];
+    int plug[ALPHABET_SIZE];
+    double score;                       // Score from the last stage it went through
+} AttackCandidate;
+
+typedef struct {
+    EnigmaState base;                   // Machine with rings AAA and no plugboard
+    unsigned char* cipher;
+    size_t length;
+    CompiledMachine orders[NUM_ROTOR_ORDERS];
+    int threads[ATTACK_STAGES];
+    ScoreFunc scorer;                   // Plug-in for the positions stage (NULL = letter IoC)
+    double board[ATTACK_STAGES][ATTACK_BOARD];  // Best admitted scores, descending
+    int board_count[ATTACK_STAGES];
+    unsigned long offered[ATTACK_STAGES];
+    unsigned long admitted[ATTACK_STAGES];
+    AttackCandidate results[ATTACK_RESULTS];    // Best final keys, descending
+    int result_count;
+#ifndef UNIVAC
+    BoundedQueue queues[ATTACK_STAGES]; // queues[s] feeds stage s (s >= 1)
+    volatile LONG running[ATTACK_STAGES];
+    CRITICAL_SECTION lock;
+#endif
+} Attack;
+
+static void attack_stage(Attack* attack, int stage, AttackCandidate* candidate);
+
+// Whether a candidate may enter stage: its score must rank among the
+// ATTACK_WIDTH[stage] best the stage has admitted so far
+static int attack_admit(Attack* attack, int stage, double score) {
+    int width = ATTACK_WIDTH[stage];
+    double* board = attack->board[stage];
+    int admit;
+
+#ifndef UNIVAC
+    EnterCriticalSection(&attack->lock);
+#endif
+    int count = attack->board_count[stage];
+    attack->offered[stage]++;
+    admit = count < width || score > board[width - 1];
+    if (admit) {
+        int i = count < width ? count++ : width - 1;
+        while (i > 0 && board[i - 1] < score) {
+            board[i] = board[i - 1];
+            i--;
+        }
+        board[i] = score;
+        attack->board_count[stage] = count;
+        attack->admitted[stage]++;
+    }
+#ifndef UNIVAC
+    LeaveCriticalSection(&attack->lock);
+#endif
+    return admit;
+}
+
+// Hand a candidate to stage, or drop it if it does not rank
+static void attack_emit(Attack* attack, int stage, AttackCandidate* candidate) {
+    if (!attack_admit(attack, stage, candidate->score)) {
+        memory_free(candidate);
+        return;
+    }
+#ifndef UNIVAC
+    queue_push(&attack->queues[stage], candidate);
+#else
+    attack_stage(attack, stage, candidate);
+#endif
+}
+
+// A one-message daily-key search at the candidate's key
+static void attack_search(const Attack* attack, const AttackCandidate* candidate,
+                          DailySearch* search, DailyMessage* message) {
+    memset(message, 0, sizeof(DailyMessage));
+    message->cipher = attack->cipher;
+    message->length = attack->length;
+    memcpy(message->positions, candidate->positions, sizeof(message->positions));
+
+    search->base = attack->base;
+    apply_rotor_order(&search->base, ROTOR_ORDERS[candidate->order]);
+    memcpy(search->base.ring_settings, candidate->rings, sizeof(search->base.ring_settings));
+    format_plugboard(candidate->plug, search->base.plugboard, MAX_PLUGBOARD_LEN);
+    search->messages = message;
+    search->count = 1;
+    search->workers = 1;
+    search->use_bigrams = 1;
+    search->keep_left = 1;
+    search->starts = 1;
+}
+
+// Stage 0: this worker's share of the rotor order / left position units
+static void attack_positions(Attack* attack, int worker) {
+    unsigned long counts[ALPHABET_SIZE];
+    double scores[ALPHABET_SIZE];
+    unsigned char* letters = NULL;
+
+    if (attack->scorer) {
+        letters = (unsigned char*)memory_alloc(MEM_SEARCH, attack->length * ALPHABET_SIZE);
+        if (!letters) {
+            fprintf(stderr, "Error: Out of memory in attack\n");
+            exit(1);
+        }
+    }
+
+    for (int unit = worker; unit < NUM_ROTOR_ORDERS * ALPHABET_SIZE; unit += attack->threads[0]) {
+        AttackCandidate kept[ATTACK_UNIT_KEEP];
+        int kept_count = 0;
+        int order = unit / ALPHABET_SIZE;
+        EnigmaState machine = attack->base;
+
+        apply_rotor_order(&machine, ROTOR_ORDERS[order]);
+        machine.positions[2] = unit % ALPHABET_SIZE;
+        for (int middle = 0; middle < ALPHABET_SIZE; middle++) {
+            machine.positions[1] = middle;
+
+            // The 26 right-rotor positions are scored as one batch
+            if (letters) {
+                for (int right = 0; right < ALPHABET_SIZE; right++) {
+                    EnigmaState decrypt = machine;
+
+                    decrypt.positions[0] = right;
+                    for (size_t i = 0; i < attack->length; i++) {
+                        step_rotors(&decrypt);
+                        letters[i * ALPHABET_SIZE + right] = (unsigned char)compiled_encipher(
+                            attack->cipher[i], decrypt.positions, &attack->orders[order]);
+                    }
+                }
+                attack->scorer(letters, (int)attack->length, ALPHABET_SIZE, scores);
+            } else {
+                for (int right = 0; right < ALPHABET_SIZE; right++) {
+                    machine.positions[0] = right;
+                    count_decrypt(&machine, &attack->orders[order], attack->cipher, attack->length, counts, NULL, NULL);
+                    scores[right] = ioc_score(counts);
+                }
+            }
+
+            for (int right = 0; right < ALPHABET_SIZE; right++) {
+                double score = scores[right];
+
+                if (kept_count == ATTACK_UNIT_KEEP && score <= kept[kept_count - 1].score) {
+                    continue;
+                }
+                int i = kept_count < ATTACK_UNIT_KEEP ? kept_count++ : kept_count - 1;
+                while (i > 0 && kept[i - 1].score < score) {
+                    kept[i] = kept[i - 1];
+                    i--;
+                }
+                memset(&kept[i], 0, sizeof(AttackCandidate));
+                kept[i].order = order;
+                kept[i].positions[2] = machine.positions[2];
+                kept[i].positions[1] = middle;
+                kept[i].positions[0] = right;
+                kept[i].score = score;
+            }
+        }
+
+        for (int k = 0; k < kept_count; k++) {
+            AttackCandidate* candidate = (AttackCandidate*)memory_alloc(MEM_SEARCH, sizeof(AttackCandidate));
+            if (!candidate) {
+                fprintf(stderr, "Error: Out of memory in attack\n");
+                exit(1);
+            }
+            *candidate = kept[k];
+            for (int i = 0; i < ALPHABET_SIZE; i++) {
+                candidate->plug[i] = i;
+            }
+            attack_emit(attack, 1, candidate);
+        }
+        UNIGMA_PROBE3(search__unit, "attack-positions", unit, worker);
+    }
+    memory_free(letters);
+}
+
+// Keep a finished candidate if it ranks among the best keys
+static void attack_result(Attack* attack, const AttackCandidate* candidate) {
+#ifndef UNIVAC
+    EnterCriticalSection(&attack->lock);
+#endif
+    if (attack->result_count < ATTACK_RESULTS ||
+        candidate->score > attack->results[ATTACK_RESULTS - 1].score) {
+        int i = attack->result_count < ATTACK_RESULTS ? attack->result_count++ : ATTACK_RESULTS - 1;
+        while (i > 0 && attack->results[i - 1].score < candidate->score) {
+            attack->results[i] = attack->results[i - 1];
+            i--;
+        }
+        attack->results[i] = *candidate;
+    }
+#ifndef UNIVAC
+    LeaveCriticalSection(&attack->lock);
+#endif
+}
+
+// Stages 1-3 on one candidate, which is passed on or freed
+static void attack_stage(Attack* attack, int stage, AttackCandidate* candidate) {
+    DailySearch search;
+    DailyMessage message;
+    unsigned long scratch[ALPHABET_SIZE * ALPHABET_SIZE];
+
+    attack_search(attack, candidate, &search, &message);
+    if (stage == 1) {
+        RingTrial trial;
+
+        trial.search = &search;
+        daily_rings_worker(&trial, 0);
+        adopt_rings(&search, trial.best_rings[0] / ALPHABET_SIZE, trial.best_rings[0] % ALPHABET_SIZE, scratch);
+        memcpy(candidate->rings, search.base.ring_settings, sizeof(candidate->rings));
+        memcpy(candidate->positions, message.positions, sizeof(candidate->positions));
+        candidate->score = trial.best_score[0];
+        attack_emit(attack, 2, candidate);
+    } else if (stage == 2) {
+        compile_daily_tables(&search);
+        candidate->score = climb_plugboard(&search, candidate->plug);
+        free_fused_tables(&message.tables);
+        attack_emit(attack, 3, candidate);
+    } else {
+        daily_positions_worker(&search, 0);
+        compile_daily_tables(&search);
+        candidate->score = plug_score(&search, candidate->plug, scratch);
+        free_fused_tables(&message.tables);
+        memcpy(candidate->positions, message.positions, sizeof(candidate->positions));
+        attack_result(attack, candidate);
+        memory_free(candidate);
+    }
+}
+
+#ifndef UNIVAC
+// The first threads[0] threads run stage 0, the next threads[1] stage 1, ...
+// The last thread out of a stage closes the queue into the next one.
+static void attack_thread(void* context, int thread) {
+    Attack* attack = (Attack*)context;
+    AttackCandidate* candidate;
+    int stage = 0;
+
+    while (thread >= attack->threads[stage]) {
+        thread -= attack->threads[stage];
+        stage++;
+    }
+    if (stage == 0) {
+        attack_positions(attack, thread);
+    } else {
+        while ((candidate = (AttackCandidate*)queue_pop(&attack->queues[stage])) != NULL) {
+            attack_stage(attack, stage, candidate);
+        }
+    }
+    if (stage + 1 < ATTACK_STAGES && InterlockedDecrement(&attack->running[stage]) == 0) {
+        queue_close(&attack->queues[stage + 1]);
+    }
+}
+#endif
+
+// Whole file as ciphertext letters
+static unsigned char* read_attack_message(const char* path, size_t* length) {
+    FILE* in = fopen(path, "r");
+    char* line = NULL;
+    size_t capacity = 0;
+    unsigned char* cipher = NULL;
+    long line_length;
+
+    if (!in) {
+        fprintf(stderr, "Error: Could not open message file '%s'\n", path);
+        exit(1);
+    }
+
+    *length = 0;
+    while ((line_length = read_line(in, &line, &capacity)) >= 0) {
+        cipher = (unsigned char*)memory_realloc(MEM_SEARCH, cipher, *length + (size_t)line_length + 1);
+        if (!cipher) {
+            fprintf(stderr, "Error: Out of memory reading the message\n");
+            exit(1);
+        }
+        *length += (size_t)letters_of(line, cipher + *length, (int)line_length);
+    }
+
+    memory_free(line);
+    fclose(in);
+    return cipher;
+}
+
+// Split the threads over the stages: one each, then the rest to the
+// plugboard, positions and ring stages in turn, the costliest first
+static void attack_thread_budget(const RunOptions* options, int threads[ATTACK_STAGES]) {
+    static const int spread[3] = { 2, 0, 1 };
+    int total = options->threads > 0 ? options->threads : default_thread_count();
+
+    for (int s = 0; s < ATTACK_STAGES; s++) {
+        threads[s] = 1;
+    }
+#ifndef UNIVAC
+    for (int extra = 0; extra < total - ATTACK_STAGES; extra++) {
+        threads[spread[extra % 3]]++;
+    }
+    for (int s = 0; s < ATTACK_STAGES; s++) {
+        if (options->stage_threads[s] > 0) {
+            threads[s] = options->stage_threads[s];
+        }
+    }
+#else
+    (void)spread;
+    (void)total;
+#endif
+}
+
+// --attack FILE
+void run_attack(const EnigmaState* state, const RunOptions* options) {
+    static Attack attack;
+    int total = 0;
+
+    memset(&attack, 0, sizeof(Attack));
+    attack.cipher = read_attack_message(options->path, &attack.length);
+    if (attack.length == 0) {
+        fprintf(stderr, "Error: No letters in '%s'\n", options->path);
+        exit(1);
+    }
+    attack.base = *state;
+    attack.base.plugboard[0] = '\0';
+    for (int i = 0; i < NUM_ROTORS; i++) {
+        attack.base.ring_settings[i] = 0;
+        attack.base.positions[i] = 0;
+    }
+    for (int o = 0; o < NUM_ROTOR_ORDERS; o++) {
+        EnigmaState machine = attack.base;
+        apply_rotor_order(&machine, ROTOR_ORDERS[o]);
+        compile_machine(&machine, &attack.orders[o]);
+    }
+    attack_thread_budget(options, attack.threads);
+    attack.scorer = options->scorer;
+
+#ifndef UNIVAC
+    InitializeCriticalSection(&attack.lock);
+    for (int s = 0; s < ATTACK_STAGES; s++) {
+        queue_init(&attack.queues[s], ATTACK_QUEUE);
+        attack.running[s] = attack.threads[s];
+        total += attack.threads[s];
+    }
+    run_workers(total, attack_thread, &attack);
+#else
+    attack_positions(&attack, 0);
+    total = 1;
+#endif
+
+    fprintf(stderr, "Attack on %lu letters, %d thread(s):", (unsigned long)attack.length, total);
+    for (int s = 0; s < ATTACK_STAGES; s++) {
+        fprintf(stderr, " %s %d", ATTACK_STAGE_NAMES[s], attack.threads[s]);
+    }
+    fprintf(stderr, "\n");
+    for (int s = 1; s < ATTACK_STAGES; s++) {
+        fprintf(stderr, "Stage %-10s %lu offered, %lu admitted", ATTACK_STAGE_NAMES[s],
+                attack.offered[s], attack.admitted[s]);
+#ifndef UNIVAC
+        fprintf(stderr, ", queue waits %lu full / %lu empty",
+                attack.queues[s].full_waits, attack.queues[s].empty_waits);
+        queue_destroy(&attack.queues[s]);
+#endif
+        fprintf(stderr, "\n");
+    }
+#ifndef UNIVAC
+    queue_destroy(&attack.queues[0]);
+    DeleteCriticalSection(&attack.lock);
+#endif
+
+    // Ranked keys to stderr, the best key and its decrypt to stdout
+    for (int r = 0; r < attack.result_count; r++) {
+        const AttackCandidate* result = &attack.results[r];
+        EnigmaState machine = attack.base;
+        char key[64];
+        char plugboard[MAX_PLUGBOARD_LEN];
+
+        apply_rotor_order(&machine, ROTOR_ORDERS[result->order]);
+        memcpy(machine.ring_settings, result->rings, sizeof(machine.ring_settings));
+        memcpy(machine.positions, result->positions, sizeof(machine.positions));
+        format_key_options(&machine, key, sizeof(key));
+        format_plugboard(result->plug, plugboard, sizeof(plugboard));
+        SAFE_STRCPY(machine.plugboard, plugboard, MAX_PLUGBOARD_LEN);
+        fprintf(stderr, "Key %d: score %.5f  %s -b \"%s\"\n", r + 1, result->score, key, plugboard);
+
+        if (r == 0) {
+            if (plugboard[0]) {
+                printf("%s -b \"%s\"\t", key, plugboard);
+            } else {
+                printf("%s\t", key);
+            }
+            for (size_t i = 0; i < attack.length; i++) {
+                step_rotors(&machine);
+                putchar('A' + encipher_letter(attack.cipher[i], &machine));
+            }
+            putchar('\n');
+        }
+    }
+    memory_free(attack.cipher);
+}
+
+// Live intercept search
+//
+// --live ranks keys while an intercept is still coming in. Every candidate
+// (rotor order and start position, under the -g rings and -b plugboard)
+// carries its running state: current rotor positions, letter histogram and
+// coincidence sum n(n-1). Each new letter group from stdin extends only the
+// survivors from where they stopped, so a letter costs the same whether it
+// is the tenth or the thousandth. After every group the survivors are ranked
+// on letter IoC and, once LIVE_WARMUP letters are in, cut in half for every
+// LIVE_HALVING letters, down to LIVE_MIN_SURVIVORS.
+
+#define LIVE_WARMUP 40                  // Letters before the first cut
+#define LIVE_HALVING 30                 // Letters per halving of the survivors
+#define LIVE_MIN_SURVIVORS 256
+#define LIVE_SHOW 5                     // Keys shown after each group
+
+typedef struct {
+    unsigned char order;                // Index into ROTOR_ORDERS
+    unsigned char start[NUM_ROTORS];
+    unsigned char positions[NUM_ROTORS];// Positions after the letters so far
+    unsigned int counts[ALPHABET_SIZE];
+    unsigned long coincidences;         // Sum of n(n-1) over the histogram
+    double score;
+} LiveCandidate;
+
+typedef struct {
+    EnigmaState orders[NUM_ROTOR_ORDERS];
+    CompiledMachine compiled[NUM_ROTOR_ORDERS];
+    LiveCandidate* candidates;
+    size_t count;
+    const unsigned char* letters;       // The new group
+    size_t length;
+    unsigned long total;                // Letters so far, this group included
+    int workers;
+} LiveSearch;
+
+// Extend this worker's share of the survivors by the new group
+static void live_worker(void* context, int worker) {
+    LiveSearch* live = (LiveSearch*)context;
+    double pairs = (double)live->total * (double)(live->total - 1);
+
+    for (size_t k = (size_t)worker; k < live->count; k += (size_t)live->workers) {
+        LiveCandidate* candidate = &live->candidates[k];
+        EnigmaState machine = live->orders[candidate->order];
+        const CompiledMachine* compiled = &live->compiled[candidate->order];
+
+        for (int r = 0; r < NUM_ROTORS; r++) {
+            machine.positions[r] = candidate->positions[r];
+        }
+        for (size_t i = 0; i < live->length; i++) {
+            step_rotors(&machine);
+            int c = compiled_encipher(live->letters[i], machine.positions, compiled);
+            candidate->coincidences += 2UL * candidate->counts[c]++;
+        }
+        for (int r = 0; r < NUM_ROTORS; r++) {
+            candidate->positions[r] = (unsigned char)machine.positions[r];
+        }
+        candidate->score = pairs > 0.0 ? (double)candidate->coincidences / pairs : 0.0;
+    }
+}
+
+// Best score first; ties in key order so the ranking does not depend on threads
+static int compare_live(const void* a, const void* b) {
+    const LiveCandidate* x = (const LiveCandidate*)a;
+    const LiveCandidate* y = (const LiveCandidate*)b;
+
+    if (x->score != y->score) {
+        return x->score > y->score ? -1 : 1;
+    }
+    if (x->order != y->order) {
+        return x->order - y->order;
+    }
+    return memcmp(x->start, y->start, sizeof(x->start));
+}
+
+// --live: read letter groups from stdin, re-ranking after each
+void run_live(const EnigmaState* state, const RunOptions* options) {
+    LiveSearch live;
+    char* line = NULL;
+    size_t capacity = 0;
+    unsigned char* letters = NULL;
+    long length;
+
+    memset(&live, 0, sizeof(LiveSearch));
+    live.workers = options->threads > 0 ? options->threads : default_thread_count();
+    for (int o = 0; o < NUM_ROTOR_ORDERS; o++) {
+        live.orders[o] = *state;
+        apply_rotor_order(&live.orders[o], ROTOR_ORDERS[o]);
+        compile_machine(&live.orders[o], &live.compiled[o]);
+    }
+
+    live.count = (size_t)NUM_ROTOR_ORDERS * NUM_POSITIONS;
+    live.candidates = (LiveCandidate*)memory_calloc(MEM_SEARCH, live.count, sizeof(LiveCandidate));
+    if (!live.candidates) {
+        fprintf(stderr, "Error: Out of memory for live candidates\n");
+        exit(1);
+    }
+    for (size_t k = 0; k < live.count; k++) {
+        LiveCandidate* candidate = &live.candidates[k];
+        unsigned int p = (unsigned int)(k % NUM_POSITIONS);
+
+        candidate->order = (unsigned char)(k / NUM_POSITIONS);
+        candidate->start[2] = (unsigned char)(p / (ALPHABET_SIZE * ALPHABET_SIZE));
+        candidate->start[1] = (unsigned char)(p / ALPHABET_SIZE % ALPHABET_SIZE);
+        candidate->start[0] = (unsigned char)(p % ALPHABET_SIZE);
+        memcpy(candidate->positions, candidate->start, sizeof(candidate->positions));
+    }
+
+    while ((length = read_line(stdin, &line, &capacity)) >= 0) {
+        letters = (unsigned char*)memory_realloc(MEM_SEARCH, letters, (size_t)length + 1);
+        if (!letters) {
+            fprintf(stderr, "Error: Out of memory reading intercept\n");
+            exit(1);
+        }
+        live.letters = letters;
+        live.length = (size_t)letters_of(line, letters, (int)length);
+        if (live.length == 0) {
+            continue;
+        }
+        live.total += (unsigned long)live.length;
+
+        run_workers(live.workers, live_worker, &live);
+        qsort(live.candidates, live.count, sizeof(LiveCandidate), compare_live);
+        if (live.total >= LIVE_WARMUP) {
+            unsigned long halvings = (live.total - LIVE_WARMUP) / LIVE_HALVING + 1;
+            size_t keep = halvings < 32 ? ((size_t)NUM_ROTOR_ORDERS * NUM_POSITIONS) >> halvings : 0;
+            if (keep < LIVE_MIN_SURVIVORS) {
+                keep = LIVE_MIN_SURVIVORS;
+            }
+            if (keep < live.count) {
+                live.count = keep;
+            }
+        }
+
+        printf("%lu letters, %lu candidates\n", live.total, (unsigned long)live.count);
+        for (size_t k = 0; k < live.count && k < LIVE_SHOW; k++) {
+            EnigmaState machine = live.orders[live.candidates[k].order];
+            char key[64];
+
+            for (int r = 0; r < NUM_ROTORS; r++) {
+                machine.positions[r] = live.candidates[k].start[r];
+            }
+            format_key_options(&machine, key, sizeof(key));
+            printf("  %lu. %s  IoC %.5f\n", (unsigned long)k + 1, key, live.candidates[k].score);
+        }
+        fflush(stdout);
+    }
+
+    memory_free(letters);
+    memory_free(line);
+    memory_free(live.candidates);
+}
+
+// Turnover analysis
+//
+// Moving a rotor's ring setting and start position by the same amount
+// leaves the wiring offset of every letter alone and only moves the notch,
+// that is, where the next rotor to the left turns over. A key whose offsets
+// are right but whose rings are not decrypts correctly up to the first
+// misplaced turnover and to garbage after it. The analysis tries every
+// turnover phase of the right and middle rotors around the -o/-g/-p/-b key,
+// scores each decrypt by its bigram IoC (or with the --scorer plug-in), and
+// for the best phase lists where the middle and left rotors step, the IoC of
+// every stretch between two middle-rotor steps, and that of every position
+// class (the letters enciphered with the right rotor at one position, i.e.
+// mod 26).
+
+#define TURNOVER_PHASES (ALPHABET_SIZE * ALPHABET_SIZE)
+#define TURNOVER_SHOW 5                 // Phases listed with their turnovers
+#define TURNOVER_LIST 12                // Turnover offsets listed per phase
+
+typedef struct {
+    const EnigmaState* base;
+    const unsigned char* cipher;
+    size_t length;
+    int workers;
+    ScoreFunc scorer;                   // Plug-in (NULL = bigram IoC)
+    double scores[TURNOVER_PHASES];     // By phase: middle shift * 26 + right shift
+} TurnoverScan;
+
+// The key with the right rotor's turnover moved by phase % 26 letters and
+// the middle rotor's by phase / 26
+static EnigmaState turnover_key(const EnigmaState* base, int phase) {
+    EnigmaState machine = *base;
+
+    for (int slot = 0; slot < 2; slot++) {
+        int shift = slot == 0 ? phase % ALPHABET_SIZE : phase / ALPHABET_SIZE;
+        machine.ring_settings[slot] = mod_positive(machine.ring_settings[slot] + shift);
+        machine.positions[slot] = mod_positive(machine.positions[slot] + shift);
+    }
+    return machine;
+}
+
+// Each worker takes whole middle-rotor phases: 26 right-rotor phases that
+// are scored together when a plug-in scores them
+static void turnover_worker(void* context, int worker) {
+    TurnoverScan* scan = (TurnoverScan*)context;
+    unsigned long bigrams[ALPHABET_SIZE * ALPHABET_SIZE];
+    unsigned char* letters = NULL;
+
+    if (scan->scorer) {
+        letters = (unsigned char*)memory_alloc(MEM_SEARCH, scan->length * ALPHABET_SIZE);
+        if (!letters) {
+            fprintf(stderr, "Error: Out of memory in turnover analysis\n");
+            exit(1);
+        }
+    }
+
+    for (int middle = worker; middle < ALPHABET_SIZE; middle += scan->workers) {
+        for (int right = 0; right < ALPHABET_SIZE; right++) {
+            EnigmaState machine = turnover_key(scan->base, middle * ALPHABET_SIZE + right);
+            CompiledMachine compiled;
+            int previous = -1;
+
+            compile_machine(&machine, &compiled);
+            memset(bigrams, 0, sizeof(bigrams));
+            for (size_t i = 0; i < scan->length; i++) {
+                step_rotors(&machine);
+                int c = compiled_encipher(scan->cipher[i], machine.positions, &compiled);
+                if (letters) {
+                    letters[i * ALPHABET_SIZE + right] = (unsigned char)c;
+                } else if (previous >= 0) {
+                    bigrams[previous * ALPHABET_SIZE + c]++;
+                }
+                previous = c;
+            }
+            if (!letters) {
+                scan->scores[middle * ALPHABET_SIZE + right] = bigram_ioc_score(bigrams);
+            }
+        }
+        if (letters) {
+            scan->scorer(letters, (int)scan->length, ALPHABET_SIZE, scan->scores + middle * ALPHABET_SIZE);
+        }
+        UNIGMA_PROBE3(search__unit, "turnover", middle, worker);
+    }
+    memory_free(letters);
+}
+
+// Letter numbers (from 1) at which slot's rotor steps, printed as a list
+static void print_turnovers(const char* label, const EnigmaState* key, size_t length, int slot) {
+    EnigmaState machine = *key;
+    int listed = 0;
+
+    printf("    %s steps at", label);
+    for (size_t i = 0; i < length; i++) {
+        int before = machine.positions[slot];
+        step_rotors(&machine);
+        if (machine.positions[slot] != before) {
+            if (listed++ < TURNOVER_LIST) {
+                printf(" %lu", (unsigned long)i + 1);
+            }
+        }
+    }
+    if (listed > TURNOVER_LIST) {
+        printf(" ... (%d in all)", listed);
+    } else if (listed == 0) {
+        printf(" none");
+    }
+    printf("\n");
+}
+
+void run_turnover(const EnigmaState* state, const RunOptions* options) {
+    TurnoverScan scan;
+    int order[TURNOVER_PHASES];
+    unsigned char* cipher;
+    size_t length;
+
+    cipher = read_attack_message(options->path, &length);
+    if (length == 0) {
+        fprintf(stderr, "Error: No letters in '%s'\n", options->path);
+        exit(1);
+    }
+
+    scan.base = state;
+    scan.cipher = cipher;
+    scan.length = length;
+    scan.scorer = options->scorer;
+    scan.workers = options->threads > 0 ? options->threads : default_thread_count();
+    if (scan.workers > ALPHABET_SIZE) {
+        scan.workers = ALPHABET_SIZE;
+    }
+    run_workers(scan.workers, turnover_worker, &scan);
+
+    // Rank the phases; ties keep the key as given (phase 0) first
+    for (int p = 0; p < TURNOVER_PHASES; p++) {
+        int k = p;
+        while (k > 0 && scan.scores[order[k - 1]] < scan.scores[p]) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = p;
+    }
+
+    printf("Turnover phases on %lu letters (%s, as given %.5f):\n",
+           (unsigned long)length, scan.scorer ? "plug-in score" : "bigram IoC", scan.scores[0]);
+    for (int r = 0; r < TURNOVER_SHOW; r++) {
+        EnigmaState key = turnover_key(state, order[r]);
+        char options_text[64];
+
+        format_key_options(&key, options_text, sizeof(options_text));
+        printf("  %d. %s  score %.5f\n", r + 1, options_text, scan.scores[order[r]]);
+        print_turnovers("middle rotor", &key, length, 1);
+        print_turnovers("left rotor", &key, length, 2);
+    }
+
+    // Stretches between middle-rotor steps and position classes of the best phase
+    EnigmaState machine = turnover_key(state, order[0]);
+    CompiledMachine compiled;
+    unsigned long stretch[ALPHABET_SIZE];
+    unsigned long (*classes)[ALPHABET_SIZE] = (unsigned long (*)[ALPHABET_SIZE])
+        memory_calloc(MEM_SEARCH, ALPHABET_SIZE, sizeof(*classes));
+    size_t stretch_start = 0;
+
+    if (!classes) {
+        fprintf(stderr, "Error: Out of memory in turnover analysis\n");
+        exit(1);
+    }
+    compile_machine(&machine, &compiled);
+    memset(stretch, 0, sizeof(stretch));
+    printf("Stretches between middle-rotor steps (best phase):\n");
+    for (size_t i = 0; i <= length; i++) {
+        int middle = machine.positions[1];
+
+        if (i < length) {
+            step_rotors(&machine);
+        }
+        if (i == length || (machine.positions[1] != middle && i > stretch_start)) {
+            printf("  letters %lu-%lu  IoC %.5f\n", (unsigned long)stretch_start + 1,
+                   (unsigned long)i, ioc_score(stretch));
+            memset(stretch, 0, sizeof(stretch));
+            stretch_start = i;
+        }
+        if (i < length) {
+            int c = compiled_encipher(cipher[i], machine.positions, &compiled);
+            stretch[c]++;
+            classes[machine.positions[0]][c]++;
+        }
+    }
+    printf("Position classes (right rotor position: IoC):\n ");
+    for (int r = 0; r < ALPHABET_SIZE; r++) {
+        printf(" %c:%.3f", 'A' + r, ioc_score(classes[r]));
+        if (r % 9 == 8) {
+            printf("\n ");
+        }
+    }
+    printf("\n");
+
+    memory_free(classes);
+    memory_free(cipher);
+}
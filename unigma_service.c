@@ -0,0 +1,1167 @@
+/*
+ * Program Name: Unigma
+ * Program Release Year: 2025
+ * Program Author: Steven S.
+ * Program Link: https://github.com/BitEU/Unigma
+ * Purpose: Request service for Unigma - keyed requests answered as they arrive, with traffic capture and replay
+ */
+
+#include "unigma.h"
+
+// The service
+//
+// --serve reads keyed requests (the -k line format, KEY<TAB>TEXT) from stdin
+// and answers each one as soon as it is done, instead of waiting for a window
+// of records to fill. A response is "ID<TAB>OK<TAB>TEXT" or "ID<TAB>ERR<TAB>
+// reason", where ID is the request's line number; with several workers the
+// responses come back in completion order.
+//
+// The reader hands requests to the workers through a fixed ring of request
+// slots, so a slow consumer pushes back on the reader instead of growing
+// memory. With one worker (and always on UNIVAC) the reader answers each
+// request itself.
+//
+// --busy-poll trades cores for latency: the threads are pinned and spin on
+// the ring instead of sleeping, so no request waits for a wakeup, and all
+// request slots and key cache tables are allocated, touched and (where the
+// platform allows) locked in memory up front. Requests up to SERVICE_PREFAULT
+// bytes then allocate nothing and make no system calls on their way through,
+// apart from writing the response.
+//
+// Admission control
+//
+// Under overload a queue that takes everything makes every request slow. Two
+// limits answer "ID<TAB>BUSY<TAB>reason" at once instead, so a client can
+// back off or retry elsewhere:
+//
+// --latency-target US sheds on queueing delay, CoDel style. Each worker
+// tracks how long its requests sat in the queue (sojourn time). Once that
+// has stayed above the target for a whole interval (SERVICE_CODEL_INTERVALS
+// targets), the worker answers BUSY instead of encrypting, at a rate that
+// rises with the square root of the number shed, until a request gets
+// through within the target again. Short bursts pass; standing queues drain.
+//
+// --tenant-quota N caps the requests one tenant can have queued or in
+// service; a tenant is a key field, so a client's batch under one key cannot
+// fill the queue ahead of interactive users of other keys. The reader
+// answers BUSY for requests over the quota without queueing them.
+//
+// Capture log
+//
+// --capture FILE records the traffic the service sees: "UNIGMATC", then the
+// version and flags, then one record per request or new key, every number a
+// little-endian base-128 varint:
+//
+//   'K' id length bytes               key text, sent before its first use
+//   'R' delay id length [payload]     request: microseconds since the previous
+//                                     request, key id (0 = no valid key field)
+//                                     and payload length without the newline
+//
+// Payloads are only stored with --capture-payload. The log is buffered and
+// key texts are stored once, so capture costs a few bytes per request.
+
+#define CAPTURE_FLAG_PAYLOADS 1u
+
+#define SERVICE_CODEL_INTERVALS 20  // CoDel interval, in latency targets (5 ms / 100 ms)
+#define SERVICE_TENANTS 4096        // Tenant load counters; tenants are hashed onto them
+
+static const char CAPTURE_MAGIC[8] = { 'U', 'N', 'I', 'G', 'M', 'A', 'T', 'C' };
+
+// Text replayed in place of payloads the capture did not keep
+static const char REPLAY_FILLER[] = "THEQUICKBROWNFOXJUMPSOVERTHELAZYDOG";
+
+typedef struct {
+    unsigned long id;               // Request number, from 1
+    unsigned long long arrival;     // Microseconds: when it arrived (or was due, in replay)
+    char* line;
+    size_t length;
+    size_t capacity;
+    int tenant;                     // Tenant load counter, or -1 when not counted
+} ServiceRequest;
+
+// Shedding state of one worker (CoDel)
+typedef struct {
+    unsigned long long first_above; // When a sojourn above target becomes persistent (0 = below)
+    unsigned long long drop_next;   // When to shed the next request while shedding
+    unsigned long count;            // Requests shed in the current shedding run
+    int dropping;
+} ServiceCodel;
+
+typedef struct Service Service;
+
+// Fill in the next request; returns -1 when there are no more
+typedef int (*ServiceSource)(Service* service, ServiceRequest* request);
+
+struct Service {
+    const EnigmaState* base;
+    int workers;
+    int busy_poll;                  // Spin instead of sleeping on the ring
+    FILE* out;                      // Responses, or NULL to drop them (replay)
+    ServiceSource source;
+    void* source_context;
+    ServiceRequest* slots;          // SERVICE_QUEUE request slots
+    int* pending;                   // Ring of slots waiting for a worker
+    int pending_head;
+    int pending_count;
+    int* idle;                      // Stack of free slots
+    int idle_count;
+    int closed;
+    unsigned long next_id;
+    unsigned long long latency_target;  // Microseconds, 0 = no shedding on delay
+    int tenant_quota;               // 0 = no tenant quota
+    int* tenant_load;               // SERVICE_TENANTS counters of queued and running requests
+    unsigned long quota_shed;       // Requests refused over their tenant's quota
+    unsigned long full_waits;       // Reader waits (or spins) for a free slot
+    unsigned long empty_waits;      // Worker waits (or spins) for a request
+#ifndef UNIVAC
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE work;        // A request is pending or the input ended
+    CONDITION_VARIABLE space;       // A slot was freed
+    CRITICAL_SECTION output;
+#endif
+    KeyCache* caches;               // Per worker, like keyed record mode
+    LatencyHistogram* latency;      // Per worker
+    unsigned long* served;          // Per worker
+    unsigned long* errors;          // Per worker
+    ServiceCodel* codel;            // Per worker
+    unsigned long* served_out;      // Where to copy served[] at the end, or NULL
+    unsigned long* shed;            // Per worker: requests refused on queueing delay
+};
+
+typedef struct {
+    char* text;
+    size_t length;
+    unsigned long hash;
+    unsigned long id;
+} CaptureKey;
+
+typedef struct {
+    FILE* out;
+    int payloads;
+    unsigned long long last;        // Arrival of the previous request
+    unsigned long requests;
+    unsigned char* buffer;
+    size_t used;
+    CaptureKey* keys;               // Open addressing on the key text
+    size_t key_slots;
+    unsigned long key_count;
+    unsigned long long bytes;
+} TrafficCapture;
+
+typedef struct {
+    unsigned long long time;        // Microseconds after the first request
+    unsigned long key;
+    size_t length;
+    long payload;                   // Offset into the payload store, or -1
+} ReplayRecord;
+
+typedef struct {
+    char** keys;                    // Key text by id (index 0 unused)
+    unsigned long key_count;
+    ReplayRecord* records;
+    size_t count;
+    unsigned char* data;            // The whole file; payloads point into it
+} TrafficLog;
+
+typedef struct {
+    const TrafficLog* log;
+    double speed;
+    unsigned long long start;
+    size_t next;
+    unsigned long long letters;
+} Replay;
+
+// Encrypt one keyed request in place: parse its key, find the compiled
+// tables in the worker's cache and run the payload through them. Returns 0,
+// or -1 if the key field is malformed.
+int service_handle(KeyCache* cache, const EnigmaState* base, char* line, size_t length, size_t* payload) {
+    EnigmaState machine;
+    CanonicalKey key;
+
+    if (parse_record_key(line, length, base, &machine, payload) != 0) {
+        return -1;
+    }
+    canonical_key(&machine, &key);
+    FusedTables* tables = key_cache_lookup(cache, &key, &machine);
+
+    char* text = line + *payload;
+    size_t text_length = length - *payload;
+    encrypt_record_batch(tables, &text, &text_length, 1);
+    return 0;
+}
+
+// Latency histogram
+
+static int latency_bucket(unsigned long long microseconds) {
+    int octave = 0;
+
+    if (microseconds < 8) {
+        return (int)microseconds;
+    }
+    while ((microseconds >> octave) >= 16) {
+        octave++;
+    }
+    int bucket = (octave + 1) * 8 + (int)((microseconds >> octave) & 7);
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+// Smallest value that falls in a bucket
+static unsigned long long latency_bucket_floor(int bucket) {
+    if (bucket < 8) {
+        return (unsigned long long)bucket;
+    }
+    int octave = bucket / 8 - 1;
+    return (unsigned long long)(8 + bucket % 8) << octave;
+}
+
+void latency_record(LatencyHistogram* histogram, unsigned long long microseconds) {
+    histogram->count[latency_bucket(microseconds)]++;
+    histogram->samples++;
+    if (microseconds > histogram->max) {
+        histogram->max = microseconds;
+    }
+}
+
+void latency_merge(LatencyHistogram* into, const LatencyHistogram* from) {
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        into->count[i] += from->count[i];
+    }
+    into->samples += from->samples;
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+}
+
+// Latency below which the given percentage of samples fall (bucket floor)
+unsigned long long latency_percentile(const LatencyHistogram* histogram, double percentile) {
+    unsigned long long rank = (unsigned long long)((double)histogram->samples * percentile / 100.0);
+    unsigned long long seen = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram->count[i];
+        if (seen > rank) {
+            unsigned long long floor = latency_bucket_floor(i);
+            return floor < histogram->max ? floor : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+// Capture log writer
+
+static void capture_flush(TrafficCapture* capture) {
+    if (capture->used > 0 && fwrite(capture->buffer, 1, capture->used, capture->out) != capture->used) {
+        fprintf(stderr, "Error: Could not write traffic capture\n");
+        exit(1);
+    }
+    capture->used = 0;
+}
+
+static void capture_put(TrafficCapture* capture, const void* bytes, size_t length) {
+    if (capture->used + length > CAPTURE_BUFFER) {
+        capture_flush(capture);
+    }
+    if (length > CAPTURE_BUFFER) {
+        if (fwrite(bytes, 1, length, capture->out) != length) {
+            fprintf(stderr, "Error: Could not write traffic capture\n");
+            exit(1);
+        }
+    } else {
+        memcpy(capture->buffer + capture->used, bytes, length);
+        capture->used += length;
+    }
+    capture->bytes += length;
+}
+
+static void capture_varint(TrafficCapture* capture, unsigned long long value) {
+    unsigned char bytes[10];
+    size_t length = 0;
+
+    do {
+        bytes[length] = (unsigned char)(value & 0x7F);
+        value >>= 7;
+        if (value) {
+            bytes[length] |= 0x80;
+        }
+        length++;
+    } while (value);
+    capture_put(capture, bytes, length);
+}
+
+static void open_capture(TrafficCapture* capture, const char* path, int payloads) {
+    memset(capture, 0, sizeof(TrafficCapture));
+    capture->out = fopen(path, "wb");
+    capture->payloads = payloads;
+    capture->buffer = (unsigned char*)memory_alloc(MEM_IO, CAPTURE_BUFFER);
+    capture->key_slots = 64;
+    capture->keys = (CaptureKey*)memory_calloc(MEM_IO, capture->key_slots, sizeof(CaptureKey));
+
+    if (!capture->out) {
+        fprintf(stderr, "Error: Could not create traffic capture '%s'\n", path);
+        exit(1);
+    }
+    if (!capture->buffer || !capture->keys) {
+        fprintf(stderr, "Error: Out of memory for traffic capture\n");
+        exit(1);
+    }
+
+    capture_put(capture, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    capture_varint(capture, CAPTURE_VERSION);
+    capture_varint(capture, payloads ? CAPTURE_FLAG_PAYLOADS : 0);
+}
+
+static unsigned long hash_key_text(const char* text, size_t length) {
+    unsigned long hash = 2166136261UL;
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619UL;
+    }
+    return hash & 0xFFFFFFFFUL;
+}
+
+// Id of a key text, writing a 'K' record the first time it is seen
+static unsigned long capture_key_id(TrafficCapture* capture, const char* text, size_t length) {
+    unsigned long hash = hash_key_text(text, length);
+    size_t mask = capture->key_slots - 1;
+    size_t slot = hash & mask;
+
+    while (capture->keys[slot].text) {
+        CaptureKey* key = &capture->keys[slot];
+        if (key->hash == hash && key->length == length && memcmp(key->text, text, length) == 0) {
+            return key->id;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    CaptureKey* key = &capture->keys[slot];
+    key->text = (char*)memory_alloc(MEM_IO, length + 1);
+    if (!key->text) {
+        fprintf(stderr, "Error: Out of memory for traffic capture\n");
+        exit(1);
+    }
+    memcpy(key->text, text, length);
+    key->text[length] = '\0';
+    key->length = length;
+    key->hash = hash;
+    key->id = ++capture->key_count;
+
+    capture_put(capture, "K", 1);
+    capture_varint(capture, key->id);
+    capture_varint(capture, length);
+    capture_put(capture, text, length);
+    unsigned long id = key->id;
+
+    // Keep the table at most half full
+    if (capture->key_count * 2 > capture->key_slots) {
+        CaptureKey* old = capture->keys;
+        size_t old_slots = capture->key_slots;
+
+        capture->key_slots *= 2;
+        capture->keys = (CaptureKey*)memory_calloc(MEM_IO, capture->key_slots, sizeof(CaptureKey));
+        if (!capture->keys) {
+            fprintf(stderr, "Error: Out of memory for traffic capture\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < old_slots; i++) {
+            if (old[i].text) {
+                size_t s = old[i].hash & (capture->key_slots - 1);
+                while (capture->keys[s].text) {
+                    s = (s + 1) & (capture->key_slots - 1);
+                }
+                capture->keys[s] = old[i];
+            }
+        }
+        memory_free(old);
+    }
+    return id;
+}
+
+static void capture_request(TrafficCapture* capture, const ServiceRequest* request) {
+    size_t tab = 0;
+    size_t end = request->length;
+    unsigned long key = 0;
+
+    while (tab < request->length && request->line[tab] != '\t') {
+        tab++;
+    }
+    if (end > 0 && request->line[end - 1] == '\n') {
+        end--;
+    }
+
+    size_t start = 0;
+    if (tab < request->length) {
+        key = capture_key_id(capture, request->line, tab);
+        start = tab + 1;
+    }
+    if (start > end) {
+        start = end;
+    }
+
+    capture_put(capture, "R", 1);
+    capture_varint(capture, capture->requests > 0 && request->arrival > capture->last
+                                ? request->arrival - capture->last : 0);
+    capture_varint(capture, key);
+    capture_varint(capture, end - start);
+    if (capture->payloads) {
+        capture_put(capture, request->line + start, end - start);
+    }
+    capture->last = request->arrival;
+    capture->requests++;
+}
+
+static void close_capture(TrafficCapture* capture) {
+    capture_flush(capture);
+    if (fclose(capture->out) != 0) {
+        fprintf(stderr, "Error: Could not write traffic capture\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < capture->key_slots; i++) {
+        memory_free(capture->keys[i].text);
+    }
+    memory_free(capture->keys);
+    memory_free(capture->buffer);
+}
+
+// Capture log reader
+
+static int read_varint(const unsigned char* data, size_t size, size_t* at, unsigned long long* value) {
+    int shift = 0;
+
+    *value = 0;
+    while (*at < size && shift < 64) {
+        unsigned char byte = data[(*at)++];
+        *value |= (unsigned long long)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+static int load_traffic_log(const char* path, TrafficLog* log) {
+    FILE* in = fopen(path, "rb");
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t record_capacity = 0;
+    size_t key_capacity = 0;
+    unsigned long long value;
+    unsigned long long time = 0;
+    int payloads;
+
+    memset(log, 0, sizeof(TrafficLog));
+    if (!in) {
+        return -1;
+    }
+    for (;;) {
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : CAPTURE_BUFFER;
+            unsigned char* grown = (unsigned char*)memory_realloc(MEM_IO, log->data, capacity);
+            if (!grown) {
+                fclose(in);
+                return -1;
+            }
+            log->data = grown;
+        }
+        size_t got = fread(log->data + size, 1, capacity - size, in);
+        if (got == 0) {
+            break;
+        }
+        size += got;
+    }
+    fclose(in);
+
+    size_t at = sizeof(CAPTURE_MAGIC);
+    if (size < at || memcmp(log->data, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 ||
+        read_varint(log->data, size, &at, &value) != 0 || value != CAPTURE_VERSION ||
+        read_varint(log->data, size, &at, &value) != 0) {
+        return -1;
+    }
+    payloads = (value & CAPTURE_FLAG_PAYLOADS) != 0;
+
+    while (at < size) {
+        unsigned char tag = log->data[at++];
+        unsigned long long id;
+        unsigned long long length;
+
+        if (tag == 'K') {
+            if (read_varint(log->data, size, &at, &id) != 0 || id != log->key_count + 1 ||
+                read_varint(log->data, size, &at, &length) != 0 || length > size - at) {
+                return -1;
+            }
+            if (log->key_count + 1 >= key_capacity) {
+                key_capacity = key_capacity ? key_capacity * 2 : 64;
+                char** grown = (char**)memory_realloc(MEM_IO, log->keys, key_capacity * sizeof(char*));
+                if (!grown) {
+                    return -1;
+                }
+                log->keys = grown;
+            }
+            char* text = (char*)memory_alloc(MEM_IO, (size_t)length + 1);
+            if (!text) {
+                return -1;
+            }
+            memcpy(text, log->data + at, (size_t)length);
+            text[length] = '\0';
+            log->keys[++log->key_count] = text;
+            at += (size_t)length;
+        } else if (tag == 'R') {
+            unsigned long long delay;
+            if (read_varint(log->data, size, &at, &delay) != 0 ||
+                read_varint(log->data, size, &at, &id) != 0 || id > log->key_count ||
+                read_varint(log->data, size, &at, &length) != 0 ||
+                (payloads && length > size - at)) {
+                return -1;
+            }
+            if (log->count == record_capacity) {
+                record_capacity = record_capacity ? record_capacity * 2 : 1024;
+                ReplayRecord* grown = (ReplayRecord*)memory_realloc(MEM_IO, log->records, record_capacity * sizeof(ReplayRecord));
+                if (!grown) {
+                    return -1;
+                }
+                log->records = grown;
+            }
+            ReplayRecord* record = &log->records[log->count++];
+            time += delay;
+            record->time = time;
+            record->key = (unsigned long)id;
+            record->length = (size_t)length;
+            record->payload = payloads ? (long)at : -1;
+            if (payloads) {
+                at += (size_t)length;
+            }
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void free_traffic_log(TrafficLog* log) {
+    for (unsigned long i = 1; i <= log->key_count; i++) {
+        memory_free(log->keys[i]);
+    }
+    memory_free(log->keys);
+    memory_free(log->records);
+    memory_free(log->data);
+    memset(log, 0, sizeof(TrafficLog));
+}
+
+// Request processing
+
+static void service_busy(Service* service, const ServiceRequest* request, const char* reason) {
+    if (service->out) {
+#ifndef UNIVAC
+        EnterCriticalSection(&service->output);
+#endif
+        fprintf(service->out, "%lu\tBUSY\t%s\n", request->id, reason);
+        fflush(service->out);
+#ifndef UNIVAC
+        LeaveCriticalSection(&service->output);
+#endif
+    }
+}
+
+static unsigned long long isqrt(unsigned long long n) {
+    unsigned long long root = n;
+
+    if (n < 2) {
+        return n;
+    }
+    for (unsigned long long next = (root + 1) / 2; next < root; next = (root + n / root) / 2) {
+        root = next;
+    }
+    return root;
+}
+
+// CoDel's decision for a request that waited sojourn microseconds in the
+// queue: whether to shed it
+static int codel_shed(const Service* service, ServiceCodel* codel, unsigned long long now,
+                      unsigned long long sojourn) {
+    unsigned long long interval = service->latency_target * SERVICE_CODEL_INTERVALS;
+    int above = 0;
+
+    if (sojourn < service->latency_target) {
+        codel->first_above = 0;
+    } else if (codel->first_above == 0) {
+        codel->first_above = now + interval;
+    } else if (now >= codel->first_above) {
+        above = 1;
+    }
+
+    if (codel->dropping) {
+        if (!above) {
+            codel->dropping = 0;
+            return 0;
+        }
+        if (now < codel->drop_next) {
+            return 0;
+        }
+        codel->count++;
+        codel->drop_next += interval / isqrt(codel->count);
+        return 1;
+    }
+    if (!above) {
+        return 0;
+    }
+    // Start shedding, picking up near the last run's rate if it ended recently
+    codel->dropping = 1;
+    codel->count = codel->count > 2 && now - codel->drop_next < 8 * interval ? codel->count - 2 : 1;
+    codel->drop_next = now + interval / isqrt(codel->count);
+    return 1;
+}
+
+static void service_process(Service* service, int worker, ServiceRequest* request) {
+    size_t payload = 0;
+
+    UNIGMA_PROBE3(service__dequeue, request->id, worker, request->arrival);
+
+    if (service->latency_target) {
+        unsigned long long now = clock_microseconds();
+        if (codel_shed(service, &service->codel[worker], now, now > request->arrival ? now - request->arrival : 0)) {
+            service_busy(service, request, "queue delay over target");
+            service->shed[worker]++;
+            return;
+        }
+    }
+
+    int ok = service_handle(&service->caches[worker], service->base, request->line, request->length, &payload) == 0;
+
+    if (service->out) {
+#ifndef UNIVAC
+        EnterCriticalSection(&service->output);
+#endif
+        if (ok) {
+            fprintf(service->out, "%lu\tOK\t", request->id);
+            fwrite(request->line + payload, 1, request->length - payload, service->out);
+            if (request->length == payload || request->line[request->length - 1] != '\n') {
+                fputc('\n', service->out);
+            }
+        } else {
+            fprintf(service->out, "%lu\tERR\tbad key\n", request->id);
+        }
+        fflush(service->out);
+#ifndef UNIVAC
+        LeaveCriticalSection(&service->output);
+#endif
+    }
+
+    unsigned long long done = clock_microseconds();
+    latency_record(&service->latency[worker], done > request->arrival ? done - request->arrival : 0);
+    if (ok) {
+        service->served[worker]++;
+    } else {
+        service->errors[worker]++;
+    }
+}
+
+#ifndef UNIVAC
+// Tenant of a request: its key field, hashed onto the load counters
+static int service_tenant(const ServiceRequest* request) {
+    const char* tab = (const char*)memchr(request->line, '\t', request->length);
+    size_t length = tab ? (size_t)(tab - request->line) : 0;
+
+    return (int)(hash_key_text(request->line, length) % SERVICE_TENANTS);
+}
+
+// Wait on a condition with the lock held. Busy polling drops the lock and
+// spins briefly instead, so the waiter notices new work without a wakeup.
+static void service_wait(Service* service, CONDITION_VARIABLE* condition) {
+    if (service->busy_poll) {
+        LeaveCriticalSection(&service->lock);
+        YieldProcessor();
+        EnterCriticalSection(&service->lock);
+    } else {
+        SleepConditionVariableCS(condition, &service->lock, INFINITE);
+    }
+}
+
+static void service_wake(Service* service, CONDITION_VARIABLE* condition, int all) {
+    if (service->busy_poll) {
+        return;  // Nobody sleeps
+    }
+    if (all) {
+        WakeAllConditionVariable(condition);
+    } else {
+        WakeConditionVariable(condition);
+    }
+}
+
+// Thread 0 reads requests into free slots; threads 1..workers answer them
+static void service_thread(void* context, int thread) {
+    Service* service = (Service*)context;
+    unsigned long long previous = 0;
+
+    if (service->busy_poll) {
+        previous = pin_current_thread(thread);
+    }
+
+    if (thread == 0) {
+        for (;;) {
+            EnterCriticalSection(&service->lock);
+            while (service->idle_count == 0) {
+                service->full_waits++;
+                service_wait(service, &service->space);
+            }
+            int slot = service->idle[--service->idle_count];
+            LeaveCriticalSection(&service->lock);
+
+            ServiceRequest* request = &service->slots[slot];
+            int more = service->source(service, request) == 0;
+            int refused = 0;
+
+            request->tenant = more && service->tenant_quota ? service_tenant(request) : -1;
+
+            EnterCriticalSection(&service->lock);
+            if (more && request->tenant >= 0 && service->tenant_load[request->tenant] >= service->tenant_quota) {
+                // Only this thread takes idle slots, so the request stays
+                // intact until the refusal below is written
+                request->id = ++service->next_id;
+                service->idle[service->idle_count++] = slot;
+                service->quota_shed++;
+                refused = 1;
+            } else if (more) {
+                request->id = ++service->next_id;
+                if (request->tenant >= 0) {
+                    service->tenant_load[request->tenant]++;
+                }
+                service->pending[(service->pending_head + service->pending_count) % SERVICE_QUEUE] = slot;
+                service->pending_count++;
+                UNIGMA_PROBE3(service__enqueue, request->id, service->pending_count, request->tenant);
+                service_wake(service, &service->work, 0);
+            } else {
+                service->idle[service->idle_count++] = slot;
+                service->closed = 1;
+                service_wake(service, &service->work, 1);
+            }
+            LeaveCriticalSection(&service->lock);
+            if (refused) {
+                service_busy(service, request, "tenant over quota");
+            }
+            if (!more) {
+                restore_thread_affinity(previous);  // Thread 0 is the caller's
+                return;
+            }
+        }
+    }
+
+    int worker = thread - 1;
+    for (;;) {
+        EnterCriticalSection(&service->lock);
+        while (service->pending_count == 0 && !service->closed) {
+            service->empty_waits++;
+            service_wait(service, &service->work);
+        }
+        if (service->pending_count == 0) {
+            LeaveCriticalSection(&service->lock);
+            return;
+        }
+        int slot = service->pending[service->pending_head];
+        service->pending_head = (service->pending_head + 1) % SERVICE_QUEUE;
+        service->pending_count--;
+        LeaveCriticalSection(&service->lock);
+
+        service_process(service, worker, &service->slots[slot]);
+
+        EnterCriticalSection(&service->lock);
+        if (service->slots[slot].tenant >= 0) {
+            service->tenant_load[service->slots[slot].tenant]--;
+        }
+        service->idle[service->idle_count++] = slot;
+        service_wake(service, &service->space, 0);
+        LeaveCriticalSection(&service->lock);
+    }
+}
+#endif
+
+// Lock a buffer in memory, counting what was locked
+static void prefault_buffer(void* block, size_t size, size_t* bytes, int* locked) {
+    memset(block, 0, size);  // Touch every page now rather than on the first request
+    *bytes += size;
+    if (lock_memory(block, size) != 0) {
+        *locked = 0;
+    }
+}
+
+// Allocate and touch everything the request path uses for requests up to
+// SERVICE_PREFAULT bytes: the request slot buffers and the tables of every
+// key cache entry. Evicted keys hand their tables to the next key, so the
+// tables are never allocated again.
+static void service_prefault(Service* service) {
+    size_t bytes = 0;
+    int locked = 1;
+
+    for (int i = 0; i < SERVICE_QUEUE; i++) {
+        ServiceRequest* request = &service->slots[i];
+        request->line = (char*)memory_alloc(MEM_IO, SERVICE_PREFAULT);
+        if (!request->line) {
+            fprintf(stderr, "Error: Out of memory starting the service\n");
+            exit(1);
+        }
+        request->capacity = SERVICE_PREFAULT;
+        prefault_buffer(request->line, SERVICE_PREFAULT, &bytes, &locked);
+    }
+
+    for (int w = 0; w < service->workers; w++) {
+        for (int e = 0; e < KEY_CACHE_SLOTS; e++) {
+            FusedTables* tables = &service->caches[w].entries[e].tables;
+            reserve_fused_tables(tables, SERVICE_PREFAULT);
+            prefault_buffer(tables->scrambler, tables->capacity * ALPHABET_SIZE, &bytes, &locked);
+            prefault_buffer(tables->fused, tables->capacity * (ALPHABET_SIZE + 1), &bytes, &locked);
+            prefault_buffer(tables->lanes, tables->capacity * RECORD_BATCH, &bytes, &locked);
+        }
+        if (lock_memory(&service->caches[w], sizeof(KeyCache)) != 0 ||
+            lock_memory(&service->latency[w], sizeof(LatencyHistogram)) != 0) {
+            locked = 0;
+        }
+    }
+    if (lock_memory(service->slots, SERVICE_QUEUE * sizeof(ServiceRequest)) != 0 ||
+        lock_memory(service->pending, SERVICE_QUEUE * sizeof(int)) != 0 ||
+        lock_memory(service->idle, SERVICE_QUEUE * sizeof(int)) != 0) {
+        locked = 0;
+    }
+
+    fprintf(stderr, "Service: %lu KB of request memory pre-faulted%s\n",
+            (unsigned long)(bytes >> 10), locked ? " and locked" : " (not locked in memory)");
+}
+
+// Run the service until its source runs dry, then add its counters to stats
+static void service_run(Service* service, RunStats* stats) {
+    int workers = service->workers;
+
+    service->slots = (ServiceRequest*)memory_calloc(MEM_SESSIONS, SERVICE_QUEUE, sizeof(ServiceRequest));
+    service->pending = (int*)memory_alloc(MEM_SESSIONS, SERVICE_QUEUE * sizeof(int));
+    service->idle = (int*)memory_alloc(MEM_SESSIONS, SERVICE_QUEUE * sizeof(int));
+    service->caches = (KeyCache*)memory_calloc(MEM_KEY_CACHE, (size_t)workers, sizeof(KeyCache));
+    service->latency = (LatencyHistogram*)memory_calloc(MEM_SESSIONS, (size_t)workers, sizeof(LatencyHistogram));
+    service->served = (unsigned long*)memory_calloc(MEM_SESSIONS, (size_t)workers, sizeof(unsigned long));
+    service->errors = (unsigned long*)memory_calloc(MEM_SESSIONS, (size_t)workers, sizeof(unsigned long));
+    service->codel = (ServiceCodel*)memory_calloc(MEM_SESSIONS, (size_t)workers, sizeof(ServiceCodel));
+    service->shed = (unsigned long*)memory_calloc(MEM_SESSIONS, (size_t)workers, sizeof(unsigned long));
+    service->tenant_load = (int*)memory_calloc(MEM_SESSIONS, SERVICE_TENANTS, sizeof(int));
+    if (!service->slots || !service->pending || !service->idle || !service->caches ||
+        !service->latency || !service->served || !service->errors || !service->codel ||
+        !service->shed || !service->tenant_load) {
+        fprintf(stderr, "Error: Out of memory starting the service\n");
+        exit(1);
+    }
+    memory_evictor(MEM_TABLES, 1);  // The caches keep the tables under their limit
+    for (int i = 0; i < SERVICE_QUEUE; i++) {
+        service->idle[i] = SERVICE_QUEUE - 1 - i;
+    }
+    service->idle_count = SERVICE_QUEUE;
+    if (service->busy_poll) {
+        service_prefault(service);
+    }
+
+#ifndef UNIVAC
+    if (workers > 1) {
+        InitializeCriticalSection(&service->lock);
+        InitializeCriticalSection(&service->output);
+        InitializeConditionVariable(&service->work);
+        InitializeConditionVariable(&service->space);
+        run_workers(workers + 1, service_thread, service);
+        DeleteCriticalSection(&service->lock);
+        DeleteCriticalSection(&service->output);
+    } else
+#endif
+    {
+        ServiceRequest* request = &service->slots[0];
+#ifndef UNIVAC
+        InitializeCriticalSection(&service->output);
+#endif
+        // Nothing queues here, so only the latency target can shed
+        while (service->source(service, request) == 0) {
+            request->id = ++service->next_id;
+            request->tenant = -1;
+            UNIGMA_PROBE3(service__enqueue, request->id, 0, request->tenant);
+            service_process(service, 0, request);
+        }
+#ifndef UNIVAC
+        DeleteCriticalSection(&service->output);
+#endif
+    }
+
+    for (int w = 0; w < workers; w++) {
+        if (service->served_out) {
+            service->served_out[w] = service->served[w];
+        }
+        latency_merge(&stats->latency, &service->latency[w]);
+        stats->requests += service->served[w] + service->errors[w] + service->shed[w];
+        stats->bad_keys += service->errors[w];
+        stats->shed_latency += service->shed[w];
+        stats->table_hits += service->caches[w].hits;
+        stats->table_misses += service->caches[w].misses;
+        free_key_cache(&service->caches[w]);
+    }
+    memory_evictor(MEM_TABLES, -1);
+    stats->requests += service->quota_shed;
+    stats->shed_quota += service->quota_shed;
+    stats->queue_full_waits += service->full_waits;
+    stats->queue_empty_waits += service->empty_waits;
+    for (int i = 0; i < SERVICE_QUEUE; i++) {
+        memory_free(service->slots[i].line);
+    }
+    memory_free(service->slots);
+    memory_free(service->pending);
+    memory_free(service->idle);
+    memory_free(service->caches);
+    memory_free(service->latency);
+    memory_free(service->served);
+    memory_free(service->errors);
+    memory_free(service->codel);
+    memory_free(service->shed);
+    memory_free(service->tenant_load);
+}
+
+static int service_workers(const RunOptions* options) {
+#ifdef UNIVAC
+    (void)options;
+    return 1;
+#else
+    if (!options->busy_poll) {
+        return options->threads > 0 ? options->threads : default_thread_count();
+    }
+
+    // Busy polling pins the reader and each worker to a processor of its
+    // own (thread % processors), so two spinners must never share one
+    int most = default_thread_count() > 1 ? default_thread_count() - 1 : 1;
+    if (options->threads > most) {
+        fprintf(stderr, "Error: With --busy-poll the reader and every worker need a processor of their own; "
+                "-t can be at most %d here\n", most);
+        exit(1);
+    }
+    return options->threads > 0 ? options->threads : most;
+#endif
+}
+
+// Admission control needs requests to queue. With one worker (always on
+// UNIVAC) each request is answered as it is read: there is no queue to hold
+// a tenant's requests, and the queueing delay is 0 unless replay paces the
+// arrivals (arrival is then the due time, so a late service can still shed).
+static void check_admission(const RunOptions* options, int workers, int paced) {
+    if (workers > 1) {
+        return;
+    }
+    if (options->tenant_quota) {
+        fprintf(stderr, "Error: --tenant-quota needs more than one service worker (-t 2 or more)\n");
+        exit(1);
+    }
+    if (options->latency_target && !paced) {
+        fprintf(stderr, "Error: --latency-target needs more than one service worker (-t 2 or more)%s\n",
+                options->mode == MODE_REPLAY ? " or a paced replay" : "");
+        exit(1);
+    }
+}
+
+// Request source for --serve: one line of stdin per request
+static int stdin_source(Service* service, ServiceRequest* request) {
+    TrafficCapture* capture = (TrafficCapture*)service->source_context;
+    long length = read_line(stdin, &request->line, &request->capacity);
+
+    if (length < 0) {
+        return -1;
+    }
+    request->length = (size_t)length;
+    request->arrival = clock_microseconds();
+    if (capture) {
+        capture_request(capture, request);
+    }
+    return 0;
+}
+
+// --serve [--busy-poll] [--latency-target US] [--tenant-quota N] [--capture FILE [--capture-payload]]
+void run_serve(const EnigmaState* state, const RunOptions* options, RunStats* stats) {
+    TrafficCapture capture;
+    Service service;
+
+    memset(&service, 0, sizeof(Service));
+    service.base = state;
+    service.workers = service_workers(options);
+    check_admission(options, service.workers, 0);
+    service.busy_poll = options->busy_poll;
+    service.latency_target = options->latency_target;
+    service.tenant_quota = options->tenant_quota;
+    service.out = stdout;
+    service.source = stdin_source;
+    if (options->capture_path) {
+        open_capture(&capture, options->capture_path, options->capture_payloads);
+        service.source_context = &capture;
+    }
+
+    service_run(&service, stats);
+
+    if (options->capture_path) {
+        close_capture(&capture);
+        stats->capture_bytes += capture.bytes;
+    }
+}
+
+static void ensure_capacity(ServiceRequest* request, size_t needed) {
+    if (needed > request->capacity) {
+        char* grown = (char*)memory_realloc(MEM_IO, request->line, needed);
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory replaying traffic\n");
+            exit(1);
+        }
+        request->line = grown;
+        request->capacity = needed;
+    }
+}
+
+// Request source for --replay: the captured requests, paced by their
+// captured arrival times divided by the speed factor. Latency is measured
+// from when a request was due, so a service that falls behind is charged
+// for the queueing it causes.
+static int replay_source(Service* service, ServiceRequest* request) {
+    Replay* replay = (Replay*)service->source_context;
+    const TrafficLog* log = replay->log;
+
+    if (replay->next == log->count) {
+        return -1;
+    }
+    const ReplayRecord* record = &log->records[replay->next++];
+    const char* key = record->key ? log->keys[record->key] : "";
+    size_t key_length = strlen(key);
+
+    ensure_capacity(request, key_length + record->length + 3);
+    memcpy(request->line, key, key_length);
+    size_t at = key_length;
+    if (record->key) {
+        request->line[at++] = '\t';
+    }
+    if (record->payload >= 0) {
+        memcpy(request->line + at, log->data + record->payload, record->length);
+    } else {
+        for (size_t i = 0; i < record->length; i++) {
+            request->line[at + i] = REPLAY_FILLER[i % (sizeof(REPLAY_FILLER) - 1)];
+        }
+    }
+    at += record->length;
+    request->line[at++] = '\n';
+    request->line[at] = '\0';
+    request->length = at;
+    replay->letters += record->length;
+
+    if (replay->speed > 0) {
+        request->arrival = replay->start + (unsigned long long)((double)record->time / replay->speed);
+        wait_until(request->arrival);
+    } else {
+        request->arrival = clock_microseconds();
+    }
+    return 0;
+}
+
+// --replay FILE [--speed X] [--busy-poll]: replay a capture against the in-process service
+// and report throughput and latency
+void run_replay(const EnigmaState* state, const RunOptions* options, RunStats* stats) {
+    TrafficLog log;
+    Replay replay;
+    Service service;
+    RunStats run;
+
+    if (load_traffic_log(options->path, &log) != 0) {
+        fprintf(stderr, "Error: '%s' is not a readable traffic capture\n", options->path);
+        exit(1);
+    }
+
+    memset(&replay, 0, sizeof(Replay));
+    replay.log = &log;
+    replay.speed = options->replay_speed;
+    memset(&service, 0, sizeof(Service));
+    service.base = state;
+    service.workers = service_workers(options);
+    check_admission(options, service.workers, options->replay_speed > 0.0);
+    service.busy_poll = options->busy_poll;
+    service.latency_target = options->latency_target;
+    service.tenant_quota = options->tenant_quota;
+    service.source = replay_source;
+    service.source_context = &replay;
+    memset(&run, 0, sizeof(RunStats));
+
+    replay.start = clock_microseconds();
+    service_run(&service, &run);
+    unsigned long long elapsed = clock_microseconds() - replay.start;
+    double seconds = elapsed > 0 ? (double)elapsed / 1e6 : 1e-6;
+
+    printf("Replayed %lu requests (%lu errors) in %.3f s with %d worker(s)",
+           run.requests, run.bad_keys, seconds, service.workers);
+    if (replay.speed > 0) {
+        printf(" at %gx speed\n", replay.speed);
+    } else {
+        printf(" at full speed\n");
+    }
+    if (run.shed_latency || run.shed_quota) {
+        printf("Shed: %lu over the latency target, %lu over tenant quota\n", run.shed_latency, run.shed_quota);
+    }
+    printf("Throughput: %.0f requests/s, %.0f letters/s\n",
+           (double)run.requests / seconds, (double)replay.letters / seconds);
+    printf("Latency (us): p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+           latency_percentile(&run.latency, 50.0), latency_percentile(&run.latency, 90.0),
+           latency_percentile(&run.latency, 99.0), latency_percentile(&run.latency, 99.9),
+           run.latency.max);
+
+    stats->requests += run.requests;
+    stats->bad_keys += run.bad_keys;
+    stats->shed_latency += run.shed_latency;
+    stats->shed_quota += run.shed_quota;
+    stats->queue_full_waits += run.queue_full_waits;
+    stats->queue_empty_waits += run.queue_empty_waits;
+    stats->table_hits += run.table_hits;
+    stats->table_misses += run.table_misses;
+    latency_merge(&stats->latency, &run.latency);
+    free_traffic_log(&log);
+}
+
+// Synthetic load for the thread benchmark: requests of a fixed length under
+// a rotating set of keys, offered as fast as the service takes them
+typedef struct {
+    unsigned long count;
+    unsigned long next;
+    int keys;
+    size_t length;
+} ServiceLoad;
+
+static int load_source(Service* service, ServiceRequest* request) {
+    ServiceLoad* load = (ServiceLoad*)service->source_context;
+    int key = (int)(load->next % (unsigned long)load->keys);
+
+    if (load->next == load->count) {
+        return -1;
+    }
+    load->next++;
+
+    ensure_capacity(request, load->length + 6);
+    request->line[0] = (char)('A' + key / (ALPHABET_SIZE * ALPHABET_SIZE) % ALPHABET_SIZE);
+    request->line[1] = (char)('A' + key / ALPHABET_SIZE % ALPHABET_SIZE);
+    request->line[2] = (char)('A' + key % ALPHABET_SIZE);
+    request->line[3] = '\t';
+    for (size_t i = 0; i < load->length; i++) {
+        request->line[4 + i] = REPLAY_FILLER[i % (sizeof(REPLAY_FILLER) - 1)];
+    }
+    request->line[4 + load->length] = '\n';
+    request->line[5 + load->length] = '\0';
+    request->length = load->length + 5;
+    request->arrival = clock_microseconds();
+    return 0;
+}
+
+// Serve count requests of length letters under keys keys with workers
+// workers; served (if not NULL) receives each worker's request count
+void run_service_load(const EnigmaState* state, int workers, unsigned long count, int keys, size_t length,
+                      unsigned long* served, RunStats* stats) {
+    ServiceLoad load;
+    Service service;
+
+    memset(&load, 0, sizeof(ServiceLoad));
+    load.count = count;
+    load.keys = keys;
+    load.length = length;
+    memset(&service, 0, sizeof(Service));
+    service.base = state;
+    service.workers = workers;
+    service.source = load_source;
+    service.source_context = &load;
+    service.served_out = served;
+    service_run(&service, stats);
+}
@@ -0,0 +1,673 @@
+/*
+ * Program Name: Unigma
+ * Program Release Year: 2025
+ * Program Author: Steven S.
+ * Program Link: https://github.com/BitEU/Unigma
+ * Purpose: Machine models for Unigma - model files and recovery of an unknown rotor or reflector wiring
+ */
+
+#include "unigma.h"
+
+// Machine model files
+//
+// A model names the wiring of the three rotors and the reflector, one per
+// line; blank lines and lines starting with # are ignored:
+//
+//   rotor 1 EKMFLGDQVZNTOWYHXUSPAIBRCJ V
+//   rotor 2 AJDKSIRUXBLHWTMCQGZNPYFVOE E
+//   rotor 3 BDFHJLCPRTXVZNYEIWGAKMUSQO Q
+//   reflector YRUHQSLDPXNGOKMIEBFZCWVJAT
+//
+// A rotor line gives where A..Z are wired to and the letter in the window
+// at which the rotor carries the next one over. Lines left out keep the
+// built-in wiring, so a model can replace a single rotor. --recover-wiring
+// writes its result in this format.
+
+#define WIRING_RESTARTS 64              // Hill-climbing restarts over all threads
+#define WIRING_KICKS 32                 // Perturbations of a peak that fail to improve it
+#define WIRING_KICK_MOVES 3             // Random moves per perturbation
+#define WIRING_MAX_LETTERS 65536        // Letters of the messages used in the climb
+
+static char model_wirings[NUM_ROTOR_WIRINGS][ALPHABET_SIZE + 1];
+
+// Whether wiring is a permutation of A-Z; a reflector must also pair
+// every letter with a different one
+static int valid_wiring(const char* wiring, int reflector) {
+    int seen = 0;
+
+    if (strlen(wiring) != ALPHABET_SIZE) {
+        return 0;
+    }
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        int c = wiring[i] - 'A';
+        if (c < 0 || c >= ALPHABET_SIZE || (seen & (1 << c))) {
+            return 0;
+        }
+        if (reflector && (c == i || wiring[c] - 'A' != i)) {
+            return 0;
+        }
+        seen |= 1 << c;
+    }
+    return 1;
+}
+
+// Read a model file into ROTOR_WIRINGS and NOTCH_POSITIONS_INIT and rewire
+// the machine in state with it, keeping its rotor order, rings and positions
+void load_machine_model(const char* path, EnigmaState* state) {
+    FILE* in = fopen(path, "r");
+    char* line = NULL;
+    size_t capacity = 0;
+    unsigned long line_number = 0;
+
+    if (!in) {
+        fprintf(stderr, "Error: Could not open machine model '%s'\n", path);
+        exit(1);
+    }
+
+    while (read_line(in, &line, &capacity) >= 0) {
+        char kind[16];
+        char wiring[64];
+        char extra[16];
+        int fields;
+
+        line_number++;
+        fields = sscanf(line, "%15s %63s %15s", kind, wiring, extra);
+        if (fields <= 0 || kind[0] == '#') {
+            continue;
+        }
+
+        if (strcmp(kind, "rotor") == 0) {
+            char notch[16];
+            int rotor = wiring[0] - '1';
+
+            if (fields != 3 || wiring[1] != '\0' || rotor < 0 || rotor >= NUM_ROTORS ||
+                sscanf(line, "%*s %*s %63s %15s", wiring, notch) != 2 ||
+                !valid_wiring(wiring, 0) || notch[1] != '\0' || notch[0] < 'A' || notch[0] > 'Z') {
+                fprintf(stderr, "Error: Line %lu of '%s' is not 'rotor 1-3 WIRING NOTCH'\n", line_number, path);
+                exit(1);
+            }
+            SAFE_STRCPY(model_wirings[rotor], wiring, ALPHABET_SIZE + 1);
+            ROTOR_WIRINGS[rotor] = model_wirings[rotor];
+            // Notches are kept by slot of the default machine (rotor III on the right)
+            NOTCH_POSITIONS_INIT[NUM_ROTORS - 1 - rotor] = notch[0] - 'A';
+        } else if (strcmp(kind, "reflector") == 0) {
+            if (fields != 2 || !valid_wiring(wiring, 1)) {
+                fprintf(stderr, "Error: Line %lu of '%s' is not 'reflector WIRING' with letters in pairs\n",
+                        line_number, path);
+                exit(1);
+            }
+            SAFE_STRCPY(model_wirings[NUM_ROTORS], wiring, ALPHABET_SIZE + 1);
+            ROTOR_WIRINGS[NUM_ROTORS] = model_wirings[NUM_ROTORS];
+        } else {
+            fprintf(stderr, "Error: Line %lu of '%s' is neither a rotor nor a reflector\n", line_number, path);
+            exit(1);
+        }
+    }
+    memory_free(line);
+    fclose(in);
+
+    int order[NUM_ROTORS];
+    memcpy(order, state->rotor_order, sizeof(order));
+    SAFE_STRCPY(state->rotors[NUM_ROTORS].wiring, ROTOR_WIRINGS[NUM_ROTORS], ALPHABET_SIZE + 1);
+    apply_rotor_order(state, order);
+}
+
+// Write the current model
+static void print_machine_model(void) {
+    printf("# Unigma machine model\n");
+    for (int rotor = 0; rotor < NUM_ROTORS; rotor++) {
+        printf("rotor %d %s %c\n", rotor + 1, ROTOR_WIRINGS[rotor],
+               'A' + NOTCH_POSITIONS_INIT[NUM_ROTORS - 1 - rotor]);
+    }
+    printf("reflector %s\n", ROTOR_WIRINGS[NUM_ROTORS]);
+}
+
+// Unknown wiring recovery
+//
+// Everything but one rotor (or the reflector) is known: order, rings,
+// plugboard, start positions and the wiring of the other parts. For every
+// letter the known parts are compiled into two small tables around the
+// unknown one. With the unknown rotor in slot s at offset o, a cipher letter
+// enters it at the fixed contact u = outer(c) + o; the known rotors further
+// in and the reflector map its exit contact back (inner), and the way out
+// through the known rotors and the plugboard gives the plain letter:
+//
+//   plain = outer_back[Finv[inner[F[u] - o] + o] - o]
+//
+// For the reflector it is just plain = outer_back[U[outer(c)]].
+//
+// A candidate wiring F is scored on the decrypts: letters matching the known
+// plaintext where a message has one, letter coincidences where it does not
+// (messages in depth). The climb swaps two outputs of F (for a reflector,
+// re-pairs two pairs), and only letters whose path used a changed entry are
+// decrypted again. Restarts from random wirings run on all threads.
+//
+// Stepping still needs the unknown rotor's notch, which is taken from the
+// model in use; --turnover finds where a rotor turns over.
+
+typedef struct {
+    unsigned char entry;                // Contact u (rotor) or reflector input
+    unsigned char plain;                // Known plain letter, or PASS_THROUGH
+    unsigned char offset;               // Offset of the unknown rotor
+    unsigned char inner[ALPHABET_SIZE]; // Exit contact -> return contact (rotor only)
+    unsigned char back[ALPHABET_SIZE];  // Return contact -> plain letter
+} WiringLetter;
+
+typedef struct {
+    WiringLetter* letters;
+    size_t count;
+    size_t known;                       // Letters with a known plain letter
+    int reflector;                      // The unknown part is the reflector
+    int workers;
+    int* by_entry;                      // Letters sorted by entry contact
+    int entry_start[ALPHABET_SIZE + 1]; // Where each contact's letters start in by_entry
+    int offsets;                        // Distinct offsets the unknown rotor took
+    volatile int solved;                // Every known letter matched: stop
+    double best_score[MAX_THREADS];
+    unsigned char best[MAX_THREADS][ALPHABET_SIZE];
+} WiringSearch;
+
+// Climb state of one worker
+typedef struct {
+    unsigned char forward[ALPHABET_SIZE];
+    unsigned char inverse[ALPHABET_SIZE];
+    unsigned char* decrypt;             // Current plain letter of every letter
+    unsigned char* via;                 // Inverse entry every letter went through
+    unsigned char* trial;               // Plain letters of the move being tried
+    unsigned char* trial_via;
+    int* touched;                       // Letters the move affects
+    int touched_count;
+    int* via_next;                      // Letters chained by via, so a move finds its letters
+    int* via_prev;
+    int via_head[ALPHABET_SIZE];
+    unsigned* seen;                     // Move stamp of the letters already rescored
+    unsigned stamp;
+    long matches;
+    long counts[ALPHABET_SIZE];
+} WiringClimb;
+
+static int wiring_letter(const WiringSearch* search, const WiringClimb* climb,
+                         const WiringLetter* letter, int* via) {
+    if (search->reflector) {
+        *via = letter->entry;
+        return letter->back[climb->forward[letter->entry]];
+    }
+    int o = letter->offset;
+    int z = letter->inner[(climb->forward[letter->entry] + ALPHABET_SIZE - o) % ALPHABET_SIZE];
+    *via = (z + o) % ALPHABET_SIZE;
+    return letter->back[(climb->inverse[*via] + ALPHABET_SIZE - o) % ALPHABET_SIZE];
+}
+
+// Known letters matched dominate; coincidences break ties and carry depth-only runs
+static double wiring_score(const WiringSearch* search, long matches, const long counts[ALPHABET_SIZE]) {
+    double coincidences = 0.0;
+
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        coincidences += (double)counts[i] * (double)(counts[i] - 1);
+    }
+    return (double)matches * (double)search->count * (double)search->count + coincidences;
+}
+
+static void via_link(WiringClimb* climb, int k, int via) {
+    int head = climb->via_head[via];
+
+    climb->via[k] = (unsigned char)via;
+    climb->via_prev[k] = -1;
+    climb->via_next[k] = head;
+    if (head >= 0) {
+        climb->via_prev[head] = k;
+    }
+    climb->via_head[via] = k;
+}
+
+static void via_unlink(WiringClimb* climb, int k) {
+    int prev = climb->via_prev[k];
+    int next = climb->via_next[k];
+
+    if (prev >= 0) {
+        climb->via_next[prev] = next;
+    } else {
+        climb->via_head[climb->via[k]] = next;
+    }
+    if (next >= 0) {
+        climb->via_prev[next] = prev;
+    }
+}
+
+static void wiring_decrypt_all(const WiringSearch* search, WiringClimb* climb) {
+    climb->matches = 0;
+    memset(climb->counts, 0, sizeof(climb->counts));
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        climb->via_head[i] = -1;
+    }
+    for (size_t k = 0; k < search->count; k++) {
+        const WiringLetter* letter = &search->letters[k];
+        int via;
+        int plain = wiring_letter(search, climb, letter, &via);
+
+        climb->decrypt[k] = (unsigned char)plain;
+        via_link(climb, (int)k, via);
+        climb->counts[plain]++;
+        climb->matches += plain == letter->plain;
+    }
+}
+
+static void wiring_random_start(const WiringSearch* search, WiringClimb* climb, unsigned long* seed) {
+    unsigned char letters[ALPHABET_SIZE];
+
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        letters[i] = (unsigned char)i;
+    }
+    for (int i = ALPHABET_SIZE - 1; i > 0; i--) {
+        *seed = *seed * 1103515245UL + 12345UL;
+        int j = (int)((*seed >> 16) % (unsigned long)(i + 1));
+        unsigned char t = letters[i];
+        letters[i] = letters[j];
+        letters[j] = t;
+    }
+    if (search->reflector) {
+        // Pair the shuffled letters off
+        for (int i = 0; i < ALPHABET_SIZE; i += 2) {
+            climb->forward[letters[i]] = letters[i + 1];
+            climb->forward[letters[i + 1]] = letters[i];
+        }
+    } else {
+        memcpy(climb->forward, letters, ALPHABET_SIZE);
+    }
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        climb->inverse[climb->forward[i]] = (unsigned char)i;
+    }
+}
+
+// Apply a move: swap the outputs of inputs a and b, or for a reflector
+// re-pair a-U[a], b-U[b] as a-b, U[a]-U[b]
+static void wiring_move(const WiringSearch* search, WiringClimb* climb, int a, int b) {
+    if (search->reflector) {
+        int pa = climb->forward[a];
+        int pb = climb->forward[b];
+        climb->forward[a] = (unsigned char)b;
+        climb->forward[b] = (unsigned char)a;
+        climb->forward[pa] = (unsigned char)pb;
+        climb->forward[pb] = (unsigned char)pa;
+    } else {
+        unsigned char t = climb->forward[a];
+        climb->forward[a] = climb->forward[b];
+        climb->forward[b] = t;
+    }
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        climb->inverse[climb->forward[i]] = (unsigned char)i;
+    }
+}
+
+// Decrypt letter k again under a move being tried
+static void wiring_rescore(const WiringSearch* search, WiringClimb* climb, int k,
+                           long* matches, long counts[ALPHABET_SIZE]) {
+    const WiringLetter* letter = &search->letters[k];
+    int via;
+    int plain;
+    int old = climb->decrypt[k];
+
+    if (climb->seen[k] == climb->stamp) {
+        return;
+    }
+    climb->seen[k] = climb->stamp;
+    plain = wiring_letter(search, climb, letter, &via);
+    counts[old]--;
+    counts[plain]++;
+    *matches += (plain == letter->plain) - (old == letter->plain);
+    climb->trial[k] = (unsigned char)plain;
+    climb->trial_via[k] = (unsigned char)via;
+    climb->touched[climb->touched_count++] = k;
+}
+
+// Try one move; keep it if the score goes up. Returns whether it was kept.
+static int wiring_try(const WiringSearch* search, WiringClimb* climb, int a, int b, double* score) {
+    unsigned char before[ALPHABET_SIZE];
+    int changed[4];
+    long matches = climb->matches;
+    long counts[ALPHABET_SIZE];
+
+    if (search->reflector && climb->forward[a] == b) {
+        return 0;
+    }
+    changed[0] = a;
+    changed[1] = b;
+    changed[2] = climb->forward[a];
+    changed[3] = climb->forward[b];
+
+    memcpy(before, climb->forward, sizeof(before));
+    memcpy(counts, climb->counts, sizeof(counts));
+    wiring_move(search, climb, a, b);
+
+    if (++climb->stamp == 0) {
+        memset(climb->seen, 0, search->count * sizeof(unsigned));
+        climb->stamp = 1;
+    }
+    climb->touched_count = 0;
+
+    // Letters that entered through a changed entry (for a rotor, the outputs
+    // of a and b; for a reflector, all four letters re-paired)...
+    for (int e = 0; e < (search->reflector ? 4 : 2); e++) {
+        for (int i = search->entry_start[changed[e]]; i < search->entry_start[changed[e] + 1]; i++) {
+            wiring_rescore(search, climb, search->by_entry[i], &matches, counts);
+        }
+    }
+    // ...or came back through one whose inverse changed
+    if (!search->reflector) {
+        for (int e = 2; e < 4; e++) {
+            for (int k = climb->via_head[changed[e]]; k >= 0; k = climb->via_next[k]) {
+                wiring_rescore(search, climb, k, &matches, counts);
+            }
+        }
+    }
+
+    double trial = wiring_score(search, matches, counts);
+    if (trial <= *score) {
+        memcpy(climb->forward, before, sizeof(before));
+        for (int i = 0; i < ALPHABET_SIZE; i++) {
+            climb->inverse[climb->forward[i]] = (unsigned char)i;
+        }
+        return 0;
+    }
+
+    for (int t = 0; t < climb->touched_count; t++) {
+        int k = climb->touched[t];
+
+        climb->decrypt[k] = climb->trial[k];
+        if (climb->trial_via[k] != climb->via[k]) {
+            via_unlink(climb, k);
+            via_link(climb, k, climb->trial_via[k]);
+        }
+    }
+    climb->matches = matches;
+    memcpy(climb->counts, counts, sizeof(counts));
+    *score = trial;
+    return 1;
+}
+
+// Take improving moves until none is left
+static void wiring_climb(WiringSearch* search, WiringClimb* climb, double* score) {
+    int improved = 1;
+
+    while (improved && !search->solved) {
+        improved = 0;
+        for (int a = 0; a < ALPHABET_SIZE; a++) {
+            for (int b = a + 1; b < ALPHABET_SIZE; b++) {
+                improved |= wiring_try(search, climb, a, b, score);
+            }
+        }
+    }
+}
+
+static void wiring_set(const WiringSearch* search, WiringClimb* climb, const unsigned char forward[ALPHABET_SIZE]) {
+    memcpy(climb->forward, forward, ALPHABET_SIZE);
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        climb->inverse[climb->forward[i]] = (unsigned char)i;
+    }
+    wiring_decrypt_all(search, climb);
+}
+
+static void init_climb(const WiringSearch* search, WiringClimb* climb) {
+    size_t count = search->count;
+
+    climb->decrypt = (unsigned char*)memory_alloc(MEM_SEARCH, count * 4);
+    climb->touched = (int*)memory_alloc(MEM_SEARCH, count * 3 * sizeof(int));
+    climb->seen = (unsigned*)memory_calloc(MEM_SEARCH, count, sizeof(unsigned));
+    if (!climb->decrypt || !climb->touched || !climb->seen) {
+        fprintf(stderr, "Error: Out of memory in wiring search\n");
+        exit(1);
+    }
+    climb->via = climb->decrypt + count;
+    climb->trial = climb->via + count;
+    climb->trial_via = climb->trial + count;
+    climb->via_next = climb->touched + count;
+    climb->via_prev = climb->via_next + count;
+    climb->stamp = 0;
+}
+
+static void free_climb(WiringClimb* climb) {
+    memory_free(climb->decrypt);
+    memory_free(climb->touched);
+    memory_free(climb->seen);
+}
+
+static void wiring_worker(void* context, int worker) {
+    WiringSearch* search = (WiringSearch*)context;
+    WiringClimb climb;
+
+    init_climb(search, &climb);
+    search->best_score[worker] = -1.0;
+
+    for (int restart = worker; restart < WIRING_RESTARTS && !search->solved; restart += search->workers) {
+        unsigned long seed = 2654435761UL * (unsigned long)(restart + 1);
+        double score;
+
+        wiring_random_start(search, &climb, &seed);
+        wiring_decrypt_all(search, &climb);
+        score = wiring_score(search, climb.matches, climb.counts);
+        wiring_climb(search, &climb, &score);
+
+        // Kick the peak with a few random moves and climb again; keep the
+        // result unless it scores lower, until kicks stop paying off
+        for (int stall = 0; stall < WIRING_KICKS && !search->solved &&
+             !(search->known && (size_t)climb.matches == search->known); stall++) {
+            unsigned char peak[ALPHABET_SIZE];
+            double peak_score = score;
+
+            memcpy(peak, climb.forward, ALPHABET_SIZE);
+            for (int m = 0; m < WIRING_KICK_MOVES; m++) {
+                seed = seed * 1103515245UL + 12345UL;
+                int a = (int)((seed >> 16) % ALPHABET_SIZE);
+                int b = (int)((seed >> 8) % ALPHABET_SIZE);
+                if (a != b && (!search->reflector || climb.forward[a] != b)) {
+                    wiring_move(search, &climb, a, b);
+                }
+            }
+            wiring_decrypt_all(search, &climb);
+            score = wiring_score(search, climb.matches, climb.counts);
+            wiring_climb(search, &climb, &score);
+            if (score < peak_score) {
+                wiring_set(search, &climb, peak);
+                score = peak_score;
+            } else if (score > peak_score) {
+                stall = -1;
+            }
+        }
+
+        if (score > search->best_score[worker]) {
+            search->best_score[worker] = score;
+            memcpy(search->best[worker], climb.forward, ALPHABET_SIZE);
+        }
+        if (search->known && (size_t)climb.matches == search->known) {
+            search->solved = 1;
+        }
+        UNIGMA_PROBE3(search__unit, "wiring", restart, worker);
+    }
+
+    free_climb(&climb);
+}
+
+// Pass c (0-25) through the rotor in slot at offset o, inwards or back out
+static int through_slot(const CompiledMachine* compiled, int slot, int o, int c, int inwards) {
+    const unsigned char* table = inwards ? compiled->forward[slot] : compiled->reverse[slot];
+    return (table[(c + o) % ALPHABET_SIZE] + ALPHABET_SIZE - o) % ALPHABET_SIZE;
+}
+
+// Compile the known parts around the unknown one for every letter of the
+// messages (CIPHERTEXT or CIPHERTEXT<TAB>PLAINTEXT per line, in depth from
+// the -p positions)
+static void read_wiring_messages(WiringSearch* search, const EnigmaState* base, int unknown, const char* path) {
+    FILE* in = fopen(path, "r");
+    char* line = NULL;
+    size_t capacity = 0;
+    CompiledMachine compiled;
+    int slot = NUM_ROTORS;              // Slot of the unknown part; NUM_ROTORS = reflector
+    unsigned char* cipher = (unsigned char*)memory_alloc(MEM_SEARCH, WIRING_MAX_LETTERS);
+    unsigned char* plain = (unsigned char*)memory_alloc(MEM_SEARCH, WIRING_MAX_LETTERS);
+
+    if (!in) {
+        fprintf(stderr, "Error: Could not open message file '%s'\n", path);
+        exit(1);
+    }
+    search->letters = (WiringLetter*)memory_alloc(MEM_SEARCH, WIRING_MAX_LETTERS * sizeof(WiringLetter));
+    if (!cipher || !plain || !search->letters) {
+        fprintf(stderr, "Error: Out of memory reading messages\n");
+        exit(1);
+    }
+    for (int s = 0; s < NUM_ROTORS; s++) {
+        if (base->rotor_order[s] == unknown) {
+            slot = s;
+        }
+    }
+    compile_machine(base, &compiled);
+
+    while (read_line(in, &line, &capacity) >= 0 && search->count < WIRING_MAX_LETTERS) {
+        char* tab = strchr(line, '\t');
+        int room = (int)(WIRING_MAX_LETTERS - search->count);
+        int plain_length = tab ? letters_of(tab + 1, plain, WIRING_MAX_LETTERS) : 0;
+        EnigmaState machine = *base;
+
+        if (tab) {
+            *tab = '\0';
+        }
+        int cipher_length = letters_of(line, cipher, room);
+        for (int i = 0; i < cipher_length; i++) {
+            WiringLetter* letter = &search->letters[search->count++];
+            int o[NUM_ROTORS];
+
+            step_rotors(&machine);
+            for (int s = 0; s < NUM_ROTORS; s++) {
+                o[s] = mod_positive(machine.positions[s] - compiled.rings[s]);
+            }
+
+            // In from the cipher side up to the unknown part
+            int c = compiled.plug[cipher[i]];
+            for (int s = 0; s < slot; s++) {
+                c = through_slot(&compiled, s, o[s], c, 1);
+            }
+            letter->entry = (unsigned char)(slot < NUM_ROTORS ? (c + o[slot]) % ALPHABET_SIZE : c);
+            letter->offset = (unsigned char)(slot < NUM_ROTORS ? o[slot] : 0);
+            letter->plain = i < plain_length ? plain[i] : PASS_THROUGH;
+            search->known += i < plain_length;
+
+            for (int x = 0; x < ALPHABET_SIZE; x++) {
+                // The known inner part: further rotors, reflector and back
+                if (slot < NUM_ROTORS) {
+                    int z = x;
+                    for (int s = slot + 1; s < NUM_ROTORS; s++) {
+                        z = through_slot(&compiled, s, o[s], z, 1);
+                    }
+                    z = compiled.reflector[z];
+                    for (int s = NUM_ROTORS - 1; s > slot; s--) {
+                        z = through_slot(&compiled, s, o[s], z, 0);
+                    }
+                    letter->inner[x] = (unsigned char)z;
+                }
+                // And the way back out to a plain letter
+                int p = x;
+                for (int s = slot - 1; s >= 0; s--) {
+                    p = through_slot(&compiled, s, o[s], p, 0);
+                }
+                letter->back[x] = compiled.plug[p];
+            }
+        }
+    }
+
+    memory_free(line);
+    memory_free(cipher);
+    memory_free(plain);
+    fclose(in);
+
+    // Index the letters by entry contact, and count the unknown rotor's offsets
+    int offsets = 0;
+    search->by_entry = (int*)memory_alloc(MEM_SEARCH, (search->count + 1) * sizeof(int));
+    if (!search->by_entry) {
+        fprintf(stderr, "Error: Out of memory reading messages\n");
+        exit(1);
+    }
+    for (size_t k = 0; k < search->count; k++) {
+        search->entry_start[search->letters[k].entry + 1]++;
+        offsets |= 1 << search->letters[k].offset;
+    }
+    for (int e = 0; e < ALPHABET_SIZE; e++) {
+        search->entry_start[e + 1] += search->entry_start[e];
+    }
+    int fill[ALPHABET_SIZE];
+    memcpy(fill, search->entry_start, sizeof(fill));
+    for (size_t k = 0; k < search->count; k++) {
+        search->by_entry[fill[search->letters[k].entry]++] = (int)k;
+    }
+    for (; offsets; offsets &= offsets - 1) {
+        search->offsets++;
+    }
+}
+
+void run_recover_wiring(const EnigmaState* state, const RunOptions* options) {
+    WiringSearch search;
+    int unknown;
+    int best = 0;
+
+    memset(&search, 0, sizeof(WiringSearch));
+    if (strcmp(options->text, "R") == 0) {
+        unknown = NUM_ROTORS;
+        search.reflector = 1;
+    } else if (options->text[0] >= '1' && options->text[0] <= '3' && options->text[1] == '\0') {
+        unknown = options->text[0] - '1';
+    } else {
+        fprintf(stderr, "Error: --recover-wiring needs rotor 1, 2 or 3, or R for the reflector\n");
+        exit(1);
+    }
+
+    read_wiring_messages(&search, state, unknown, options->path);
+    if (search.count == 0) {
+        fprintf(stderr, "Error: No letters in '%s'\n", options->path);
+        exit(1);
+    }
+
+    search.workers = options->threads > 0 ? options->threads : default_thread_count();
+    if (search.workers > MAX_THREADS) {
+        search.workers = MAX_THREADS;
+    }
+    run_workers(search.workers, wiring_worker, &search);
+
+    for (int w = 1; w < search.workers; w++) {
+        if (search.best_score[w] > search.best_score[best]) {
+            best = w;
+        }
+    }
+
+    // Score the winner again for the report
+    WiringClimb climb;
+    unsigned long counts[ALPHABET_SIZE];
+    char* wiring = model_wirings[unknown];
+
+    init_climb(&search, &climb);
+    wiring_set(&search, &climb, search.best[best]);
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        wiring[i] = (char)('A' + climb.forward[i]);
+    }
+    wiring[ALPHABET_SIZE] = '\0';
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        counts[i] = (unsigned long)climb.counts[i];
+    }
+
+    if (search.reflector) {
+        fprintf(stderr, "Recovered the reflector");
+    } else {
+        fprintf(stderr, "Recovered rotor %d", unknown + 1);
+    }
+    fprintf(stderr, " from %lu letters (%ld of %lu known letters match, letter IoC %.4f)\n",
+            (unsigned long)search.count, climb.matches, (unsigned long)search.known, ioc_score(counts));
+    if (!search.reflector && search.offsets < 2) {
+        // At one offset only the rotor's conjugate of the inner part shows,
+        // which many wirings share
+        fprintf(stderr, "Warning: Rotor %d did not move in the messages; other wirings fit them as well\n",
+                unknown + 1);
+    }
+
+    ROTOR_WIRINGS[unknown] = wiring;
+    print_machine_model();
+    free_climb(&climb);
+    memory_free(search.by_entry);
+    memory_free(search.letters);
+}